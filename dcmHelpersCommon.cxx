@@ -1,10 +1,23 @@
 #include "dcmHelpersCommon.h"
+#include "dcmHelpersTerminology.h"
 #include "dcmtk/config/osconfig.h"
 #include "dcmtk/dcmdata/dctk.h"
 #include "dcmtk/dcmsr/dsriodcc.h"
 #include "dcmtk/dcmsr/dsrdoc.h"
 
-#define WARN_IF_ERROR(X,M) X
+#include <algorithm>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+#include <dirent.h>
+#include <sys/stat.h>
+
+static bool succeeded(size_t nodeID){ return nodeID > 0; }
+static bool succeeded(const OFCondition &cond){ return cond.good(); }
+
+#define WARN_IF_ERROR(X,M) do { if(!succeeded(X)) std::cerr << "Failed to add " << M << std::endl; } while(0)
 
 // List of tags copied from David Clunie's Pixelmed toolkit
 
@@ -235,17 +248,19 @@ void dcmHelpersCommon::findAndGetCodedValueFromSequenceItem(DcmItem *seq,
 */
 
 void dcmHelpersCommon::addLanguageOfContent(DSRDocument *doc){
-  doc->getTree().addContentItem(DSRTypes::RT_hasConceptMod, DSRTypes::VT_Code, DSRTypes::AM_belowCurrent);
+  WARN_IF_ERROR(doc->getTree().addContentItem(DSRTypes::RT_hasConceptMod, DSRTypes::VT_Code, DSRTypes::AM_belowCurrent),
+                "Language of Content Item and Descendants");
   doc->getTree().getCurrentContentItem().setConceptName(
-                DSRCodedEntryValue("121049", "DCM", "Language of Content Item and Descendants"));
+                dcmHelpersTerminology::get(dcmHelpersTerminology::CODE_LanguageOfContent));
   doc->getTree().getCurrentContentItem().setCodeValue(
-                DSRCodedEntryValue("eng","RFC3066","English"));
+                dcmHelpersTerminology::get(dcmHelpersTerminology::CODE_English));
 
-  doc->getTree().addContentItem(DSRTypes::RT_hasConceptMod, DSRTypes::VT_Code, DSRTypes::AM_belowCurrent);
+  WARN_IF_ERROR(doc->getTree().addContentItem(DSRTypes::RT_hasConceptMod, DSRTypes::VT_Code, DSRTypes::AM_belowCurrent),
+                "Country of Language");
   doc->getTree().getCurrentContentItem().setConceptName(
-                DSRCodedEntryValue("121046", "DCM", "Country of Language"));
+                dcmHelpersTerminology::get(dcmHelpersTerminology::CODE_CountryOfLanguage));
   doc->getTree().getCurrentContentItem().setCodeValue(
-                DSRCodedEntryValue("US","ISO3166_1","United States"));
+                dcmHelpersTerminology::get(dcmHelpersTerminology::CODE_UnitedStates));
   doc->getTree().goUp();
 }
 
@@ -260,36 +275,42 @@ void dcmHelpersCommon::addObserverContext(DSRDocument *doc, const char* deviceOb
                                           const char* deviceObserverName, const char* deviceObserverManufacturer,
                                           const char* deviceObserverModelName, const char* deviceObserverSerialNumber){
     // TODO: TID 1001 Observation context
-    doc->getTree().addContentItem(DSRTypes::RT_hasObsContext, DSRTypes::VT_Code, DSRTypes::AM_afterCurrent);
+    WARN_IF_ERROR(doc->getTree().addContentItem(DSRTypes::RT_hasObsContext, DSRTypes::VT_Code, DSRTypes::AM_afterCurrent),
+                  "Observer Type");
     doc->getTree().getCurrentContentItem().setConceptName(
-                DSRCodedEntryValue("121005","DCM","Observer Type"));
+                dcmHelpersTerminology::get(dcmHelpersTerminology::CODE_ObserverType));
     doc->getTree().getCurrentContentItem().setCodeValue(
-                DSRCodedEntryValue("121007","DCM","Device"));
+                dcmHelpersTerminology::get(dcmHelpersTerminology::CODE_Device));
 
     // TODO: need to decide what UIDs we will use
-    doc->getTree().addContentItem(DSRTypes::RT_hasObsContext, DSRTypes::VT_UIDRef, DSRTypes::AM_afterCurrent);
+    WARN_IF_ERROR(doc->getTree().addContentItem(DSRTypes::RT_hasObsContext, DSRTypes::VT_UIDRef, DSRTypes::AM_afterCurrent),
+                  "Device Observer UID");
     doc->getTree().getCurrentContentItem().setConceptName(
-                DSRCodedEntryValue("121012","DCM","Device Observer UID"));
+                dcmHelpersTerminology::get(dcmHelpersTerminology::CODE_DeviceObserverUID));
     doc->getTree().getCurrentContentItem().setStringValue(deviceObserverUID);
 
-    doc->getTree().addContentItem(DSRTypes::RT_hasObsContext, DSRTypes::VT_Text, DSRTypes::AM_afterCurrent);
+    WARN_IF_ERROR(doc->getTree().addContentItem(DSRTypes::RT_hasObsContext, DSRTypes::VT_Text, DSRTypes::AM_afterCurrent),
+                  "Device Observer Name");
     doc->getTree().getCurrentContentItem().setConceptName(
-                DSRCodedEntryValue("121013","DCM","Device Observer Name"));
+                dcmHelpersTerminology::get(dcmHelpersTerminology::CODE_DeviceObserverName));
     doc->getTree().getCurrentContentItem().setStringValue(deviceObserverName);
 
-    doc->getTree().addContentItem(DSRTypes::RT_hasObsContext, DSRTypes::VT_Text, DSRTypes::AM_afterCurrent);
+    WARN_IF_ERROR(doc->getTree().addContentItem(DSRTypes::RT_hasObsContext, DSRTypes::VT_Text, DSRTypes::AM_afterCurrent),
+                  "Device Observer Manufacturer");
     doc->getTree().getCurrentContentItem().setConceptName(
-                DSRCodedEntryValue("121014","DCM","Device Observer Manufacturer"));
+                dcmHelpersTerminology::get(dcmHelpersTerminology::CODE_DeviceObserverManufacturer));
     doc->getTree().getCurrentContentItem().setStringValue(deviceObserverManufacturer);
 
-    doc->getTree().addContentItem(DSRTypes::RT_hasObsContext, DSRTypes::VT_Text, DSRTypes::AM_afterCurrent);
+    WARN_IF_ERROR(doc->getTree().addContentItem(DSRTypes::RT_hasObsContext, DSRTypes::VT_Text, DSRTypes::AM_afterCurrent),
+                  "Device Observer Model Name");
     doc->getTree().getCurrentContentItem().setConceptName(
-                DSRCodedEntryValue("121015","DCM","Device Observer Model Name"));
+                dcmHelpersTerminology::get(dcmHelpersTerminology::CODE_DeviceObserverModelName));
     doc->getTree().getCurrentContentItem().setStringValue(deviceObserverModelName);
 
-    doc->getTree().addContentItem(DSRTypes::RT_hasObsContext, DSRTypes::VT_Text, DSRTypes::AM_afterCurrent);
+    WARN_IF_ERROR(doc->getTree().addContentItem(DSRTypes::RT_hasObsContext, DSRTypes::VT_Text, DSRTypes::AM_afterCurrent),
+                  "Device Observer Serial Number");
     doc->getTree().getCurrentContentItem().setConceptName(
-                DSRCodedEntryValue("121016","DCM","Device Observer Serial Number"));
+                dcmHelpersTerminology::get(dcmHelpersTerminology::CODE_DeviceObserverSerialNumber));
     doc->getTree().getCurrentContentItem().setStringValue(deviceObserverSerialNumber);
 }
 
@@ -301,11 +322,56 @@ void dcmHelpersCommon::addSubjectContext(DSRDocument *doc){
   // TODO
 }
 
+/*
+ * Look up an attribute of the given frame (1-based) of a multi-frame image:
+ * in the top-level dataset first, then in the functional group macro of the
+ * per-frame and the shared functional groups that holds the attribute.
+ */
+OFCondition dcmHelpersCommon::findAndGetFrameElement(DcmItem *dataset, long frameNumber,
+                                                     const DcmTagKey &tag, DcmElement *&element){
+  OFCondition cond = dataset->findAndGetElement(tag, element);
+  if(cond.good() || frameNumber < 1)
+    return cond;
+
+  DcmTagKey macroTag;
+  if(tag == DCM_PixelSpacing || tag == DCM_SliceThickness || tag == DCM_SpacingBetweenSlices)
+    macroTag = DCM_PixelMeasuresSequence;
+  else if(tag == DCM_ImagePositionPatient)
+    macroTag = DCM_PlanePositionSequence;
+  else if(tag == DCM_ImageOrientationPatient)
+    macroTag = DCM_PlaneOrientationSequence;
+  else if(tag == DCM_RescaleSlope || tag == DCM_RescaleIntercept || tag == DCM_RescaleType)
+    macroTag = DCM_PixelValueTransformationSequence;
+  else
+    return cond;
+
+  DcmItem *groupItem, *macroItem;
+  if(dataset->findAndGetSequenceItem(DCM_PerFrameFunctionalGroupsSequence, groupItem, frameNumber-1).good() &&
+     groupItem->findAndGetSequenceItem(macroTag, macroItem).good() &&
+     macroItem->findAndGetElement(tag, element).good())
+    return EC_Normal;
+  if(dataset->findAndGetSequenceItem(DCM_SharedFunctionalGroupsSequence, groupItem).good() &&
+     groupItem->findAndGetSequenceItem(macroTag, macroItem).good())
+    return macroItem->findAndGetElement(tag, element);
+  return cond;
+}
+
+OFCondition dcmHelpersCommon::findAndGetFrameFloat64(DcmItem *dataset, long frameNumber,
+                                                     const DcmTagKey &tag, double &value){
+  DcmElement *element;
+  OFCondition cond = findAndGetFrameElement(dataset, frameNumber, tag, element);
+  if(cond.good())
+    cond = element->getFloat64(value);
+  return cond;
+}
+
 /*
  * Add Image Library entry (TID 4020) for the specified SR document
  * and DcmDataset correspnding to an image to the document.
+ * For multi-frame images, frameNumber (1-based) selects the frame that is
+ * referenced, and its geometry is taken from the functional groups.
  */
-void dcmHelpersCommon::addImageLibraryEntry(DSRDocument *doc, DcmDataset *imgDataset){
+void dcmHelpersCommon::addImageLibraryEntry(DSRDocument *doc, DcmDataset *imgDataset, long frameNumber){
     DcmElement *element;
     DcmItem *sequenceItem;
 
@@ -322,11 +388,14 @@ void dcmHelpersCommon::addImageLibraryEntry(DSRDocument *doc, DcmDataset *imgDat
     element->getString(elementStr);
     sopInstanceUID = std::string(elementStr);
 
-    doc->getTree().addContentItem(DSRTypes::RT_contains,DSRTypes::VT_Image,
-                                  DSRTypes::AM_belowCurrent);
+    WARN_IF_ERROR(doc->getTree().addContentItem(DSRTypes::RT_contains,DSRTypes::VT_Image,
+                                                DSRTypes::AM_belowCurrent),
+                  "image reference");
 
     DSRImageReferenceValue imageReference =
             DSRImageReferenceValue(sopClassUID.c_str(), sopInstanceUID.c_str());
+    if(frameNumber > 0)
+      imageReference.getFrameList().addItem(frameNumber);
     doc->getTree().getCurrentContentItem().setImageReference(imageReference);
 
     DSRCodedEntryValue codedValue;
@@ -337,12 +406,13 @@ void dcmHelpersCommon::addImageLibraryEntry(DSRDocument *doc, DcmDataset *imgDat
     if(imgDataset->findAndGetSequenceItem(DCM_ImageLaterality,sequenceItem).good()){
        codedValue.readSequence(*imgDataset, DCM_ImageLaterality,"2");
        //findAndGetCodedValueFromSequenceItem(sequenceItem, codedValue);
-       doc->getTree().addContentItem(DSRTypes::RT_hasAcqContext,
-                                     DSRTypes::VT_Code,
-                                     DSRTypes::AM_belowCurrent);
+       WARN_IF_ERROR(doc->getTree().addContentItem(DSRTypes::RT_hasAcqContext,
+                                                   DSRTypes::VT_Code,
+                                                   DSRTypes::AM_belowCurrent),
+                     "Image Laterality");
        addMode = DSRTypes::AM_afterCurrent;
        doc->getTree().getCurrentContentItem().setConceptName(
-                     DSRCodedEntryValue("111027","DCM","Image Laterality"));
+                     dcmHelpersTerminology::get(dcmHelpersTerminology::CODE_ImageLaterality));
        doc->getTree().getCurrentContentItem().setCodeValue(codedValue);
     }
 
@@ -350,22 +420,24 @@ void dcmHelpersCommon::addImageLibraryEntry(DSRDocument *doc, DcmDataset *imgDat
     if(imgDataset->findAndGetSequenceItem(DCM_ViewCodeSequence,sequenceItem).good()){
       //findAndGetCodedValueFromSequenceItem(sequenceItem,codedValue);
       codedValue.readSequence(*imgDataset, DCM_ViewCodeSequence, "2");
-      doc->getTree().addContentItem(DSRTypes::RT_hasAcqContext,
-                                    DSRTypes::VT_Code,
-                                    addMode);
+      WARN_IF_ERROR(doc->getTree().addContentItem(DSRTypes::RT_hasAcqContext,
+                                                  DSRTypes::VT_Code,
+                                                  addMode),
+                    "Image View");
       addMode = addMode == DSRTypes::AM_belowCurrent ? DSRTypes::AM_afterCurrent : addMode;
       doc->getTree().getCurrentContentItem().setConceptName(
-                  DSRCodedEntryValue("111031","DCM","Image View"));
+                  dcmHelpersTerminology::get(dcmHelpersTerminology::CODE_ImageView));
       doc->getTree().getCurrentContentItem().setCodeValue(codedValue);
 
       //if(imgDataset->findAndGetSequenceItem(DCM_ViewModifierCodeSequence,sequenceItem).good()){
       if(codedValue.readSequence(*imgDataset, DCM_ViewModifierCodeSequence, "2").good()){
         //findAndGetCodedValueFromSequenceItem(sequenceItem,codedValue);
-        doc->getTree().addContentItem(DSRTypes::RT_hasConceptMod,
-                                      DSRTypes::VT_Code,
-                                      DSRTypes::AM_belowCurrent);
+        WARN_IF_ERROR(doc->getTree().addContentItem(DSRTypes::RT_hasConceptMod,
+                                                    DSRTypes::VT_Code,
+                                                    DSRTypes::AM_belowCurrent),
+                      "Image View Modifier");
         doc->getTree().getCurrentContentItem().setConceptName(
-                        DSRCodedEntryValue("111032","DCM","Image View Modifier"));
+                        dcmHelpersTerminology::get(dcmHelpersTerminology::CODE_ImageViewModifier));
         doc->getTree().getCurrentContentItem().setCodeValue(codedValue);
         doc->getTree().goUp();
       }
@@ -374,35 +446,38 @@ void dcmHelpersCommon::addImageLibraryEntry(DSRDocument *doc, DcmDataset *imgDat
     // Patient Orientation - Row and Column separately
     if(imgDataset->findAndGetElement(DCM_PatientOrientation, element).good()){
         element->getOFString(elementOFString, 0);
-        doc->getTree().addContentItem(DSRTypes::RT_hasAcqContext,
-                                                    DSRTypes::VT_Text,
-                                                    addMode);
+        WARN_IF_ERROR(doc->getTree().addContentItem(DSRTypes::RT_hasAcqContext,
+                                                                  DSRTypes::VT_Text,
+                                                                  addMode),
+                      "Patient Orientation Row");
 
         addMode = addMode == DSRTypes::AM_belowCurrent ? DSRTypes::AM_afterCurrent : addMode;
 
         doc->getTree().getCurrentContentItem().setConceptName(
-                    DSRCodedEntryValue("111044","DCM","Patient Orientation Row"));
+                    dcmHelpersTerminology::get(dcmHelpersTerminology::CODE_PatientOrientationRow));
         doc->getTree().getCurrentContentItem().setStringValue(elementOFString.c_str());
 
         element->getOFString(elementOFString, 1);
-        doc->getTree().addContentItem(DSRTypes::RT_hasAcqContext,
-                                      DSRTypes::VT_Text,
-                                      DSRTypes::AM_afterCurrent);
+        WARN_IF_ERROR(doc->getTree().addContentItem(DSRTypes::RT_hasAcqContext,
+                                                    DSRTypes::VT_Text,
+                                                    DSRTypes::AM_afterCurrent),
+                      "Patient Orientation Column");
         doc->getTree().getCurrentContentItem().setConceptName(
-                    DSRCodedEntryValue("111043","DCM","Patient Orientation Column"));
+                    dcmHelpersTerminology::get(dcmHelpersTerminology::CODE_PatientOrientationColumn));
         doc->getTree().getCurrentContentItem().setStringValue(elementOFString.c_str());
     }
 
     // Study date
     if(imgDataset->findAndGetElement(DCM_StudyDate, element).good()){
         element->getOFString(elementOFString, 0);
-        doc->getTree().addContentItem(DSRTypes::RT_hasAcqContext,
-                                                    DSRTypes::VT_Date,
-                                                    addMode);
+        WARN_IF_ERROR(doc->getTree().addContentItem(DSRTypes::RT_hasAcqContext,
+                                                                  DSRTypes::VT_Date,
+                                                                  addMode),
+                      "Study Date");
         addMode = addMode == DSRTypes::AM_belowCurrent ? DSRTypes::AM_afterCurrent : addMode;
 
         doc->getTree().getCurrentContentItem().setConceptName(
-                    DSRCodedEntryValue("111060","DCM","Study Date"));
+                    dcmHelpersTerminology::get(dcmHelpersTerminology::CODE_StudyDate));
         doc->getTree().getCurrentContentItem().setStringValue(elementOFString.c_str());
     }
 
@@ -410,13 +485,14 @@ void dcmHelpersCommon::addImageLibraryEntry(DSRDocument *doc, DcmDataset *imgDat
     if(imgDataset->findAndGetElement(DCM_StudyTime, element).good()){
 
         element->getOFString(elementOFString, 0);
-        doc->getTree().addContentItem(DSRTypes::RT_hasAcqContext,
-                                      DSRTypes::VT_Time,
-                                      addMode);
+        WARN_IF_ERROR(doc->getTree().addContentItem(DSRTypes::RT_hasAcqContext,
+                                                    DSRTypes::VT_Time,
+                                                    addMode),
+                      "Study Time");
         addMode = addMode == DSRTypes::AM_belowCurrent ? DSRTypes::AM_afterCurrent : addMode;
 
         doc->getTree().getCurrentContentItem().setConceptName(
-                    DSRCodedEntryValue("111061","DCM","Study Time"));
+                    dcmHelpersTerminology::get(dcmHelpersTerminology::CODE_StudyTime));
         doc->getTree().getCurrentContentItem().setStringValue(elementOFString.c_str());
     }
 
@@ -424,68 +500,73 @@ void dcmHelpersCommon::addImageLibraryEntry(DSRDocument *doc, DcmDataset *imgDat
     if(imgDataset->findAndGetElement(DCM_ContentDate, element).good()){
 
         element->getOFString(elementOFString, 0);
-        doc->getTree().addContentItem(DSRTypes::RT_hasAcqContext,
-                                      DSRTypes::VT_Date,
-                                      addMode);
+        WARN_IF_ERROR(doc->getTree().addContentItem(DSRTypes::RT_hasAcqContext,
+                                                    DSRTypes::VT_Date,
+                                                    addMode),
+                      "Content Date");
         addMode = addMode == DSRTypes::AM_belowCurrent ? DSRTypes::AM_afterCurrent : addMode;
 
         doc->getTree().getCurrentContentItem().setConceptName(
-                    DSRCodedEntryValue("111018","DCM","Content Date"));
+                    dcmHelpersTerminology::get(dcmHelpersTerminology::CODE_ContentDate));
         doc->getTree().getCurrentContentItem().setStringValue(elementOFString.c_str());
     }
 
     // Content time
     if(imgDataset->findAndGetElement(DCM_ContentTime, element).good()){
         element->getOFString(elementOFString, 0);
-        doc->getTree().addContentItem(DSRTypes::RT_hasAcqContext,
-                                      DSRTypes::VT_Time,
-                                      addMode);
+        WARN_IF_ERROR(doc->getTree().addContentItem(DSRTypes::RT_hasAcqContext,
+                                                    DSRTypes::VT_Time,
+                                                    addMode),
+                      "Content Time");
         addMode = addMode == DSRTypes::AM_belowCurrent ? DSRTypes::AM_afterCurrent : addMode;
 
         doc->getTree().getCurrentContentItem().setConceptName(
-                    DSRCodedEntryValue("111019","DCM","Content Time"));
+                    dcmHelpersTerminology::get(dcmHelpersTerminology::CODE_ContentTime));
         doc->getTree().getCurrentContentItem().setStringValue(elementOFString.c_str());
     }
 
     // Pixel Spacing - horizontal and vertical separately
-    if(imgDataset->findAndGetElement(DCM_PixelSpacing, element).good()){
+    if(findAndGetFrameElement(imgDataset, frameNumber, DCM_PixelSpacing, element).good()){
         element->getOFString(elementOFString, 0);
-        doc->getTree().addContentItem(DSRTypes::RT_hasAcqContext,
-                                      DSRTypes::VT_Num,
-                                      addMode);
+        WARN_IF_ERROR(doc->getTree().addContentItem(DSRTypes::RT_hasAcqContext,
+                                                    DSRTypes::VT_Num,
+                                                    addMode),
+                      "Horizontal Pixel Spacing");
         addMode = addMode == DSRTypes::AM_belowCurrent ? DSRTypes::AM_afterCurrent : addMode;
 
         doc->getTree().getCurrentContentItem().setConceptName(
-                    DSRCodedEntryValue("111026","DCM","Horizontal Pixel Spacing"));
+                    dcmHelpersTerminology::get(dcmHelpersTerminology::CODE_HorizontalPixelSpacing));
         doc->getTree().getCurrentContentItem().setNumericValue(
                     DSRNumericMeasurementValue(elementOFString.c_str(),
-                                               DSRCodedEntryValue("mm","UCUM","millimeter")));
+                                               dcmHelpersTerminology::get(dcmHelpersTerminology::CODE_UnitMillimeter)));
 
         element->getOFString(elementOFString, 1);
-        doc->getTree().addContentItem(DSRTypes::RT_hasAcqContext,
-                                      DSRTypes::VT_Num,
-                                      DSRTypes::AM_afterCurrent);
+        WARN_IF_ERROR(doc->getTree().addContentItem(DSRTypes::RT_hasAcqContext,
+                                                    DSRTypes::VT_Num,
+                                                    DSRTypes::AM_afterCurrent),
+                      "Vertical Pixel Spacing");
         doc->getTree().getCurrentContentItem().setConceptName(
-                    DSRCodedEntryValue("111066","DCM","Vertical Pixel Spacing"));
+                    dcmHelpersTerminology::get(dcmHelpersTerminology::CODE_VerticalPixelSpacing));
         doc->getTree().getCurrentContentItem().setNumericValue(
                     DSRNumericMeasurementValue(elementOFString.c_str(),
-                                               DSRCodedEntryValue("mm","UCUM","millimeter")));
+                                               dcmHelpersTerminology::get(dcmHelpersTerminology::CODE_UnitMillimeter)));
     }
 
     // Positioner Primary Angle
     if(imgDataset->findAndGetElement(DCM_PositionerPrimaryAngle, element).good()){
 
         element->getOFString(elementOFString, 0);
-        doc->getTree().addContentItem(DSRTypes::RT_hasAcqContext,
-                                      DSRTypes::VT_Num,
-                                      addMode);
+        WARN_IF_ERROR(doc->getTree().addContentItem(DSRTypes::RT_hasAcqContext,
+                                                    DSRTypes::VT_Num,
+                                                    addMode),
+                      "Positioner Primary Angle");
         addMode = addMode == DSRTypes::AM_belowCurrent ? DSRTypes::AM_afterCurrent : addMode;
 
         doc->getTree().getCurrentContentItem().setConceptName(
-                    DSRCodedEntryValue("112011","DCM","Positioner Primary Angle"));
+                    dcmHelpersTerminology::get(dcmHelpersTerminology::CODE_PositionerPrimaryAngle));
         doc->getTree().getCurrentContentItem().setNumericValue(
                     DSRNumericMeasurementValue(elementOFString.c_str(),
-                                               DSRCodedEntryValue("deg","UCUM","degrees of plane angle")));
+                                               dcmHelpersTerminology::get(dcmHelpersTerminology::CODE_UnitDegree)));
 
     }
 
@@ -493,16 +574,17 @@ void dcmHelpersCommon::addImageLibraryEntry(DSRDocument *doc, DcmDataset *imgDat
     if(imgDataset->findAndGetElement(DCM_PositionerSecondaryAngle, element).good()){
 
         element->getOFString(elementOFString, 0);
-        doc->getTree().addContentItem(DSRTypes::RT_hasAcqContext,
-                                      DSRTypes::VT_Num,
-                                      addMode);
+        WARN_IF_ERROR(doc->getTree().addContentItem(DSRTypes::RT_hasAcqContext,
+                                                    DSRTypes::VT_Num,
+                                                    addMode),
+                      "Positioner Secondary Angle");
         addMode = addMode == DSRTypes::AM_belowCurrent ? DSRTypes::AM_afterCurrent : addMode;
 
         doc->getTree().getCurrentContentItem().setConceptName(
-                    DSRCodedEntryValue("112012","DCM","Positioner Secondary Angle"));
+                    dcmHelpersTerminology::get(dcmHelpersTerminology::CODE_PositionerSecondaryAngle));
         doc->getTree().getCurrentContentItem().setNumericValue(
                     DSRNumericMeasurementValue(elementOFString.c_str(),
-                                               DSRCodedEntryValue("deg","UCUM","degrees of plane angle")));
+                                               dcmHelpersTerminology::get(dcmHelpersTerminology::CODE_UnitDegree)));
     }
 
     // TODO
@@ -511,163 +593,281 @@ void dcmHelpersCommon::addImageLibraryEntry(DSRDocument *doc, DcmDataset *imgDat
     // may or may not be the same as the Spacing Between Slices (0018,0088) if present.
 
     // Slice thickness/
-    if(imgDataset->findAndGetElement(DCM_SliceThickness, element).good()){
+    if(findAndGetFrameElement(imgDataset, frameNumber, DCM_SliceThickness, element).good()){
 
         element->getOFString(elementOFString, 0);
-        doc->getTree().addContentItem(DSRTypes::RT_hasAcqContext,
-                                      DSRTypes::VT_Num,
-                                      addMode);
+        WARN_IF_ERROR(doc->getTree().addContentItem(DSRTypes::RT_hasAcqContext,
+                                                    DSRTypes::VT_Num,
+                                                    addMode),
+                      "Slice Thickness");
         addMode = addMode == DSRTypes::AM_belowCurrent ? DSRTypes::AM_afterCurrent : addMode;
 
         doc->getTree().getCurrentContentItem().setConceptName(
-                    DSRCodedEntryValue("112225","DCM","Slice Thickness"));
+                    dcmHelpersTerminology::get(dcmHelpersTerminology::CODE_SliceThickness));
         doc->getTree().getCurrentContentItem().setNumericValue(
                     DSRNumericMeasurementValue(elementOFString.c_str(),
-                                               DSRCodedEntryValue("mm","UCUM","millimeter")));
+                                               dcmHelpersTerminology::get(dcmHelpersTerminology::CODE_UnitMillimeter)));
     }
 
     // Frame of reference
     if(imgDataset->findAndGetElement(DCM_FrameOfReferenceUID, element).good()){
 
         element->getOFString(elementOFString,0);
-        doc->getTree().addContentItem(DSRTypes::RT_hasAcqContext,
-                                      DSRTypes::VT_UIDRef,
-                                      addMode);
+        WARN_IF_ERROR(doc->getTree().addContentItem(DSRTypes::RT_hasAcqContext,
+                                                    DSRTypes::VT_UIDRef,
+                                                    addMode),
+                      "Frame of Reference UID");
         addMode = addMode == DSRTypes::AM_belowCurrent ? DSRTypes::AM_afterCurrent : addMode;
 
         doc->getTree().getCurrentContentItem().setConceptName(
-                    DSRCodedEntryValue("112227","DCM","Frame of Reference UID"));
+                    dcmHelpersTerminology::get(dcmHelpersTerminology::CODE_FrameOfReferenceUID));
         doc->getTree().getCurrentContentItem().setStringValue(elementOFString);
     }
 
     // Image Position Patient
-    if(imgDataset->findAndGetElement(DCM_ImagePositionPatient, element).good()){
+    if(findAndGetFrameElement(imgDataset, frameNumber, DCM_ImagePositionPatient, element).good()){
         element->getOFString(elementOFString, 0);
-        doc->getTree().addContentItem(DSRTypes::RT_hasAcqContext,
-                                      DSRTypes::VT_Num,
-                                      addMode);
+        WARN_IF_ERROR(doc->getTree().addContentItem(DSRTypes::RT_hasAcqContext,
+                                                    DSRTypes::VT_Num,
+                                                    addMode),
+                      "Image Position (Patient) X");
         addMode = addMode == DSRTypes::AM_belowCurrent ? DSRTypes::AM_afterCurrent : addMode;
 
         doc->getTree().getCurrentContentItem().setConceptName(
-                    DSRCodedEntryValue("110901","DCM","Image Position (Patient) X"));
+                    dcmHelpersTerminology::get(dcmHelpersTerminology::CODE_ImagePositionX));
         doc->getTree().getCurrentContentItem().setNumericValue(
                     DSRNumericMeasurementValue(elementOFString.c_str(),
-                                               DSRCodedEntryValue("mm","UCUM","millimeter")));
+                                               dcmHelpersTerminology::get(dcmHelpersTerminology::CODE_UnitMillimeter)));
 
         element->getOFString(elementOFString, 1);
-        doc->getTree().addContentItem(DSRTypes::RT_hasAcqContext,
-                                      DSRTypes::VT_Num,
-                                      DSRTypes::AM_afterCurrent);
+        WARN_IF_ERROR(doc->getTree().addContentItem(DSRTypes::RT_hasAcqContext,
+                                                    DSRTypes::VT_Num,
+                                                    DSRTypes::AM_afterCurrent),
+                      "Image Position (Patient) Y");
         doc->getTree().getCurrentContentItem().setConceptName(
-                    DSRCodedEntryValue("110902","DCM","Image Position (Patient) Y"));
+                    dcmHelpersTerminology::get(dcmHelpersTerminology::CODE_ImagePositionY));
         doc->getTree().getCurrentContentItem().setNumericValue(
                     DSRNumericMeasurementValue(elementOFString.c_str(),
-                                               DSRCodedEntryValue("mm","UCUM","millimeter")));
+                                               dcmHelpersTerminology::get(dcmHelpersTerminology::CODE_UnitMillimeter)));
 
         element->getOFString(elementOFString, 2);
-        doc->getTree().addContentItem(DSRTypes::RT_hasAcqContext,
-                                      DSRTypes::VT_Num,
-                                      DSRTypes::AM_afterCurrent);
+        WARN_IF_ERROR(doc->getTree().addContentItem(DSRTypes::RT_hasAcqContext,
+                                                    DSRTypes::VT_Num,
+                                                    DSRTypes::AM_afterCurrent),
+                      "Image Position (Patient) Z");
         doc->getTree().getCurrentContentItem().setConceptName(
-                    DSRCodedEntryValue("110903","DCM","Image Position (Patient) Z"));
+                    dcmHelpersTerminology::get(dcmHelpersTerminology::CODE_ImagePositionZ));
         doc->getTree().getCurrentContentItem().setNumericValue(
                     DSRNumericMeasurementValue(elementOFString.c_str(),
-                                               DSRCodedEntryValue("mm","UCUM","millimeter")));
+                                               dcmHelpersTerminology::get(dcmHelpersTerminology::CODE_UnitMillimeter)));
     }
 
     // Image Orientation Patient
-    if(imgDataset->findAndGetElement(DCM_ImageOrientationPatient, element).good()){
+    if(findAndGetFrameElement(imgDataset, frameNumber, DCM_ImageOrientationPatient, element).good()){
         element->getOFString(elementOFString, 0);
-        doc->getTree().addContentItem(DSRTypes::RT_hasAcqContext,
-                                      DSRTypes::VT_Num,
-                                      addMode);
+        WARN_IF_ERROR(doc->getTree().addContentItem(DSRTypes::RT_hasAcqContext,
+                                                    DSRTypes::VT_Num,
+                                                    addMode),
+                      "Image Orientation (Patient) Row X");
         addMode = addMode == DSRTypes::AM_belowCurrent ? DSRTypes::AM_afterCurrent : addMode;
 
         doc->getTree().getCurrentContentItem().setConceptName(
-                    DSRCodedEntryValue("110904","DCM","Image Orientation (Patient) Row X"));
+                    dcmHelpersTerminology::get(dcmHelpersTerminology::CODE_ImageOrientationRowX));
         doc->getTree().getCurrentContentItem().setNumericValue(
                     DSRNumericMeasurementValue(elementOFString.c_str(),
-                                               DSRCodedEntryValue("{-1:1}","UCUM","{-1:1}")));
+                                               dcmHelpersTerminology::get(dcmHelpersTerminology::CODE_UnitMinusOneToOne)));
 
         element->getOFString(elementOFString, 1);
-        doc->getTree().addContentItem(DSRTypes::RT_hasAcqContext,
-                                      DSRTypes::VT_Num,
-                                      DSRTypes::AM_afterCurrent);
+        WARN_IF_ERROR(doc->getTree().addContentItem(DSRTypes::RT_hasAcqContext,
+                                                    DSRTypes::VT_Num,
+                                                    DSRTypes::AM_afterCurrent),
+                      "Image Orientation (Patient) Row Y");
         doc->getTree().getCurrentContentItem().setConceptName(
-                    DSRCodedEntryValue("110905","DCM","Image Orientation (Patient) Row Y"));
+                    dcmHelpersTerminology::get(dcmHelpersTerminology::CODE_ImageOrientationRowY));
         doc->getTree().getCurrentContentItem().setNumericValue(
                     DSRNumericMeasurementValue(elementOFString.c_str(),
-                                               DSRCodedEntryValue("{-1:1}","UCUM","{-1:1}")));
+                                               dcmHelpersTerminology::get(dcmHelpersTerminology::CODE_UnitMinusOneToOne)));
 
         element->getOFString(elementOFString, 2);
-        doc->getTree().addContentItem(DSRTypes::RT_hasAcqContext,
-                                      DSRTypes::VT_Num,
-                                      DSRTypes::AM_afterCurrent);
+        WARN_IF_ERROR(doc->getTree().addContentItem(DSRTypes::RT_hasAcqContext,
+                                                    DSRTypes::VT_Num,
+                                                    DSRTypes::AM_afterCurrent),
+                      "Image Orientation (Patient) Row Z");
         doc->getTree().getCurrentContentItem().setConceptName(
-                    DSRCodedEntryValue("110906","DCM","Image Orientation (Patient) Row Z"));
+                    dcmHelpersTerminology::get(dcmHelpersTerminology::CODE_ImageOrientationRowZ));
         doc->getTree().getCurrentContentItem().setNumericValue(
                     DSRNumericMeasurementValue(elementOFString.c_str(),
-                                               DSRCodedEntryValue("{-1:1}","UCUM","{-1:1}")));
+                                               dcmHelpersTerminology::get(dcmHelpersTerminology::CODE_UnitMinusOneToOne)));
 
         element->getOFString(elementOFString, 3);
-        doc->getTree().addContentItem(DSRTypes::RT_hasAcqContext,
-                                      DSRTypes::VT_Num,
-                                      DSRTypes::AM_afterCurrent);
+        WARN_IF_ERROR(doc->getTree().addContentItem(DSRTypes::RT_hasAcqContext,
+                                                    DSRTypes::VT_Num,
+                                                    DSRTypes::AM_afterCurrent),
+                      "Image Orientation (Patient) Column X");
         doc->getTree().getCurrentContentItem().setConceptName(
-                    DSRCodedEntryValue("110907","DCM","Image Orientation (Patient) Column X"));
+                    dcmHelpersTerminology::get(dcmHelpersTerminology::CODE_ImageOrientationColumnX));
         doc->getTree().getCurrentContentItem().setNumericValue(
                     DSRNumericMeasurementValue(elementOFString.c_str(),
-                                               DSRCodedEntryValue("{-1:1}","UCUM","{-1:1}")));
+                                               dcmHelpersTerminology::get(dcmHelpersTerminology::CODE_UnitMinusOneToOne)));
 
         element->getOFString(elementOFString, 4);
-        doc->getTree().addContentItem(DSRTypes::RT_hasAcqContext,
-                                      DSRTypes::VT_Num,
-                                      DSRTypes::AM_afterCurrent);
+        WARN_IF_ERROR(doc->getTree().addContentItem(DSRTypes::RT_hasAcqContext,
+                                                    DSRTypes::VT_Num,
+                                                    DSRTypes::AM_afterCurrent),
+                      "Image Orientation (Patient) Column Y");
         doc->getTree().getCurrentContentItem().setConceptName(
-                    DSRCodedEntryValue("110908","DCM","Image Orientation (Patient) Column Y"));
+                    dcmHelpersTerminology::get(dcmHelpersTerminology::CODE_ImageOrientationColumnY));
         doc->getTree().getCurrentContentItem().setNumericValue(
                     DSRNumericMeasurementValue(elementOFString.c_str(),
-                                               DSRCodedEntryValue("{-1:1}","UCUM","{-1:1}")));
+                                               dcmHelpersTerminology::get(dcmHelpersTerminology::CODE_UnitMinusOneToOne)));
 
         element->getOFString(elementOFString, 5);
-        doc->getTree().addContentItem(DSRTypes::RT_hasAcqContext,
-                                      DSRTypes::VT_Num,
-                                      DSRTypes::AM_afterCurrent);
+        WARN_IF_ERROR(doc->getTree().addContentItem(DSRTypes::RT_hasAcqContext,
+                                                    DSRTypes::VT_Num,
+                                                    DSRTypes::AM_afterCurrent),
+                      "Image Orientation (Patient) Column Z");
         doc->getTree().getCurrentContentItem().setConceptName(
-                    DSRCodedEntryValue("110909","DCM","Image Orientation (Patient) Column Z"));
+                    dcmHelpersTerminology::get(dcmHelpersTerminology::CODE_ImageOrientationColumnZ));
         doc->getTree().getCurrentContentItem().setNumericValue(
                     DSRNumericMeasurementValue(elementOFString.c_str(),
-                                               DSRCodedEntryValue("{-1:1}","UCUM","{-1:1}")));
+                                               dcmHelpersTerminology::get(dcmHelpersTerminology::CODE_UnitMinusOneToOne)));
 
     }
 
     // Image Orientation Patient
     if(imgDataset->findAndGetElement(DCM_Rows, element).good()){
         element->getOFString(elementOFString, 0);
-        doc->getTree().addContentItem(DSRTypes::RT_hasAcqContext,
-                                      DSRTypes::VT_Num,
-                                      addMode);
+        WARN_IF_ERROR(doc->getTree().addContentItem(DSRTypes::RT_hasAcqContext,
+                                                    DSRTypes::VT_Num,
+                                                    addMode),
+                      "Pixel Data Rows");
         addMode = addMode == DSRTypes::AM_belowCurrent ? DSRTypes::AM_afterCurrent : addMode;
 
         doc->getTree().getCurrentContentItem().setConceptName(
-                    DSRCodedEntryValue("110910","DCM","Pixel Data Rows"));
+                    dcmHelpersTerminology::get(dcmHelpersTerminology::CODE_PixelDataRows));
         doc->getTree().getCurrentContentItem().setNumericValue(
                     DSRNumericMeasurementValue(elementOFString.c_str(),
-                                               DSRCodedEntryValue("{pixels}","UCUM","pixels")));
+                                               dcmHelpersTerminology::get(dcmHelpersTerminology::CODE_UnitPixels)));
 
         imgDataset->findAndGetElement(DCM_Columns, element);
         element->getOFString(elementOFString, 0);
-        doc->getTree().addContentItem(DSRTypes::RT_hasAcqContext,
-                                      DSRTypes::VT_Num,
-                                      DSRTypes::AM_afterCurrent);
+        WARN_IF_ERROR(doc->getTree().addContentItem(DSRTypes::RT_hasAcqContext,
+                                                    DSRTypes::VT_Num,
+                                                    DSRTypes::AM_afterCurrent),
+                      "Pixel Data Columns");
         doc->getTree().getCurrentContentItem().setConceptName(
-                    DSRCodedEntryValue("110911","DCM","Pixel Data Columns"));
+                    dcmHelpersTerminology::get(dcmHelpersTerminology::CODE_PixelDataColumns));
         doc->getTree().getCurrentContentItem().setNumericValue(
                     DSRNumericMeasurementValue(elementOFString.c_str(),
-                                               DSRCodedEntryValue("{pixels}","UCUM","pixels")));
+                                               dcmHelpersTerminology::get(dcmHelpersTerminology::CODE_UnitPixels)));
     }
 
 
     doc->getTree().goUp(); // up to image level
     doc->getTree().goUp(); // up to image library container level
 }
+
+void dcmHelpersCommon::addMeasurementGroup(DSRDocument *doc, const char* trackingIdentifier, const char* trackingUID,
+                                           const char* segInstanceUID, unsigned short segmentNumber,
+                                           const std::vector<std::string> &sourceClassUIDs,
+                                           const std::vector<std::string> &sourceInstanceUIDs,
+                                           const std::map<std::string, std::vector<long> > &sourceFrames,
+                                           const char* meanValue, DcmDataset *sourceDataset){
+    WARN_IF_ERROR(doc->getTree().addContentItem(DSRTypes::RT_contains, DSRTypes::VT_Container, DSRTypes::AM_belowCurrent),
+                  "Measurement Group");
+    doc->getTree().getCurrentContentItem().setConceptName(dcmHelpersTerminology::get(dcmHelpersTerminology::CODE_MeasurementGroup));
+
+    WARN_IF_ERROR(doc->getTree().addContentItem(DSRTypes::RT_hasObsContext, DSRTypes::VT_Text, DSRTypes::AM_belowCurrent),
+                  "Tracking Identifier");
+    doc->getTree().getCurrentContentItem().setConceptName(
+                dcmHelpersTerminology::get(dcmHelpersTerminology::CODE_TrackingIdentifier));
+    doc->getTree().getCurrentContentItem().setStringValue(trackingIdentifier);
+
+    WARN_IF_ERROR(doc->getTree().addContentItem(DSRTypes::RT_hasObsContext, DSRTypes::VT_UIDRef, DSRTypes::AM_afterCurrent),
+                  "Tracking Unique Identifier");
+    doc->getTree().getCurrentContentItem().setConceptName(
+                dcmHelpersTerminology::get(dcmHelpersTerminology::CODE_TrackingUniqueIdentifier));
+    doc->getTree().getCurrentContentItem().setStringValue(trackingUID);
+
+    WARN_IF_ERROR(doc->getTree().addContentItem(DSRTypes::RT_contains, DSRTypes::VT_Image, DSRTypes::AM_afterCurrent),
+                  "Referenced Segment");
+    doc->getTree().getCurrentContentItem().setConceptName(
+                dcmHelpersTerminology::get(dcmHelpersTerminology::CODE_ReferencedSegment));
+    DSRImageReferenceValue segReference = DSRImageReferenceValue(UID_SegmentationStorage, segInstanceUID);
+    segReference.getSegmentList().addItem(segmentNumber);
+    if(doc->getTree().getCurrentContentItem().setImageReference(segReference).bad())
+        std::cerr << "Failed to set segmentation image reference" << std::endl;
+
+    // Referenced series used for segmentation is not stored in the
+    // segmentation object, so need to reference all images instead.
+    for(size_t i=0;i<sourceInstanceUIDs.size();i++){
+        WARN_IF_ERROR(doc->getTree().addContentItem(DSRTypes::RT_contains, DSRTypes::VT_Image, DSRTypes::AM_afterCurrent),
+                      "Source image for segmentation");
+        doc->getTree().getCurrentContentItem().setConceptName(
+                    dcmHelpersTerminology::get(dcmHelpersTerminology::CODE_SourceImageForSegmentation));
+        DSRImageReferenceValue imageReference =
+                DSRImageReferenceValue(sourceClassUIDs[i].c_str(), sourceInstanceUIDs[i].c_str());
+        std::map<std::string, std::vector<long> >::const_iterator frames = sourceFrames.find(sourceInstanceUIDs[i]);
+        if(frames != sourceFrames.end())
+            for(size_t f=0;f<frames->second.size();f++)
+                imageReference.getFrameList().addItem(frames->second[f]);
+        if(doc->getTree().getCurrentContentItem().setImageReference(imageReference).bad())
+            std::cerr << "Failed to set source image reference" << std::endl;
+    }
+
+    // CT values are attenuation in HU; the values of other modalities, e.g. MR
+    // signal intensity, have no units
+    OFString modality, rescaleType;
+    sourceDataset->findAndGetOFString(DCM_Modality, modality);
+    sourceDataset->findAndGetOFString(DCM_RescaleType, rescaleType);
+    bool attenuation = modality == "CT" || rescaleType == "HU";
+    WARN_IF_ERROR(doc->getTree().addContentItem(DSRTypes::RT_contains, DSRTypes::VT_Num, DSRTypes::AM_afterCurrent),
+                  "Mean value");
+    doc->getTree().getCurrentContentItem().setNumericValue(
+                DSRNumericMeasurementValue(meanValue, dcmHelpersTerminology::get(
+                    attenuation ? dcmHelpersTerminology::CODE_UnitHounsfield : dcmHelpersTerminology::CODE_UnitNoUnits)));
+    doc->getTree().getCurrentContentItem().setConceptName(
+                dcmHelpersTerminology::get(attenuation ? dcmHelpersTerminology::CODE_AttenuationCoefficient
+                                                       : dcmHelpersTerminology::CODE_ImageIntensity));
+
+    WARN_IF_ERROR(doc->getTree().addContentItem(DSRTypes::RT_hasConceptMod, DSRTypes::VT_Code, DSRTypes::AM_belowCurrent),
+                  "Derivation");
+    doc->getTree().getCurrentContentItem().setConceptName(
+                dcmHelpersTerminology::get(dcmHelpersTerminology::CODE_Derivation));
+    doc->getTree().getCurrentContentItem().setCodeValue(
+                dcmHelpersTerminology::get(dcmHelpersTerminology::CODE_Mean));
+
+    doc->getTree().goUp(); // up to measurement level
+    doc->getTree().goUp(); // up to measurement group level
+    doc->getTree().goUp(); // up to findings container level
+}
+
+std::string dcmHelpersCommon::canonicalPath(const std::string &path){
+  char resolved[PATH_MAX];
+  if(realpath(path.c_str(), resolved))
+    return resolved;
+  return path;
+}
+
+void dcmHelpersCommon::collectFiles(const std::string &path, std::vector<std::string> &files){
+  struct stat st;
+  if(stat(path.c_str(), &st)){
+    std::cerr << "Cannot access " << path << std::endl;
+    return;
+  }
+  if(!S_ISDIR(st.st_mode)){
+    files.push_back(path);
+    return;
+  }
+  DIR *dir = opendir(path.c_str());
+  if(!dir)
+    return;
+  std::vector<std::string> entries;
+  while(struct dirent *entry = readdir(dir))
+    if(strcmp(entry->d_name, ".") && strcmp(entry->d_name, ".."))
+      entries.push_back(path + "/" + entry->d_name);
+  closedir(dir);
+  std::sort(entries.begin(), entries.end());
+  for(size_t i=0;i<entries.size();i++)
+    collectFiles(entries[i], files);
+}
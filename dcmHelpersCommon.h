@@ -1,10 +1,14 @@
 #ifndef __dcmHelpersCommon_h
 #define __dcmHelpersCommon_h
 
+#include <map>
+#include <string>
 #include <vector>
 
 class DcmItem;
+class DcmElement;
 class DcmTagKey;
+class OFCondition;
 class DcmDataset;
 class DSRDocument;
 class DSRCodedEntryValue;
@@ -37,13 +41,40 @@ class dcmHelpersCommon {
     static void copyGeneralImageModule(DcmDataset *src, DcmDataset *dest);
     static void copySRDocumentGeneralModule(DcmDataset *src, DcmDataset *dest);
 
+    // attribute of a frame (1-based) of a multi-frame image, falling back from the
+    // top-level dataset to the per-frame and shared functional groups
+    static OFCondition findAndGetFrameElement(DcmItem *dataset, long frameNumber,
+                                              const DcmTagKey &tag, DcmElement *&element);
+    static OFCondition findAndGetFrameFloat64(DcmItem *dataset, long frameNumber,
+                                              const DcmTagKey &tag, double &value);
+
 
     //static void copyItems(DcmDataset *src, DcmDataset *dest);
 
+    // the given path if it is a file, or the files below it (sorted by name)
+    // if it is a directory
+    static void collectFiles(const std::string &path, std::vector<std::string> &files);
+    // absolute path without symbolic links, or the path itself if it does not
+    // resolve
+    static std::string canonicalPath(const std::string &path);
+
     // functions to initialize specific templates; return to the same level in the input
     // -- TID 4020 "CAD Image Library Entry Template"
-    // this function adds an
-    static void addImageLibraryEntry(DSRDocument*, DcmDataset*);
+    // this function adds an entry for the image, or for one frame (1-based) of a
+    // multi-frame image
+    static void addImageLibraryEntry(DSRDocument*, DcmDataset*, long frameNumber = 0);
+    // -- TID 1411 "Volumetric ROI Measurements"
+    // this function adds a Measurement Group with the mean value of a segment below
+    // the current (Findings) container, referencing the segment and its source
+    // images (with the frames of multi-frame images listed in sourceFrames).
+    // The mean is an attenuation coefficient in HU for CT sources, and an
+    // image intensity without units otherwise, as told by sourceDataset.
+    static void addMeasurementGroup(DSRDocument*, const char* trackingIdentifier, const char* trackingUID,
+                                    const char* segInstanceUID, unsigned short segmentNumber,
+                                    const std::vector<std::string> &sourceClassUIDs,
+                                    const std::vector<std::string> &sourceInstanceUIDs,
+                                    const std::map<std::string, std::vector<long> > &sourceFrames,
+                                    const char* meanValue, DcmDataset *sourceDataset);
     // -- TID 1204 "Language of Content Item and Descendants"
     static void addLanguageOfContent(DSRDocument*);
     // -- TID 1001 "Observation context"
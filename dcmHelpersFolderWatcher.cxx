@@ -0,0 +1,486 @@
+#include "dcmHelpersFolderWatcher.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <thread>
+
+#include <dirent.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+namespace {
+
+const double HISTOGRAM_BOUNDS_MS[] = {1, 2, 5, 10, 20, 50, 100, 200, 500, 1000, 2000, 5000, 10000, 30000, 60000};
+const size_t HISTOGRAM_BUCKETS = sizeof(HISTOGRAM_BOUNDS_MS) / sizeof(HISTOGRAM_BOUNDS_MS[0]) + 1;
+
+const uint32_t FILE_EVENTS = IN_CLOSE_WRITE | IN_MOVED_TO;
+const uint32_t REMOVE_EVENTS = IN_DELETE | IN_MOVED_FROM;
+const uint32_t WATCH_EVENTS = FILE_EVENTS | REMOVE_EVENTS | IN_CREATE;
+
+// the delay before retrying a failed job doubles with each attempt
+const long RETRY_BACKOFF_MS = 1000;
+const unsigned MAX_RETRY_DOUBLINGS = 9;
+
+double millisecondsBetween(const std::chrono::steady_clock::time_point &start,
+                           const std::chrono::steady_clock::time_point &end){
+  return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+bool getFileSignature(const std::string &path, long long &size, long long &mtime){
+  struct stat st;
+  if(stat(path.c_str(), &st) || !S_ISREG(st.st_mode))
+    return false;
+  size = st.st_size;
+  mtime = st.st_mtime;
+  return true;
+}
+
+// whether a file was modified within the interval before now, by the wall clock
+bool modifiedWithin(const std::string &path, const std::chrono::milliseconds &interval){
+  struct stat st;
+  struct timespec now;
+  if(stat(path.c_str(), &st) || clock_gettime(CLOCK_REALTIME, &now))
+    return false;
+  long long age = (now.tv_sec - st.st_mtim.tv_sec) * 1000LL + (now.tv_nsec - st.st_mtim.tv_nsec) / 1000000;
+  return age < interval.count();
+}
+
+}
+
+std::atomic<bool> dcmHelpersFolderWatcher::stopRequested(false);
+
+dcmHelpersFolderWatcher::Histogram::Histogram() : counts(HISTOGRAM_BUCKETS), count(0), sum(0), max(0){
+}
+
+void dcmHelpersFolderWatcher::Histogram::add(double ms){
+  size_t bucket = 0;
+  while(bucket+1 < HISTOGRAM_BUCKETS && ms > HISTOGRAM_BOUNDS_MS[bucket])
+    bucket++;
+  counts[bucket]++;
+  count++;
+  sum += ms;
+  max = std::max(max, ms);
+}
+
+void dcmHelpersFolderWatcher::Histogram::writeJSON(std::ostream &out) const {
+  out << "{\"count\": " << count << ", \"mean\": " << (count ? sum / count : 0.) << ", \"max\": " << max
+      << ", \"buckets\": [";
+  for(size_t i=0;i<HISTOGRAM_BUCKETS;i++){
+    out << (i ? ", " : "") << "{\"le\": ";
+    if(i+1 < HISTOGRAM_BUCKETS)
+      out << HISTOGRAM_BOUNDS_MS[i];
+    else
+      out << "null";
+    out << ", \"count\": " << counts[i] << "}";
+  }
+  out << "]}";
+}
+
+dcmHelpersFolderWatcher::dcmHelpersFolderWatcher(const Filter &filter, const Handler &handler,
+                                                 unsigned debounceMs, size_t maxQueue) :
+  filter(filter), handler(handler), debounce(debounceMs), queue(maxQueue),
+  events(0), duplicates(0), rejected(0), completed(0), failed(0), retried(0), overflows(0){
+}
+
+void dcmHelpersFolderWatcher::stop(){
+  stopRequested = true;
+}
+
+bool dcmHelpersFolderWatcher::addWatch(int fd, const std::string &directory){
+  int wd = inotify_add_watch(fd, directory.c_str(), WATCH_EVENTS | IN_ONLYDIR);
+  if(wd < 0){
+    std::cerr << "Cannot watch " << directory << ": " << strerror(errno) << std::endl;
+    return false;
+  }
+  watches[wd] = directory;
+
+  // subdirectories existing already are watched as well
+  DIR *dir = opendir(directory.c_str());
+  if(!dir)
+    return true;
+  struct dirent *entry;
+  while((entry = readdir(dir)) != NULL){
+    std::string name = entry->d_name;
+    struct stat st;
+    if(name != "." && name != ".." && !stat((directory + "/" + name).c_str(), &st) && S_ISDIR(st.st_mode))
+      addWatch(fd, directory + "/" + name);
+  }
+  closedir(dir);
+  return true;
+}
+
+// watch the directories created since the overflow, and take up the files
+//  completed since then, i.e. not processed in their current state
+void dcmHelpersFolderWatcher::rescan(int fd, const std::string &directory, const TimePoint &now){
+  // watching a directory again returns its existing watch
+  int wd = inotify_add_watch(fd, directory.c_str(), WATCH_EVENTS | IN_ONLYDIR);
+  if(wd >= 0)
+    watches[wd] = directory;
+
+  DIR *dir = opendir(directory.c_str());
+  if(!dir)
+    return;
+  struct dirent *entry;
+  while((entry = readdir(dir)) != NULL){
+    std::string name = entry->d_name;
+    std::string path = directory + "/" + name;
+    struct stat st;
+    if(name == "." || name == ".." || stat(path.c_str(), &st))
+      continue;
+    if(S_ISDIR(st.st_mode)){
+      rescan(fd, path, now);
+    } else if(S_ISREG(st.st_mode)){
+      bool known;
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        known = isKnown(path, st.st_size, st.st_mtime);
+      }
+      if(!known)
+        fileEvent(path, now, true);
+    }
+  }
+  closedir(dir);
+}
+
+// a file, or a directory with the files below it, left the watched tree
+void dcmHelpersFolderWatcher::forget(const std::string &path, bool directory){
+  std::string prefix = path + "/";
+  pending.erase(path);
+  std::lock_guard<std::mutex> lock(mutex);
+  processed.erase(path);
+  retries.erase(path);
+  if(!directory)
+    return;
+  for(std::map<std::string, std::pair<long long, long long> >::iterator it=processed.lower_bound(prefix);
+      it!=processed.end() && it->first.compare(0, prefix.size(), prefix) == 0;)
+    processed.erase(it++);
+  for(std::map<std::string, Retry>::iterator it=retries.lower_bound(prefix);
+      it!=retries.end() && it->first.compare(0, prefix.size(), prefix) == 0;)
+    retries.erase(it++);
+}
+
+// removals may have been lost with an overflow as well
+void dcmHelpersFolderWatcher::forgetRemoved(){
+  long long size, mtime;
+  std::lock_guard<std::mutex> lock(mutex);
+  for(std::map<std::string, std::pair<long long, long long> >::iterator it=processed.begin();it!=processed.end();){
+    if(getFileSignature(it->first, size, mtime))
+      ++it;
+    else
+      processed.erase(it++);
+  }
+  for(std::map<std::string, Retry>::iterator it=retries.begin();it!=retries.end();){
+    if(getFileSignature(it->first, size, mtime))
+      ++it;
+    else
+      retries.erase(it++);
+  }
+}
+
+bool dcmHelpersFolderWatcher::isKnown(const std::string &path, long long size, long long mtime) const {
+  if(waiting.count(path))
+    return true;
+  std::map<std::string, std::pair<long long, long long> >::const_iterator done = running.find(path);
+  if(done != running.end() && done->second == std::make_pair(size, mtime))
+    return true;
+  done = processed.find(path);
+  if(done != processed.end() && done->second == std::make_pair(size, mtime))
+    return true;
+  std::map<std::string, Retry>::const_iterator retry = retries.find(path);
+  return retry != retries.end() && retry->second.job.size == size && retry->second.job.mtime == mtime;
+}
+
+bool dcmHelpersFolderWatcher::run(const std::string &directory){
+  int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if(fd < 0){
+    std::cerr << "Cannot initialize inotify: " << strerror(errno) << std::endl;
+    return false;
+  }
+  if(!addWatch(fd, directory)){
+    close(fd);
+    return false;
+  }
+
+  std::thread worker(&dcmHelpersFolderWatcher::runWorker, this);
+
+  std::vector<char> buffer(64 * 1024);
+  while(!stopRequested){
+    // wake up for the next debounce or retry deadline, and regularly to check
+    //  for stop()
+    TimePoint now = std::chrono::steady_clock::now();
+    TimePoint wakeup = now + std::chrono::milliseconds(200);
+    for(std::map<std::string, Pending>::const_iterator it=pending.begin();it!=pending.end();++it)
+      wakeup = std::min(wakeup, it->second.deadline);
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      for(std::map<std::string, Retry>::const_iterator it=retries.begin();it!=retries.end();++it)
+        wakeup = std::min(wakeup, it->second.deadline);
+    }
+    long long wait = std::chrono::duration_cast<std::chrono::milliseconds>(wakeup - now).count() + 1;
+    int timeout = int(std::max(0LL, wait));
+
+    struct pollfd pfd;
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+    int ready = poll(&pfd, 1, timeout);
+    if(ready < 0 && errno != EINTR){
+      std::cerr << "Failed to wait for inotify events: " << strerror(errno) << std::endl;
+      break;
+    }
+
+    now = std::chrono::steady_clock::now();
+    bool overflow = false;
+    ssize_t length;
+    while(ready > 0 && (length = read(fd, &buffer[0], buffer.size())) > 0){
+      for(char *p=&buffer[0];p<&buffer[0]+length;){
+        const struct inotify_event *event = reinterpret_cast<const struct inotify_event*>(p);
+        p += sizeof(struct inotify_event) + event->len;
+        if(event->mask & IN_Q_OVERFLOW){
+          overflow = true;
+          std::lock_guard<std::mutex> lock(mutex);
+          overflows++;
+          continue;
+        }
+        std::map<int, std::string>::const_iterator watch = watches.find(event->wd);
+        if(event->mask & IN_IGNORED){
+          if(watch != watches.end())
+            watches.erase(event->wd);
+          continue;
+        }
+        if(watch == watches.end() || !event->len)
+          continue;
+        std::string path = watch->second + "/" + event->name;
+        if(event->mask & REMOVE_EVENTS){
+          forget(path, (event->mask & IN_ISDIR) != 0);
+        } else if(event->mask & IN_ISDIR){
+          // files may have been completed in a new directory before it is watched
+          if(event->mask & (IN_CREATE | IN_MOVED_TO) && addWatch(fd, path)){
+            DIR *dir = opendir(path.c_str());
+            struct dirent *entry;
+            while(dir && (entry = readdir(dir)) != NULL)
+              if(entry->d_type == DT_REG || entry->d_type == DT_UNKNOWN)
+                fileEvent(path + "/" + entry->d_name, now, true);
+            if(dir)
+              closedir(dir);
+          }
+        } else if(event->mask & FILE_EVENTS){
+          fileEvent(path, now);
+        }
+      }
+    }
+
+    // events were lost, the tree is compared with what is known instead
+    if(overflow){
+      forgetRemoved();
+      rescan(fd, directory, now);
+    }
+
+    now = std::chrono::steady_clock::now();
+    queueReady(now, false);
+    queueRetries(now);
+  }
+
+  // files still in their debounce interval are complete by now, failed jobs
+  //  waiting for a retry are given up
+  queueReady(std::chrono::steady_clock::now(), true);
+  queue.close();
+  worker.join();
+  close(fd);
+  return true;
+}
+
+void dcmHelpersFolderWatcher::fileEvent(const std::string &path, const TimePoint &now, bool scanned){
+  std::map<std::string, Pending>::iterator it = pending.find(path);
+  if(it == pending.end()){
+    Pending &file = pending[path];
+    file.arrival = now;
+    file.deadline = now + debounce;
+    file.scanned = scanned;
+  } else {
+    it->second.deadline = now + debounce;
+    // an event of the file tells when it is complete
+    it->second.scanned = it->second.scanned && scanned;
+  }
+  std::lock_guard<std::mutex> lock(mutex);
+  events++;
+}
+
+void dcmHelpersFolderWatcher::queueReady(const TimePoint &now, bool all){
+  bool arrived = false;
+  for(std::map<std::string, Pending>::iterator it=pending.begin();it!=pending.end();){
+    if(!all && it->second.deadline > now){
+      ++it;
+      continue;
+    }
+    // a scanned file may still be open for writing, it waits for its close or
+    //  for writes to stop
+    if(!all && it->second.scanned && modifiedWithin(it->first, debounce)){
+      it->second.deadline = now + debounce;
+      ++it;
+      continue;
+    }
+    Job job;
+    job.path = it->first;
+    job.arrival = it->second.arrival;
+    job.queued = now;
+    job.attempts = 0;
+    pending.erase(it++);
+
+    if(!getFileSignature(job.path, job.size, job.mtime))
+      continue;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      if(isKnown(job.path, job.size, job.mtime)){
+        duplicates++;
+        continue;
+      }
+    }
+    arrived = true;
+    if(!filter(job.path)){
+      std::lock_guard<std::mutex> lock(mutex);
+      rejected++;
+      continue;
+    }
+    {
+      // a retry of the file's previous content is superseded
+      std::lock_guard<std::mutex> lock(mutex);
+      waiting.insert(job.path);
+      retries.erase(job.path);
+      debounceLatency.add(millisecondsBetween(job.arrival, job.queued));
+    }
+    queue.push(std::move(job));
+  }
+
+  // the files that arrived may be what failed jobs lacked; a retry waits for
+  //  the debounce interval, so that a burst of files leads to one retry
+  if(arrived){
+    std::lock_guard<std::mutex> lock(mutex);
+    for(std::map<std::string, Retry>::iterator it=retries.begin();it!=retries.end();++it)
+      it->second.deadline = std::min(it->second.deadline, now + debounce);
+  }
+}
+
+void dcmHelpersFolderWatcher::queueRetries(const TimePoint &now){
+  std::vector<Job> jobs;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    for(std::map<std::string, Retry>::iterator it=retries.begin();it!=retries.end();){
+      if(it->second.deadline > now){
+        ++it;
+        continue;
+      }
+      jobs.push_back(it->second.job);
+      retries.erase(it++);
+    }
+  }
+  for(size_t i=0;i<jobs.size();i++){
+    // a changed file is queued by its own events
+    long long size, mtime;
+    if(!getFileSignature(jobs[i].path, size, mtime) || size != jobs[i].size || mtime != jobs[i].mtime)
+      continue;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      if(waiting.count(jobs[i].path))
+        continue;
+      waiting.insert(jobs[i].path);
+      retried++;
+    }
+    jobs[i].queued = now;
+    queue.push(std::move(jobs[i]));
+  }
+}
+
+void dcmHelpersFolderWatcher::runWorker(){
+  Job job;
+  while(queue.pop(job)){
+    TimePoint start = std::chrono::steady_clock::now();
+    {
+      // a file changed from now on is queued again
+      std::lock_guard<std::mutex> lock(mutex);
+      waiting.erase(job.path);
+      running[job.path] = std::make_pair(job.size, job.mtime);
+    }
+    bool ok = handler(job.path);
+    TimePoint end = std::chrono::steady_clock::now();
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      running.erase(job.path);
+      if(ok){
+        completed++;
+        processed[job.path] = std::make_pair(job.size, job.mtime);
+      } else {
+        failed++;
+        Retry &retry = retries[job.path];
+        retry.job = job;
+        retry.deadline = end + std::chrono::milliseconds(RETRY_BACKOFF_MS << std::min(job.attempts, MAX_RETRY_DOUBLINGS));
+        retry.job.attempts++;
+      }
+      queueLatency.add(millisecondsBetween(job.queued, start));
+      processingLatency.add(millisecondsBetween(start, end));
+      endToEndLatency.add(millisecondsBetween(job.arrival, end));
+    }
+    if(!statisticsFile.empty())
+      saveStatistics();
+  }
+}
+
+void dcmHelpersFolderWatcher::saveStatistics(){
+  // readers never see a partially written file
+  std::string temporary = statisticsFile + ".tmp";
+  {
+    std::ofstream out(temporary.c_str());
+    out << "{";
+    writeJSON(out);
+    out << "}" << std::endl;
+    if(!out)
+      return;
+  }
+  rename(temporary.c_str(), statisticsFile.c_str());
+}
+
+void dcmHelpersFolderWatcher::printStatistics(std::ostream &out) const {
+  std::lock_guard<std::mutex> lock(mutex);
+  out << "Watched files: " << events << " events, " << completed << " jobs completed, " << failed << " failed, "
+      << retried << " retried, " << duplicates << " duplicates, " << rejected << " not accepted";
+  if(overflows)
+    out << ", " << overflows << " event queue overflows";
+  out << std::endl;
+  const Histogram *histograms[] = {&debounceLatency, &queueLatency, &processingLatency, &endToEndLatency};
+  const char *names[] = {"debounce", "queue", "processing", "end to end"};
+  for(int h=0;h<4;h++){
+    out << "  " << names[h] << " latency (ms):";
+    for(size_t i=0;i<HISTOGRAM_BUCKETS;i++){
+      if(!histograms[h]->counts[i])
+        continue;
+      if(i+1 < HISTOGRAM_BUCKETS)
+        out << " <=" << long(HISTOGRAM_BOUNDS_MS[i]);
+      else
+        out << " >" << long(HISTOGRAM_BOUNDS_MS[HISTOGRAM_BUCKETS-2]);
+      out << ": " << histograms[h]->counts[i];
+    }
+    out << std::fixed << std::setprecision(1) << " (max " << histograms[h]->max << ")" << std::endl;
+  }
+}
+
+void dcmHelpersFolderWatcher::writeJSON(std::ostream &out) const {
+  std::lock_guard<std::mutex> lock(mutex);
+  out << "\"events\": " << events << ", \"completed\": " << completed << ", \"failed\": " << failed
+      << ", \"retried\": " << retried << ", \"awaiting_retry\": " << retries.size() << ", \"duplicates\": " << duplicates << ", \"not_accepted\": " << rejected
+      << ", \"overflows\": " << overflows << ", \"latency_ms\": {\"debounce\": ";
+  debounceLatency.writeJSON(out);
+  out << ", \"queue\": ";
+  queueLatency.writeJSON(out);
+  out << ", \"processing\": ";
+  processingLatency.writeJSON(out);
+  out << ", \"end_to_end\": ";
+  endToEndLatency.writeJSON(out);
+  out << "}";
+}
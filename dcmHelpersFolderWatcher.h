@@ -0,0 +1,134 @@
+#ifndef __dcmHelpersFolderWatcher_h
+#define __dcmHelpersFolderWatcher_h
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <iosfwd>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "dcmHelpersThreadPool.h"
+
+// Watches a landing directory, and its subdirectories, with inotify and runs
+// a job for each completed file, so that a file is processed within moments
+// of its arrival rather than at the next run of a periodic scan.
+//
+// A file counts as complete when it is closed after writing or moved into the
+// directory. Further events for the same file within debounceMs postpone it,
+// so that a file written in several passes is processed once. Files found by
+// scanning a new directory or after an overflow have had no such event; they
+// are postponed until they were not modified for debounceMs, or until their
+// close after writing. Every completed
+// file is passed to the filter on the watching thread (e.g. to index it); the
+// files it accepts are queued for the handler, which runs on a worker thread.
+// A file is not queued again while it is waiting, nor after its job succeeded
+// unless its size or modification time changed.
+//
+// A failed job is retried once further files arrived, as they may hold the
+// instances it lacked, and otherwise after a backoff doubling from one second
+// to about eight minutes. Files removed from the tree are forgotten, so the
+// record of processed files is bounded by the files present. If the kernel's
+// event queue overflows, the tree is rescanned for the files and directories
+// whose events were lost.
+//
+// Latencies are kept as histograms: from the first event of a file to its
+// queueing (debounce), to the start of its job (queue), of the job itself
+// (processing) and from the first event to the end of the job (end to end).
+class dcmHelpersFolderWatcher {
+  public:
+    typedef std::function<bool(const std::string &path)> Filter;
+    // runs a job; returns false on failure
+    typedef std::function<bool(const std::string &path)> Handler;
+
+    dcmHelpersFolderWatcher(const Filter &filter, const Handler &handler,
+                            unsigned debounceMs = 200, size_t maxQueue = 256);
+
+    // statistics as JSON are rewritten to this file after each job
+    void setStatisticsFile(const std::string &path) { statisticsFile = path; }
+
+    // watch until stop() is called, then complete the queued jobs; returns
+    //  false if the directory cannot be watched
+    bool run(const std::string &directory);
+
+    // safe to call from a signal handler
+    static void stop();
+
+    void printStatistics(std::ostream&) const;
+    // statistics as JSON members, without the enclosing braces
+    void writeJSON(std::ostream&) const;
+
+  private:
+    dcmHelpersFolderWatcher(const dcmHelpersFolderWatcher&);
+    dcmHelpersFolderWatcher& operator=(const dcmHelpersFolderWatcher&);
+
+    typedef std::chrono::steady_clock::time_point TimePoint;
+
+    // counts per upper bound in milliseconds, the last bucket is unbounded
+    struct Histogram {
+      Histogram();
+      void add(double ms);
+      void writeJSON(std::ostream&) const;
+      std::vector<unsigned long> counts;
+      unsigned long count;
+      double sum, max;
+    };
+
+    struct Pending {
+      TimePoint arrival;
+      TimePoint deadline;
+      // found by a scan, not by an event of the file
+      bool scanned;
+    };
+
+    struct Job {
+      std::string path;
+      TimePoint arrival;
+      TimePoint queued;
+      long long size, mtime;
+      unsigned attempts;
+    };
+
+    struct Retry {
+      Job job;
+      TimePoint deadline;
+    };
+
+    bool addWatch(int fd, const std::string &directory);
+    void rescan(int fd, const std::string &directory, const TimePoint &now);
+    void forget(const std::string &path, bool directory);
+    void forgetRemoved();
+    // with the mutex held
+    bool isKnown(const std::string &path, long long size, long long mtime) const;
+    void fileEvent(const std::string &path, const TimePoint &now, bool scanned = false);
+    void queueReady(const TimePoint &now, bool all);
+    void queueRetries(const TimePoint &now);
+    void runWorker();
+    void saveStatistics();
+
+    Filter filter;
+    Handler handler;
+    std::chrono::milliseconds debounce;
+    dcmHelpersBoundedQueue<Job> queue;
+    std::string statisticsFile;
+
+    // watching thread state
+    std::map<int, std::string> watches;
+    std::map<std::string, Pending> pending;
+
+    mutable std::mutex mutex;
+    std::set<std::string> waiting;
+    // size and modification time of the file each running job started with
+    std::map<std::string, std::pair<long long, long long> > running;
+    std::map<std::string, std::pair<long long, long long> > processed;
+    std::map<std::string, Retry> retries;
+    unsigned long events, duplicates, rejected, completed, failed, retried, overflows;
+    Histogram debounceLatency, queueLatency, processingLatency, endToEndLatency;
+
+    static std::atomic<bool> stopRequested;
+};
+
+#endif
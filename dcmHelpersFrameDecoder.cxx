@@ -0,0 +1,361 @@
+#include "dcmHelpersFrameDecoder.h"
+#include "dcmHelpersCommon.h"
+#include "dcmHelpersFrameIndex.h"
+#include "dcmHelpersThreadPool.h"
+#include "dcmtk/config/osconfig.h"
+#include "dcmtk/dcmdata/dctk.h"
+#include "dcmtk/dcmdata/dcfcache.h"
+#include "dcmtk/dcmdata/dcrledrg.h"
+#include "dcmtk/dcmjpeg/djdecode.h"
+#include "dcmtk/dcmjpls/djdecode.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <iomanip>
+#include <iostream>
+
+namespace {
+
+struct QueuedFrame {
+  dcmHelpersDecodedFrame frame;
+  std::vector<unsigned char> *buffer;
+};
+
+// a file that is parsed by the workers is split into chunks of at least this
+//  many frames, so that its parsing is shared by several frames
+const size_t MIN_FRAMES_PER_PARSE = 8;
+
+double secondsSince(const std::chrono::steady_clock::time_point &start){
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// attributes shared by the frames of a file
+struct FileHeader {
+  FileHeader() : valid(false), indexable(false), frameSize(0), codec("unknown") {}
+  bool valid;
+  // native little endian frames, fetched with a single positioned read
+  //  through the frame index, bypassing DCMTK
+  bool indexable;
+  Uint32 frameSize;
+  std::string codec;
+  dcmHelpersDecodedFrame frame;
+};
+
+bool readHeader(DcmDataset *dataset, const std::string &path, FileHeader &header){
+  DcmElement *element = NULL;
+  header.codec = DcmXfer(dataset->getOriginalXfer()).getXferName();
+  if(dataset->findAndGetElement(DCM_PixelData, element).bad()){
+    std::cerr << "Failed to access pixel data in " << path << std::endl;
+    return false;
+  }
+  dcmHelpersDecodedFrame &frame = header.frame;
+  frame.rows = frame.columns = frame.bitsAllocated = 0;
+  frame.rescaleSlope = 1;
+  frame.rescaleIntercept = 0;
+  frame.samplesPerPixel = 1;
+  frame.pixelRepresentation = 0;
+  dataset->findAndGetUint16(DCM_Rows, frame.rows);
+  dataset->findAndGetUint16(DCM_Columns, frame.columns);
+  dataset->findAndGetUint16(DCM_SamplesPerPixel, frame.samplesPerPixel);
+  dataset->findAndGetUint16(DCM_BitsAllocated, frame.bitsAllocated);
+  dataset->findAndGetUint16(DCM_PixelRepresentation, frame.pixelRepresentation);
+
+  DcmPixelData *pixelData = OFstatic_cast(DcmPixelData*, element);
+  header.frameSize = 0;
+  if(pixelData->getUncompressedFrameSize(dataset, header.frameSize).bad() || !header.frameSize){
+    std::cerr << "Cannot determine the frame size of " << path << std::endl;
+    return false;
+  }
+  header.indexable = !DcmXfer(dataset->getOriginalXfer()).isEncapsulated() &&
+                     gLocalByteOrder == EBO_LittleEndian && frame.bitsAllocated % 8 == 0;
+  header.valid = true;
+  return true;
+}
+
+void getRescale(DcmDataset *dataset, unsigned long frameNumber, std::pair<double, double> &rescale){
+  dcmHelpersCommon::findAndGetFrameFloat64(dataset, frameNumber+1, DCM_RescaleSlope, rescale.first);
+  dcmHelpersCommon::findAndGetFrameFloat64(dataset, frameNumber+1, DCM_RescaleIntercept, rescale.second);
+}
+
+}
+
+
+dcmHelpersFrameBufferPool::~dcmHelpersFrameBufferPool(){
+  for(size_t i=0;i<freeBuffers.size();i++)
+    delete freeBuffers[i];
+}
+
+std::vector<unsigned char>* dcmHelpersFrameBufferPool::acquire(size_t length){
+  std::vector<unsigned char> *buffer = NULL;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    if(!freeBuffers.empty()){
+      buffer = freeBuffers.back();
+      freeBuffers.pop_back();
+    } else {
+      allocated++;
+    }
+  }
+  if(!buffer)
+    buffer = new std::vector<unsigned char>();
+  // resize() keeps the capacity, so same-sized frames never reallocate
+  buffer->resize(length);
+  return buffer;
+}
+
+void dcmHelpersFrameBufferPool::release(std::vector<unsigned char> *buffer){
+  std::lock_guard<std::mutex> lock(mutex);
+  freeBuffers.push_back(buffer);
+}
+
+
+dcmHelpersFrameDecoder::dcmHelpersFrameDecoder(unsigned numThreads, unsigned queueDepth) :
+  numThreads(numThreads), queueDepth(queueDepth), wallSeconds(0){
+}
+
+dcmHelpersFrameDecoder::~dcmHelpersFrameDecoder(){
+}
+
+void dcmHelpersFrameDecoder::registerCodecs(){
+  DJDecoderRegistration::registerCodecs();
+  DJLSDecoderRegistration::registerCodecs();
+  DcmRLEDecoderRegistration::registerCodecs();
+}
+
+void dcmHelpersFrameDecoder::cleanupCodecs(){
+  DJDecoderRegistration::cleanup();
+  DJLSDecoderRegistration::cleanup();
+  DcmRLEDecoderRegistration::cleanup();
+}
+
+bool dcmHelpersFrameDecoder::decodeFrames(const std::vector<dcmHelpersFrameRequest> &requests,
+                                          const Consumer &consumer){
+  if(requests.empty())
+    return true;
+
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+  // Group the requests by file, and split each file into chunks so that the
+  // frames of a single multi-frame object are spread over the workers as well.
+  // A task that has to decode needs a DcmFileFormat of its own, as DCMTK
+  // objects are not safe for concurrent use; a parsed file is handed on to
+  // the next task of the same file, so that a file is parsed at most once per
+  // worker. The pixel data is only read on demand, so for a large enhanced
+  // multi-frame object only the requested frames are read and decoded.
+  std::map<std::string, std::vector<size_t> > requestsByPath;
+  for(size_t i=0;i<requests.size();i++)
+    requestsByPath[requests[i].path].push_back(i);
+
+  // headers parsed by the caller are read here, before the workers start, and
+  //  the modality LUT of each requested frame with them
+  std::map<std::string, FileHeader> headers;
+  std::vector<std::pair<double, double> > rescale(requests.size(), std::make_pair(1., 0.));
+  for(std::map<std::string, std::vector<size_t> >::const_iterator it=requestsByPath.begin();
+      it!=requestsByPath.end();++it){
+    DcmDataset *dataset = requests[it->second[0]].dataset;
+    FileHeader header;
+    if(!dataset || !readHeader(dataset, it->first, header))
+      continue;
+    headers[it->first] = header;
+    for(size_t i=0;i<it->second.size();i++)
+      getRescale(dataset, requests[it->second[i]].frameNumber, rescale[it->second[i]]);
+  }
+
+  if(!pool)
+    pool.reset(new dcmHelpersThreadPool(numThreads));
+  dcmHelpersThreadPool &pool = *this->pool;
+  std::vector<std::vector<size_t> > tasks;
+  // tasks not yet finished per file, and the files parsed by finished ones
+  std::map<std::string, size_t> fileTasks;
+  std::multimap<std::string, std::unique_ptr<DcmFileFormat> > parsedFiles;
+  std::mutex parsedMutex;
+  for(std::map<std::string, std::vector<size_t> >::const_iterator it=requestsByPath.begin();
+      it!=requestsByPath.end();++it){
+    size_t chunkSize = std::max<size_t>(1, (it->second.size() + pool.size() - 1) / pool.size());
+    std::map<std::string, FileHeader>::const_iterator header = headers.find(it->first);
+    if(header == headers.end() || !header->second.indexable)
+      chunkSize = std::max(chunkSize, MIN_FRAMES_PER_PARSE);
+    for(size_t first=0;first<it->second.size();first+=chunkSize){
+      size_t last = std::min(first + chunkSize, it->second.size());
+      tasks.push_back(std::vector<size_t>(it->second.begin() + first, it->second.begin() + last));
+      fileTasks[it->first]++;
+    }
+  }
+
+  dcmHelpersBoundedQueue<QueuedFrame> queue(queueDepth);
+  std::atomic<size_t> remainingTasks(tasks.size());
+  std::atomic<bool> failed(false);
+  // the pool may be shared, so only the tasks of this call are waited for
+  std::mutex doneMutex;
+  std::condition_variable tasksDone;
+  size_t finishedTasks = 0;
+
+  for(size_t t=0;t<tasks.size();t++){
+    const std::vector<size_t> &task = tasks[t];
+    pool.submit([this, &requests, &task, &headers, &rescale, &queue, &remainingTasks, &failed,
+                 &fileTasks, &parsedFiles, &parsedMutex, &doneMutex, &tasksDone, &finishedTasks](){
+      const std::string &path = requests[task[0]].path;
+      std::chrono::steady_clock::time_point taskStart = std::chrono::steady_clock::now();
+      double decodedBytes = 0;
+      unsigned long decodedFrames = 0;
+
+      // native frames of a parsed header are read through the frame index;
+      //  everything else is decoded from a dataset of this task
+      FileHeader header;
+      std::map<std::string, FileHeader>::const_iterator parsed = headers.find(path);
+      if(parsed != headers.end())
+        header = parsed->second;
+      std::shared_ptr<const dcmHelpersFrameIndex> index;
+      if(header.valid && header.indexable){
+        index = dcmHelpersFrameIndex::get(path);
+        if(index && index->isEncapsulated())
+          index.reset();
+      }
+      std::unique_ptr<DcmFileFormat> fileFormat;
+      DcmDataset *dataset = NULL;
+      DcmPixelData *pixelData = NULL;
+      bool parseHere = !index;
+      if(parseHere){
+        {
+          std::lock_guard<std::mutex> lock(parsedMutex);
+          std::multimap<std::string, std::unique_ptr<DcmFileFormat> >::iterator it = parsedFiles.find(path);
+          if(it != parsedFiles.end()){
+            fileFormat = std::move(it->second);
+            parsedFiles.erase(it);
+          }
+        }
+        if(!fileFormat){
+          fileFormat.reset(new DcmFileFormat());
+          if(fileFormat->loadFile(path.c_str()).bad())
+            fileFormat.reset();
+        }
+        DcmElement *element = NULL;
+        if(fileFormat && fileFormat->getDataset()->findAndGetElement(DCM_PixelData, element).good()){
+          dataset = fileFormat->getDataset();
+          pixelData = OFstatic_cast(DcmPixelData*, element);
+          if(!header.valid)
+            readHeader(dataset, path, header);
+          if(header.indexable){
+            index = dcmHelpersFrameIndex::get(path);
+            if(index && index->isEncapsulated())
+              index.reset();
+          }
+        } else {
+          std::cerr << "Failed to access pixel data in " << path << std::endl;
+          failed = true;
+        }
+      }
+      if((dataset || index) && !header.valid)
+        failed = true;
+
+      DcmFileCache cache;
+      Uint32 startFragment = 0;
+      unsigned long nextFrame = 0;
+      for(size_t i=0;header.valid && (dataset || index) && i<task.size();i++){
+        const dcmHelpersFrameRequest &request = requests[task[i]];
+        // the fragment position is only known when continuing with the next frame
+        if(request.frameNumber != nextFrame)
+          startFragment = 0;
+        std::vector<unsigned char> *buffer = bufferPool.acquire(header.frameSize);
+        OFCondition cond = EC_Normal;
+        if(index){
+          if(!index->readFrame(request.frameNumber, *buffer) || buffer->size() != header.frameSize)
+            cond = EC_IllegalCall;
+        } else {
+          OFString colorModel;
+          cond = pixelData->getUncompressedFrame(dataset, request.frameNumber,
+                                                 startFragment, &(*buffer)[0], header.frameSize,
+                                                 colorModel, &cache);
+        }
+        if(cond.bad()){
+          std::cerr << "Failed to decode frame " << request.frameNumber << " of " << path
+                    << ": " << cond.text() << std::endl;
+          bufferPool.release(buffer);
+          startFragment = 0;
+          failed = true;
+          continue;
+        }
+        nextFrame = request.frameNumber + 1;
+        decodedBytes += header.frameSize;
+        decodedFrames++;
+
+        QueuedFrame queued;
+        queued.frame = header.frame;
+        // enhanced multi-frame images keep the modality LUT in the functional groups
+        if(parsed != headers.end()){
+          queued.frame.rescaleSlope = rescale[task[i]].first;
+          queued.frame.rescaleIntercept = rescale[task[i]].second;
+        } else {
+          std::pair<double, double> frameRescale(1., 0.);
+          getRescale(dataset, request.frameNumber, frameRescale);
+          queued.frame.rescaleSlope = frameRescale.first;
+          queued.frame.rescaleIntercept = frameRescale.second;
+        }
+        queued.frame.userIndex = request.userIndex;
+        queued.frame.data = &(*buffer)[0];
+        queued.frame.length = header.frameSize;
+        queued.buffer = buffer;
+        if(!queue.push(queued))
+          bufferPool.release(buffer);
+      }
+
+      addStatistics(header.codec, decodedFrames, decodedBytes, secondsSince(taskStart));
+      {
+        // the parsed file is kept for the remaining tasks of the file only
+        std::lock_guard<std::mutex> lock(parsedMutex);
+        if(--fileTasks[path] == 0)
+          parsedFiles.erase(path);
+        else if(fileFormat)
+          parsedFiles.insert(std::make_pair(path, std::move(fileFormat)));
+      }
+      fileFormat.reset();
+      if(--remainingTasks == 0)
+        queue.close();
+      std::lock_guard<std::mutex> lock(doneMutex);
+      finishedTasks++;
+      tasksDone.notify_all();
+    });
+  }
+
+  // consume on the calling thread while the workers keep decoding
+  QueuedFrame queued;
+  while(queue.pop(queued)){
+    consumer(queued.frame);
+    bufferPool.release(queued.buffer);
+  }
+  {
+    std::unique_lock<std::mutex> lock(doneMutex);
+    tasksDone.wait(lock, [&finishedTasks, &tasks]{ return finishedTasks == tasks.size(); });
+  }
+
+  wallSeconds += secondsSince(start);
+  return !failed;
+}
+
+void dcmHelpersFrameDecoder::addStatistics(const std::string &codec, unsigned long frames,
+                                           double bytes, double seconds){
+  std::lock_guard<std::mutex> lock(statisticsMutex);
+  CodecStatistics &s = statistics[codec];
+  s.frames += frames;
+  s.bytes += bytes;
+  s.seconds += seconds;
+}
+
+void dcmHelpersFrameDecoder::printStatistics(std::ostream &out) const {
+  std::lock_guard<std::mutex> lock(statisticsMutex);
+  double totalBytes = 0;
+  out << "Frame decoding (MB/s per decoding thread):" << std::endl;
+  for(std::map<std::string, CodecStatistics>::const_iterator it=statistics.begin();
+      it!=statistics.end();++it){
+    const CodecStatistics &s = it->second;
+    totalBytes += s.bytes;
+    out << "  " << it->first << ": " << s.frames << " frames, "
+        << std::fixed << std::setprecision(1) << s.bytes / 1048576. << " MB, "
+        << (s.seconds > 0 ? s.bytes / 1048576. / s.seconds : 0.) << " MB/s" << std::endl;
+  }
+  out << "  total: " << std::fixed << std::setprecision(1)
+      << (wallSeconds > 0 ? totalBytes / 1048576. / wallSeconds : 0.) << " MB/s wall clock, "
+      << bufferPool.getNumberOfBuffers() << " frame buffers allocated" << std::endl;
+}
@@ -0,0 +1,103 @@
+#ifndef __dcmHelpersFrameDecoder_h
+#define __dcmHelpersFrameDecoder_h
+
+#include <functional>
+#include <iosfwd>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+class DcmDataset;
+
+// One frame to be decoded; frameNumber is 0-based, userIndex is passed
+// through unchanged so that the consumer can match the result to its request.
+// dataset is the already parsed header of the file (e.g. from the input
+// registry), or NULL to have the decoder parse it.
+struct dcmHelpersFrameRequest {
+  std::string path;
+  unsigned long frameNumber;
+  size_t userIndex;
+  DcmDataset *dataset;
+};
+
+// Decoded frame in native byte order, together with the attributes needed
+// to interpret the pixel values.
+struct dcmHelpersDecodedFrame {
+  size_t userIndex;
+  const unsigned char *data;
+  size_t length;
+  unsigned short rows;
+  unsigned short columns;
+  unsigned short samplesPerPixel;
+  unsigned short bitsAllocated;
+  unsigned short pixelRepresentation;
+  double rescaleSlope;
+  double rescaleIntercept;
+};
+
+// Recycles frame buffers so that a decode run allocates at most one buffer
+// per frame in flight, independent of the number of frames decoded.
+class dcmHelpersFrameBufferPool {
+  public:
+    dcmHelpersFrameBufferPool() : allocated(0) {}
+    ~dcmHelpersFrameBufferPool();
+
+    std::vector<unsigned char>* acquire(size_t length);
+    void release(std::vector<unsigned char>*);
+    size_t getNumberOfBuffers() const { return allocated; }
+
+  private:
+    std::vector<std::vector<unsigned char>*> freeBuffers;
+    std::mutex mutex;
+    size_t allocated;
+};
+
+// Decodes frames of (possibly compressed) DICOM images concurrently using the
+// codecs registered with DCMTK (dcmjpeg, dcmjpls, dcmrle), and hands them in
+// completion order to a consumer running on the calling thread. At most
+// queueDepth decoded frames are kept waiting for the consumer.
+//
+// Given datasets are only accessed on the calling thread. Native frames of
+// such files are read through the frame index without parsing the file again;
+// compressed frames are decoded through a DcmFileFormat of each worker, as
+// DCMTK objects cannot be shared between threads.
+class dcmHelpersThreadPool;
+
+class dcmHelpersFrameDecoder {
+  public:
+    typedef std::function<void(const dcmHelpersDecodedFrame&)> Consumer;
+
+    dcmHelpersFrameDecoder(unsigned numThreads = 0, unsigned queueDepth = 16);
+    ~dcmHelpersFrameDecoder();
+
+    static void registerCodecs();
+    static void cleanupCodecs();
+
+    // returns false if any of the requested frames could not be decoded
+    bool decodeFrames(const std::vector<dcmHelpersFrameRequest>&, const Consumer&);
+
+    void printStatistics(std::ostream&) const;
+
+  private:
+    struct CodecStatistics {
+      CodecStatistics() : frames(0), bytes(0), seconds(0) {}
+      unsigned long frames;
+      double bytes;
+      double seconds;
+    };
+
+    void addStatistics(const std::string &codec, unsigned long frames, double bytes, double seconds);
+
+    unsigned numThreads;
+    unsigned queueDepth;
+    // created on first use and kept, so that repeated runs find the workers started
+    std::unique_ptr<dcmHelpersThreadPool> pool;
+    dcmHelpersFrameBufferPool bufferPool;
+    mutable std::mutex statisticsMutex;
+    std::map<std::string, CodecStatistics> statistics;
+    double wallSeconds;
+};
+
+#endif
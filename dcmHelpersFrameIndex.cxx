@@ -0,0 +1,564 @@
+#include "dcmHelpersFrameIndex.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <list>
+#include <map>
+#include <mutex>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+const unsigned long UNDEFINED_LENGTH = 0xFFFFFFFFUL;
+const int MAX_NESTING_DEPTH = 64;
+const size_t WINDOW_SIZE = 65536;
+// indices kept by get(), enough for the sources of a few large series
+const size_t MAX_CACHED_INDICES = 16384;
+// descriptors kept open for frame reads, far fewer than cached indices
+const size_t MAX_OPEN_FILES = 64;
+
+inline unsigned short le16(const unsigned char *p){
+  return p[0] | (p[1] << 8);
+}
+
+inline unsigned long le32(const unsigned char *p){
+  return (unsigned long)p[0] | ((unsigned long)p[1] << 8) |
+         ((unsigned long)p[2] << 16) | ((unsigned long)p[3] << 24);
+}
+
+inline unsigned long long le64(const unsigned char *p){
+  return (unsigned long long)le32(p) | ((unsigned long long)le32(p+4) << 32);
+}
+
+inline unsigned long tagKey(unsigned short group, unsigned short element){
+  return ((unsigned long)group << 16) | element;
+}
+
+const unsigned long TAG_TransferSyntaxUID = 0x00020010UL;
+const unsigned long TAG_SamplesPerPixel = 0x00280002UL;
+const unsigned long TAG_NumberOfFrames = 0x00280008UL;
+const unsigned long TAG_Rows = 0x00280010UL;
+const unsigned long TAG_Columns = 0x00280011UL;
+const unsigned long TAG_BitsAllocated = 0x00280100UL;
+const unsigned long TAG_ExtendedOffsetTable = 0x7FE00001UL;
+const unsigned long TAG_ExtendedOffsetTableLengths = 0x7FE00002UL;
+const unsigned long TAG_PixelData = 0x7FE00010UL;
+const unsigned long TAG_Item = 0xFFFEE000UL;
+const unsigned long TAG_ItemDelimitation = 0xFFFEE00DUL;
+const unsigned long TAG_SequenceDelimitation = 0xFFFEE0DDUL;
+
+struct ElementHeader {
+  unsigned long tag;
+  char vr[2];
+  unsigned long length;
+  unsigned headerLength;
+};
+
+bool hasLongLength(const char *vr){
+  static const char *longVRs[] = {"OB","OD","OF","OL","OV","OW","SQ","SV","UC","UN","UR","UT","UV"};
+  for(size_t i=0;i<sizeof(longVRs)/sizeof(longVRs[0]);i++)
+    if(vr[0] == longVRs[i][0] && vr[1] == longVRs[i][1])
+      return true;
+  return false;
+}
+
+// fragments are read through pread() directly, the dataset is parsed through
+// a read window so that small elements do not each cost a system call
+struct WindowReader {
+  WindowReader(int fd, unsigned long long fileSize) :
+    fd(fd), fileSize(fileSize), windowOffset(0), windowLength(0), window(WINDOW_SIZE) {}
+
+  bool read(unsigned long long offset, void *buffer, size_t length){
+    if(offset + length > fileSize)
+      return false;
+    if(length > WINDOW_SIZE)
+      return pread(fd, buffer, length, offset) == (ssize_t)length;
+    if(offset < windowOffset || offset + length > windowOffset + windowLength){
+      ssize_t n = pread(fd, &window[0], WINDOW_SIZE, offset);
+      if(n < (ssize_t)length)
+        return false;
+      windowOffset = offset;
+      windowLength = n;
+    }
+    memcpy(buffer, &window[offset - windowOffset], length);
+    return true;
+  }
+
+  bool readHeader(unsigned long long offset, bool explicitVR, ElementHeader &header){
+    unsigned char h[12];
+    if(!read(offset, h, 8))
+      return false;
+    header.tag = tagKey(le16(h), le16(h+2));
+    header.vr[0] = header.vr[1] = 0;
+    header.headerLength = 8;
+    if(le16(h) == 0xFFFE || !explicitVR){
+      header.length = le32(h+4);
+    } else {
+      header.vr[0] = h[4];
+      header.vr[1] = h[5];
+      if(hasLongLength(header.vr)){
+        if(!read(offset + 8, h + 8, 4))
+          return false;
+        header.length = le32(h+8);
+        header.headerLength = 12;
+      } else {
+        header.length = le16(h+6);
+      }
+    }
+    return true;
+  }
+
+  bool skipItems(unsigned long long &offset, bool explicitVR, int depth);
+  bool skipElement(unsigned long long &offset, bool explicitVR, int depth);
+
+  int fd;
+  unsigned long long fileSize;
+  unsigned long long windowOffset;
+  size_t windowLength;
+  std::vector<unsigned char> window;
+};
+
+// skip the items of a sequence of undefined length, up to and including the
+// sequence delimitation item
+bool WindowReader::skipItems(unsigned long long &offset, bool explicitVR, int depth){
+  if(depth > MAX_NESTING_DEPTH)
+    return false;
+  for(;;){
+    ElementHeader item;
+    if(!readHeader(offset, explicitVR, item))
+      return false;
+    offset += 8;
+    if(item.tag == TAG_SequenceDelimitation)
+      return true;
+    if(item.tag != TAG_Item)
+      return false;
+    if(item.length != UNDEFINED_LENGTH){
+      offset += item.length;
+      continue;
+    }
+    for(;;){
+      ElementHeader element;
+      if(!readHeader(offset, explicitVR, element))
+        return false;
+      if(element.tag == TAG_ItemDelimitation){
+        offset += 8;
+        break;
+      }
+      if(!skipElement(offset, explicitVR, depth+1))
+        return false;
+    }
+  }
+}
+
+bool WindowReader::skipElement(unsigned long long &offset, bool explicitVR, int depth){
+  ElementHeader element;
+  if(!readHeader(offset, explicitVR, element))
+    return false;
+  offset += element.headerLength;
+  if(element.length != UNDEFINED_LENGTH){
+    offset += element.length;
+    return offset <= fileSize;
+  }
+  // undefined length: a sequence, encapsulated pixel data, or UN whose
+  // content is encoded in implicit VR little endian
+  bool unknownVR = element.vr[0] == 'U' && element.vr[1] == 'N';
+  return skipItems(offset, explicitVR && !unknownVR, depth+1);
+}
+
+}
+
+
+// A reader holds on to its descriptor, so that it stays open while in use
+// even when it is dropped from the list of open files.
+struct dcmHelpersFrameIndex::OpenFile {
+  explicit OpenFile(int fd) : fd(fd) {}
+  ~OpenFile() { ::close(fd); }
+  int fd;
+};
+
+std::mutex dcmHelpersFrameIndex::openFilesMutex;
+dcmHelpersFrameIndex::OpenFiles dcmHelpersFrameIndex::openFiles;
+
+dcmHelpersFrameIndex::dcmHelpersFrameIndex() :
+  fd(-1), fileSize(0), modified(0), encapsulated(false), indexSource(IS_Native),
+  rows(0), columns(0), samplesPerPixel(1), bitsAllocated(0), numberOfFrames(1),
+  pixelDataOffset(0), pixelDataLength(0){
+}
+
+dcmHelpersFrameIndex::~dcmHelpersFrameIndex(){
+  if(fd >= 0)
+    close(fd);
+  std::lock_guard<std::mutex> lock(openFilesMutex);
+  for(OpenFiles::iterator it=openFiles.begin();it!=openFiles.end();++it)
+    if(it->first == this){
+      openFiles.erase(it);
+      break;
+    }
+}
+
+const char* dcmHelpersFrameIndex::getIndexSourceName() const {
+  switch(indexSource){
+    case IS_Native: return "native";
+    case IS_ExtendedOffsetTable: return "Extended Offset Table";
+    case IS_BasicOffsetTable: return "Basic Offset Table";
+    case IS_FragmentScan: return "fragment scan";
+  }
+  return "unknown";
+}
+
+std::shared_ptr<dcmHelpersFrameIndex::OpenFile> dcmHelpersFrameIndex::getOpenFile() const {
+  {
+    std::lock_guard<std::mutex> lock(openFilesMutex);
+    for(OpenFiles::iterator it=openFiles.begin();it!=openFiles.end();++it)
+      if(it->first == this){
+        openFiles.splice(openFiles.begin(), openFiles, it);
+        return it->second;
+      }
+  }
+
+  int fileFd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if(fileFd < 0)
+    return std::shared_ptr<OpenFile>();
+  std::shared_ptr<OpenFile> file(new OpenFile(fileFd));
+  // the offsets are only valid for the file that was indexed; a file replaced
+  //  later is not seen through the descriptor opened here
+  struct stat st;
+  if(fstat(fileFd, &st) || (unsigned long long)st.st_size != fileSize || st.st_mtime != modified)
+    return std::shared_ptr<OpenFile>();
+
+  std::lock_guard<std::mutex> lock(openFilesMutex);
+  // another reader of the index may have opened it meanwhile
+  for(OpenFiles::iterator it=openFiles.begin();it!=openFiles.end();++it)
+    if(it->first == this)
+      return it->second;
+  openFiles.push_front(std::make_pair(this, file));
+  if(openFiles.size() > MAX_OPEN_FILES)
+    openFiles.pop_back();
+  return file;
+}
+
+// the file is only kept open while the index is built; frames are read
+//  through a shared descriptor, see getOpenFile()
+bool dcmHelpersFrameIndex::open(const std::string &fileName){
+  path = fileName;
+  fd = ::open(fileName.c_str(), O_RDONLY);
+  if(fd < 0)
+    return false;
+  bool indexed = buildIndex();
+  close(fd);
+  fd = -1;
+  return indexed;
+}
+
+bool dcmHelpersFrameIndex::buildIndex(){
+  struct stat st;
+  if(fstat(fd, &st))
+    return false;
+  fileSize = st.st_size;
+  modified = st.st_mtime;
+
+  WindowReader reader(fd, fileSize);
+  unsigned char preamble[132];
+  if(!reader.read(0, preamble, 132) || memcmp(preamble + 128, "DICM", 4))
+    return false;
+
+  // the meta header is always explicit VR little endian
+  unsigned long long offset = 132;
+  for(;;){
+    ElementHeader header;
+    if(!reader.readHeader(offset, true, header) || (header.tag >> 16) != 0x0002)
+      break;
+    if(header.tag == TAG_TransferSyntaxUID && header.length < 256){
+      char uid[256];
+      if(!reader.read(offset + header.headerLength, uid, header.length))
+        return false;
+      transferSyntaxUID.assign(uid, header.length);
+      while(!transferSyntaxUID.empty() &&
+            (transferSyntaxUID[transferSyntaxUID.size()-1] == '\0' || transferSyntaxUID[transferSyntaxUID.size()-1] == ' '))
+        transferSyntaxUID.erase(transferSyntaxUID.size()-1);
+    }
+    if(!reader.skipElement(offset, true, 0))
+      return false;
+  }
+
+  // big endian and deflated datasets cannot be indexed in place
+  if(transferSyntaxUID == "1.2.840.10008.1.2.2" || transferSyntaxUID == "1.2.840.10008.1.2.1.99")
+    return false;
+  bool explicitVR = transferSyntaxUID != "1.2.840.10008.1.2";
+  encapsulated = transferSyntaxUID != "1.2.840.10008.1.2" && transferSyntaxUID != "1.2.840.10008.1.2.1";
+
+  for(;;){
+    ElementHeader header;
+    if(!reader.readHeader(offset, explicitVR, header))
+      return false;
+    unsigned long long valueOffset = offset + header.headerLength;
+
+    if(header.tag == TAG_PixelData){
+      pixelDataOffset = valueOffset;
+      pixelDataLength = header.length;
+      break;
+    }
+
+    unsigned char value[16];
+    switch(header.tag){
+      case TAG_Rows:
+      case TAG_Columns:
+      case TAG_SamplesPerPixel:
+      case TAG_BitsAllocated:
+        if(header.length != 2 || !reader.read(valueOffset, value, 2))
+          return false;
+        if(header.tag == TAG_Rows) rows = le16(value);
+        else if(header.tag == TAG_Columns) columns = le16(value);
+        else if(header.tag == TAG_SamplesPerPixel) samplesPerPixel = le16(value);
+        else bitsAllocated = le16(value);
+        break;
+      case TAG_NumberOfFrames:
+        if(header.length < sizeof(value) && reader.read(valueOffset, value, header.length)){
+          value[header.length] = 0;
+          numberOfFrames = strtoul((const char*)value, NULL, 10);
+        }
+        break;
+      case TAG_ExtendedOffsetTable:
+      case TAG_ExtendedOffsetTableLengths:
+        if(header.length != UNDEFINED_LENGTH){
+          std::vector<unsigned char> table(header.length);
+          if(header.length && !reader.read(valueOffset, &table[0], header.length))
+            return false;
+          std::vector<unsigned long long> &values =
+            header.tag == TAG_ExtendedOffsetTable ? extendedOffsets : extendedLengths;
+          for(size_t i=0;i+8<=table.size();i+=8)
+            values.push_back(le64(&table[i]));
+        }
+        break;
+    }
+
+    if(!reader.skipElement(offset, explicitVR, 0))
+      return false;
+  }
+
+  if(!rows || !columns || !bitsAllocated || !numberOfFrames)
+    return false;
+  return encapsulated ? indexEncapsulatedFrames() : indexNativeFrames();
+}
+
+bool dcmHelpersFrameIndex::indexNativeFrames(){
+  indexSource = IS_Native;
+  unsigned long long frameBits = (unsigned long long)rows * columns * samplesPerPixel * bitsAllocated;
+  if(pixelDataLength == UNDEFINED_LENGTH || (frameBits * numberOfFrames + 7) / 8 > pixelDataLength)
+    return false;
+  frames.resize(numberOfFrames);
+  for(unsigned long f=0;f<numberOfFrames;f++){
+    unsigned long long firstBit = f * frameBits;
+    FrameExtent &extent = frames[f];
+    extent.offset = pixelDataOffset + firstBit / 8;
+    extent.firstBit = firstBit % 8;
+    extent.length = (extent.firstBit + frameBits + 7) / 8;
+    extent.includesItemHeaders = false;
+  }
+  return true;
+}
+
+bool dcmHelpersFrameIndex::indexEncapsulatedFrames(){
+  WindowReader reader(fd, fileSize);
+  ElementHeader header;
+
+  // Basic Offset Table, offsets relative to the first fragment item
+  if(!reader.readHeader(pixelDataOffset, false, header) || header.tag != TAG_Item ||
+     header.length == UNDEFINED_LENGTH)
+    return false;
+  std::vector<unsigned long> basicOffsets(header.length / 4);
+  if(header.length){
+    std::vector<unsigned char> table(header.length);
+    if(!reader.read(pixelDataOffset + 8, &table[0], header.length))
+      return false;
+    for(size_t i=0;i<basicOffsets.size();i++)
+      basicOffsets[i] = le32(&table[4*i]);
+  }
+  unsigned long long firstFragment = pixelDataOffset + 8 + header.length;
+  frames.resize(numberOfFrames);
+
+  // Extended Offset Table: one fragment per frame, lengths given
+  if(extendedOffsets.size() == numberOfFrames && extendedLengths.size() == numberOfFrames){
+    indexSource = IS_ExtendedOffsetTable;
+    for(unsigned long f=0;f<numberOfFrames;f++){
+      frames[f].offset = firstFragment + extendedOffsets[f] + 8;
+      frames[f].length = extendedLengths[f];
+      frames[f].firstBit = 0;
+      frames[f].includesItemHeaders = false;
+      if(frames[f].offset + frames[f].length > fileSize)
+        return false;
+    }
+    return true;
+  }
+
+  // All other cases need the fragment list, or at least the end of the last frame
+  std::vector<std::pair<unsigned long long, unsigned long> > fragments;
+  unsigned long long offset = firstFragment;
+  if(basicOffsets.size() == numberOfFrames)
+    offset += basicOffsets[numberOfFrames-1];
+  for(;;){
+    if(!reader.readHeader(offset, false, header))
+      return false;
+    if(header.tag == TAG_SequenceDelimitation)
+      break;
+    if(header.tag != TAG_Item || header.length == UNDEFINED_LENGTH)
+      return false;
+    fragments.push_back(std::make_pair(offset, header.length));
+    offset += 8 + header.length;
+  }
+  unsigned long long pixelDataEnd = offset;
+
+  // Basic Offset Table: frames may span several fragments
+  if(basicOffsets.size() == numberOfFrames){
+    indexSource = IS_BasicOffsetTable;
+    for(unsigned long f=0;f<numberOfFrames;f++){
+      unsigned long long start = firstFragment + basicOffsets[f];
+      unsigned long long end = f+1 < numberOfFrames ? firstFragment + basicOffsets[f+1] : pixelDataEnd;
+      if(end <= start || end > pixelDataEnd)
+        return false;
+      frames[f].offset = start;
+      frames[f].length = end - start;
+      frames[f].firstBit = 0;
+      frames[f].includesItemHeaders = true;
+    }
+    return true;
+  }
+
+  // no offset table: group the fragments by frame
+  indexSource = IS_FragmentScan;
+  std::vector<size_t> frameStarts;
+  if(fragments.size() == numberOfFrames){
+    for(size_t i=0;i<fragments.size();i++)
+      frameStarts.push_back(i);
+  } else if(numberOfFrames == 1){
+    frameStarts.push_back(0);
+  } else {
+    for(size_t i=0;i<fragments.size();i++)
+      if(isFrameStart(fragments[i].first + 8, fragments[i].second))
+        frameStarts.push_back(i);
+  }
+  if(frameStarts.size() != numberOfFrames || fragments.empty() || frameStarts[0] != 0)
+    return false;
+
+  for(unsigned long f=0;f<numberOfFrames;f++){
+    size_t first = frameStarts[f];
+    size_t last = f+1 < numberOfFrames ? frameStarts[f+1] - 1 : fragments.size() - 1;
+    frames[f].firstBit = 0;
+    if(first == last){
+      frames[f].offset = fragments[first].first + 8;
+      frames[f].length = fragments[first].second;
+      frames[f].includesItemHeaders = false;
+    } else {
+      frames[f].offset = fragments[first].first;
+      frames[f].length = fragments[last].first + 8 + fragments[last].second - fragments[first].first;
+      frames[f].includesItemHeaders = true;
+    }
+  }
+  return true;
+}
+
+// Recognize the start of a compressed frame from the first bytes of a fragment
+bool dcmHelpersFrameIndex::isFrameStart(unsigned long long fragmentOffset, unsigned long length) const {
+  unsigned char b[8];
+  if(length < 8 || pread(fd, b, 8, fragmentOffset) != 8)
+    return false;
+  // JPEG, JPEG-LS: SOI marker
+  if(b[0] == 0xFF && b[1] == 0xD8 && b[2] == 0xFF)
+    return true;
+  // JPEG 2000 codestream or JP2 signature box
+  if((b[0] == 0xFF && b[1] == 0x4F && b[2] == 0xFF && b[3] == 0x51) ||
+     !memcmp(b, "\x00\x00\x00\x0C\x6A\x50\x20\x20", 8))
+    return true;
+  // RLE header: number of segments, followed by the offset of the first segment
+  unsigned long segments = le32(b);
+  return segments >= 1 && segments <= 15 && le32(b+4) == 64;
+}
+
+bool dcmHelpersFrameIndex::readFrame(unsigned long frame, std::vector<unsigned char> &buffer,
+                                     size_t *firstBit) const {
+  if(frame >= frames.size())
+    return false;
+  const FrameExtent &extent = frames[frame];
+  std::shared_ptr<OpenFile> file = getOpenFile();
+  if(!file)
+    return false;
+  buffer.resize(extent.length);
+  size_t done = 0;
+  while(done < extent.length){
+    ssize_t n = pread(file->fd, &buffer[done], extent.length - done, extent.offset + done);
+    if(n <= 0)
+      break;
+    done += n;
+  }
+  if(done < extent.length)
+    return false;
+  if(firstBit)
+    *firstBit = extent.firstBit;
+
+  if(extent.includesItemHeaders){
+    // concatenate the fragments of the frame
+    size_t in = 0, out = 0;
+    while(in + 8 <= buffer.size()){
+      if(tagKey(le16(&buffer[in]), le16(&buffer[in+2])) != TAG_Item)
+        return false;
+      unsigned long length = le32(&buffer[in+4]);
+      if(in + 8 + length > buffer.size())
+        return false;
+      memmove(&buffer[out], &buffer[in+8], length);
+      out += length;
+      in += 8 + length;
+    }
+    buffer.resize(out);
+  }
+  return true;
+}
+
+std::shared_ptr<const dcmHelpersFrameIndex> dcmHelpersFrameIndex::get(const std::string &path){
+  struct CacheEntry {
+    long long size;
+    long long modified;
+    std::shared_ptr<const dcmHelpersFrameIndex> index;
+    std::list<std::string>::iterator used;
+  };
+  static std::mutex cacheMutex;
+  static std::map<std::string, CacheEntry> cache;
+  // paths by their last use, the least recently used are dropped first
+  static std::list<std::string> order;
+
+  struct stat st;
+  if(stat(path.c_str(), &st))
+    return std::shared_ptr<const dcmHelpersFrameIndex>();
+
+  {
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    std::map<std::string, CacheEntry>::const_iterator it = cache.find(path);
+    if(it != cache.end() && it->second.size == st.st_size && it->second.modified == st.st_mtime){
+      order.splice(order.end(), order, it->second.used);
+      return it->second.index;
+    }
+  }
+
+  std::shared_ptr<dcmHelpersFrameIndex> index(new dcmHelpersFrameIndex());
+  if(!index->open(path))
+    return std::shared_ptr<const dcmHelpersFrameIndex>();
+
+  std::lock_guard<std::mutex> lock(cacheMutex);
+  std::map<std::string, CacheEntry>::iterator it = cache.find(path);
+  if(it == cache.end()){
+    it = cache.insert(std::make_pair(path, CacheEntry())).first;
+    it->second.used = order.insert(order.end(), path);
+    if(order.size() > MAX_CACHED_INDICES){
+      cache.erase(order.front());
+      order.pop_front();
+    }
+  } else {
+    order.splice(order.end(), order, it->second.used);
+  }
+  CacheEntry &entry = it->second;
+  entry.size = st.st_size;
+  entry.modified = st.st_mtime;
+  entry.index = index;
+  return index;
+}
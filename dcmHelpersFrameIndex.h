@@ -0,0 +1,95 @@
+#ifndef __dcmHelpersFrameIndex_h
+#define __dcmHelpersFrameIndex_h
+
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Byte offsets of the frames in the Pixel Data of a DICOM file, so that any
+// frame can be fetched with a single positioned read instead of loading the
+// whole element. For encapsulated pixel data the index is taken from the
+// Extended Offset Table or the Basic Offset Table, or built by scanning the
+// fragment headers once if neither is present.
+//
+// The file is parsed directly (little endian transfer syntaxes only), without
+// going through DCMTK, so that building the index never touches pixel data.
+class dcmHelpersFrameIndex {
+  public:
+    enum IndexSource {
+      IS_Native,
+      IS_ExtendedOffsetTable,
+      IS_BasicOffsetTable,
+      IS_FragmentScan
+    };
+
+    dcmHelpersFrameIndex();
+    ~dcmHelpersFrameIndex();
+
+    bool open(const std::string &path);
+
+    // indices are shared by path, so that the fragment scan is done only once;
+    // the most recently used files are kept. Returns an empty pointer on
+    // failure
+    static std::shared_ptr<const dcmHelpersFrameIndex> get(const std::string &path);
+
+    // read a 0-based frame with a single pread(); for encapsulated pixel data
+    // this is the compressed bitstream of the frame, for native pixel data with
+    // one bit allocated the frame starts at bit *firstBit of the buffer. The
+    // descriptors of the recently read indices are kept open and shared, and
+    // only a file of the indexed size and modification time is read
+    bool readFrame(unsigned long frame, std::vector<unsigned char> &buffer, size_t *firstBit = NULL) const;
+
+    unsigned long getNumberOfFrames() const { return frames.size(); }
+    bool isEncapsulated() const { return encapsulated; }
+    IndexSource getIndexSource() const { return indexSource; }
+    const char* getIndexSourceName() const;
+    const std::string& getTransferSyntaxUID() const { return transferSyntaxUID; }
+    unsigned short getRows() const { return rows; }
+    unsigned short getColumns() const { return columns; }
+    unsigned short getBitsAllocated() const { return bitsAllocated; }
+
+  private:
+    dcmHelpersFrameIndex(const dcmHelpersFrameIndex&);
+    dcmHelpersFrameIndex& operator=(const dcmHelpersFrameIndex&);
+
+    struct FrameExtent {
+      unsigned long long offset;
+      unsigned long long length;
+      // bit offset into the first byte (native, one bit allocated)
+      unsigned char firstBit;
+      // the extent starts at a fragment item header and covers more than one
+      // fragment; the item headers are removed after reading
+      bool includesItemHeaders;
+    };
+
+    struct OpenFile;
+    typedef std::list<std::pair<const dcmHelpersFrameIndex*, std::shared_ptr<OpenFile> > > OpenFiles;
+
+    std::shared_ptr<OpenFile> getOpenFile() const;
+    bool buildIndex();
+    bool indexNativeFrames();
+    bool indexEncapsulatedFrames();
+    bool isFrameStart(unsigned long long fragmentOffset, unsigned long length) const;
+
+    std::string path;
+    // open while the index is built only
+    int fd;
+    unsigned long long fileSize;
+    long long modified;
+    std::string transferSyntaxUID;
+    bool encapsulated;
+    IndexSource indexSource;
+    unsigned short rows, columns, samplesPerPixel, bitsAllocated;
+    unsigned long numberOfFrames;
+    unsigned long long pixelDataOffset, pixelDataLength;
+    std::vector<unsigned long long> extendedOffsets, extendedLengths;
+    std::vector<FrameExtent> frames;
+
+    // descriptors of the indices read most recently, most recent first
+    static std::mutex openFilesMutex;
+    static OpenFiles openFiles;
+};
+
+#endif
@@ -0,0 +1,120 @@
+#include "dcmHelpersHeaderCache.h"
+#include "dcmHelpersCommon.h"
+#include "dcmHelpersPrefetcher.h"
+#include "dcmtk/config/osconfig.h"
+#include "dcmtk/dcmdata/dctk.h"
+
+#include <algorithm>
+#include <iostream>
+
+#include <sys/stat.h>
+
+namespace {
+
+// memory held by a parsed header: the encoded length of the dataset, without
+// the values that were left on disk
+size_t headerBytes(DcmFileFormat &fileFormat){
+  DcmDataset *dataset = fileFormat.getDataset();
+  size_t bytes = dataset->getLength(EXS_LittleEndianExplicit, EET_ExplicitLength);
+  DcmElement *pixelData;
+  if(dataset->findAndGetElement(DCM_PixelData, pixelData).good() && !pixelData->valueLoaded())
+    bytes -= std::min<size_t>(bytes, pixelData->getLength(EXS_LittleEndianExplicit, EET_ExplicitLength));
+  return bytes;
+}
+
+}
+
+dcmHelpersHeaderCache::dcmHelpersHeaderCache(size_t memoryBudget) :
+  memoryBudget(memoryBudget), bytes(0), hits(0), misses(0), reloads(0), evictions(0){
+}
+
+std::shared_ptr<DcmFileFormat> dcmHelpersHeaderCache::load(const std::string &path, dcmHelpersPrefetcher *prefetcher){
+  struct stat st;
+  if(stat(path.c_str(), &st)){
+    std::cerr << "Cannot access " << path << std::endl;
+    return std::shared_ptr<DcmFileFormat>();
+  }
+  std::string key = dcmHelpersCommon::canonicalPath(path);
+
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::map<std::string, Entry>::iterator it = entries.find(key);
+    if(it != entries.end()){
+      if(it->second.size == st.st_size && it->second.mtime == st.st_mtime){
+        hits++;
+        lru.splice(lru.begin(), lru, it->second.lru);
+        return it->second.fileFormat;
+      }
+      reloads++;
+      bytes -= it->second.bytes;
+      lru.erase(it->second.lru);
+      entries.erase(it);
+    }
+    misses++;
+  }
+
+  // parse without holding the lock
+  std::shared_ptr<DcmFileFormat> fileFormat(new DcmFileFormat());
+  OFCondition cond = prefetcher ? prefetcher->loadFile(path, *fileFormat) : fileFormat->loadFile(path.c_str());
+  if(cond.bad()){
+    std::cerr << "Failed to load " << path << ": " << cond.text() << std::endl;
+    return std::shared_ptr<DcmFileFormat>();
+  }
+
+  std::lock_guard<std::mutex> lock(mutex);
+  if(entries.count(key))
+    return fileFormat;
+  Entry &entry = entries[key];
+  entry.fileFormat = fileFormat;
+  entry.size = st.st_size;
+  entry.mtime = st.st_mtime;
+  entry.bytes = headerBytes(*fileFormat);
+  lru.push_front(key);
+  entry.lru = lru.begin();
+  bytes += entry.bytes;
+  trimLocked(memoryBudget);
+  return fileFormat;
+}
+
+bool dcmHelpersHeaderCache::contains(const std::string &path) const {
+  struct stat st;
+  if(stat(path.c_str(), &st))
+    return false;
+  std::lock_guard<std::mutex> lock(mutex);
+  std::map<std::string, Entry>::const_iterator it = entries.find(dcmHelpersCommon::canonicalPath(path));
+  return it != entries.end() && it->second.size == st.st_size && it->second.mtime == st.st_mtime;
+}
+
+void dcmHelpersHeaderCache::trim(size_t target){
+  std::lock_guard<std::mutex> lock(mutex);
+  trimLocked(target);
+}
+
+void dcmHelpersHeaderCache::trimLocked(size_t target){
+  while(bytes > target && !lru.empty()){
+    std::map<std::string, Entry>::iterator it = entries.find(lru.back());
+    bytes -= it->second.bytes;
+    entries.erase(it);
+    lru.pop_back();
+    evictions++;
+  }
+}
+
+size_t dcmHelpersHeaderCache::getMemoryUsage() const {
+  std::lock_guard<std::mutex> lock(mutex);
+  return bytes;
+}
+
+void dcmHelpersHeaderCache::printStatistics(std::ostream &out) const {
+  std::lock_guard<std::mutex> lock(mutex);
+  out << "Header cache: " << entries.size() << " headers, " << bytes / 1048576. << " MB; "
+      << hits << " hits, " << misses << " misses (" << reloads << " changed files), "
+      << evictions << " evicted" << std::endl;
+}
+
+void dcmHelpersHeaderCache::writeJSON(std::ostream &out) const {
+  std::lock_guard<std::mutex> lock(mutex);
+  out << "\"cache_entries\": " << entries.size() << ", \"cache_bytes\": " << bytes
+      << ", \"cache_hits\": " << hits << ", \"cache_misses\": " << misses
+      << ", \"cache_evictions\": " << evictions;
+}
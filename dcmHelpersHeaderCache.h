@@ -0,0 +1,64 @@
+#ifndef __dcmHelpersHeaderCache_h
+#define __dcmHelpersHeaderCache_h
+
+#include <iosfwd>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+class DcmFileFormat;
+class dcmHelpersPrefetcher;
+
+// Parsed DICOM headers kept across reports of a long-running process. Pixel
+// data stays on disk (it is larger than DCM_MaxReadLength), so an entry costs
+// about the size of its header. A file is parsed again when its size or
+// modification time changed. The least recently used entries are dropped when
+// the cache grows beyond memoryBudget bytes; entries still in use by a report
+// stay alive through their shared pointers.
+//
+// The DCMTK objects are not safe for concurrent use: reports that share
+// cached headers must not run at the same time.
+class dcmHelpersHeaderCache {
+  public:
+    explicit dcmHelpersHeaderCache(size_t memoryBudget = 512*1048576UL);
+
+    // empty pointer if the file cannot be loaded
+    std::shared_ptr<DcmFileFormat> load(const std::string &path, dcmHelpersPrefetcher *prefetcher = NULL);
+
+    // true if the file is cached and did not change since
+    bool contains(const std::string &path) const;
+
+    // drop entries until the cache uses at most target bytes
+    void trim(size_t target);
+
+    size_t getMemoryUsage() const;
+    void printStatistics(std::ostream&) const;
+    // statistics as JSON members, without the enclosing braces
+    void writeJSON(std::ostream&) const;
+
+  private:
+    dcmHelpersHeaderCache(const dcmHelpersHeaderCache&);
+    dcmHelpersHeaderCache& operator=(const dcmHelpersHeaderCache&);
+
+    struct Entry {
+      std::shared_ptr<DcmFileFormat> fileFormat;
+      long long size;
+      long long mtime;
+      size_t bytes;
+      std::list<std::string>::iterator lru;
+    };
+
+    void trimLocked(size_t target);
+
+    size_t memoryBudget;
+    mutable std::mutex mutex;
+    std::map<std::string, Entry> entries;
+    // most recently used first
+    std::list<std::string> lru;
+    size_t bytes;
+    unsigned long hits, misses, reloads, evictions;
+};
+
+#endif
@@ -0,0 +1,88 @@
+#include "dcmHelpersInputRegistry.h"
+#include "dcmHelpersCommon.h"
+#include "dcmHelpersHeaderCache.h"
+#include "dcmHelpersPrefetcher.h"
+#include "dcmtk/config/osconfig.h"
+#include "dcmtk/dcmdata/dctk.h"
+
+#include <iostream>
+
+DcmDataset* dcmHelpersInputRegistry::Input::getDataset() const {
+  return fileFormat->getDataset();
+}
+
+dcmHelpersInputRegistry::dcmHelpersInputRegistry(dcmHelpersPrefetcher *prefetcher,
+                                                 dcmHelpersHeaderCache *cache) :
+  prefetcher(prefetcher), cache(cache), requests(0), duplicateInstances(0){
+}
+
+dcmHelpersInputRegistry::~dcmHelpersInputRegistry(){
+  for(size_t i=0;i<inputs.size();i++)
+    delete inputs[i];
+}
+
+const dcmHelpersInputRegistry::Input* dcmHelpersInputRegistry::load(const std::string &path){
+  requests++;
+  std::string key = dcmHelpersCommon::canonicalPath(path);
+  std::map<std::string, Input*>::const_iterator it = byPath.find(key);
+  if(it != byPath.end())
+    return it->second;
+
+  std::shared_ptr<DcmFileFormat> fileFormat;
+  if(cache){
+    fileFormat = cache->load(path, prefetcher);
+    if(!fileFormat)
+      return NULL;
+  } else {
+    fileFormat.reset(new DcmFileFormat());
+    OFCondition cond = prefetcher ? prefetcher->loadFile(path, *fileFormat)
+                                  : fileFormat->loadFile(path.c_str());
+    if(cond.bad()){
+      std::cerr << "Failed to load " << path << ": " << cond.text() << std::endl;
+      return NULL;
+    }
+  }
+
+  OFString sopClassUID, sopInstanceUID;
+  fileFormat->getDataset()->findAndGetOFString(DCM_SOPClassUID, sopClassUID);
+  fileFormat->getDataset()->findAndGetOFString(DCM_SOPInstanceUID, sopInstanceUID);
+  if(!sopInstanceUID.empty()){
+    std::map<std::string, Input*>::const_iterator instance = bySOPInstanceUID.find(sopInstanceUID.c_str());
+    if(instance != bySOPInstanceUID.end()){
+      std::cerr << "Warning: " << path << " is another copy of " << instance->second->path
+                << ", using the first one" << std::endl;
+      duplicateInstances++;
+      byPath[key] = instance->second;
+      return instance->second;
+    }
+  }
+
+  Input *input = new Input();
+  input->path = path;
+  input->sopClassUID = sopClassUID.c_str();
+  input->sopInstanceUID = sopInstanceUID.c_str();
+  input->fileFormat = fileFormat;
+  inputs.push_back(input);
+  byPath[key] = input;
+  if(!input->sopInstanceUID.empty())
+    bySOPInstanceUID[input->sopInstanceUID] = input;
+  return input;
+}
+
+DcmDataset* dcmHelpersInputRegistry::loadDataset(const std::string &path){
+  const Input *input = load(path);
+  return input ? input->getDataset() : NULL;
+}
+
+const dcmHelpersInputRegistry::Input* dcmHelpersInputRegistry::findBySOPInstanceUID(
+    const std::string &sopInstanceUID) const {
+  std::map<std::string, Input*>::const_iterator it = bySOPInstanceUID.find(sopInstanceUID);
+  return it == bySOPInstanceUID.end() ? NULL : it->second;
+}
+
+void dcmHelpersInputRegistry::printStatistics(std::ostream &out) const {
+  out << "Inputs: " << inputs.size() << " unique files loaded for " << requests << " uses";
+  if(duplicateInstances)
+    out << ", " << duplicateInstances << " duplicate instances skipped";
+  out << std::endl;
+}
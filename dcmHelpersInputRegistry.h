@@ -0,0 +1,66 @@
+#ifndef __dcmHelpersInputRegistry_h
+#define __dcmHelpersInputRegistry_h
+
+#include <iosfwd>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+class DcmDataset;
+class DcmFileFormat;
+class dcmHelpersHeaderCache;
+class dcmHelpersPrefetcher;
+
+// Input files of a report, each parsed once and shared by all the stages that
+// use it. Files are identified by their canonical path and by SOPInstanceUID:
+// a second path to an instance that is already loaded resolves to the first
+// object. The registry keeps the loaded objects alive until its destruction;
+// with a header cache, the objects may be shared with other reports.
+class dcmHelpersInputRegistry {
+  public:
+    class Input {
+      public:
+        std::string path;
+        std::string sopClassUID;
+        std::string sopInstanceUID;
+
+        DcmFileFormat* getFileFormat() const { return fileFormat.get(); }
+        DcmDataset* getDataset() const;
+
+      private:
+        friend class dcmHelpersInputRegistry;
+        // owned by the registry, together with the header cache if any
+        std::shared_ptr<DcmFileFormat> fileFormat;
+    };
+
+    // files are taken from the header cache and loaded through the prefetcher
+    //  if given
+    explicit dcmHelpersInputRegistry(dcmHelpersPrefetcher *prefetcher = NULL,
+                                     dcmHelpersHeaderCache *cache = NULL);
+    ~dcmHelpersInputRegistry();
+
+    // returns NULL if the file cannot be loaded
+    const Input* load(const std::string &path);
+    DcmDataset* loadDataset(const std::string &path);
+
+    const Input* findBySOPInstanceUID(const std::string &sopInstanceUID) const;
+
+    // unique inputs in the order they were first loaded
+    const std::vector<Input*>& getInputs() const { return inputs; }
+
+    void printStatistics(std::ostream&) const;
+
+  private:
+    dcmHelpersInputRegistry(const dcmHelpersInputRegistry&);
+    dcmHelpersInputRegistry& operator=(const dcmHelpersInputRegistry&);
+
+    dcmHelpersPrefetcher *prefetcher;
+    dcmHelpersHeaderCache *cache;
+    std::vector<Input*> inputs;
+    std::map<std::string, Input*> byPath;
+    std::map<std::string, Input*> bySOPInstanceUID;
+    unsigned long requests, duplicateInstances;
+};
+
+#endif
@@ -0,0 +1,275 @@
+#include "dcmHelpersJobService.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <thread>
+
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace {
+
+const size_t LATENCY_WINDOW = 10000;
+const size_t MAX_REQUEST_LENGTH = 1048576;
+
+// one line, without the newline; false if the client sent nothing usable
+bool readLine(int connection, std::string &line){
+  line.clear();
+  char buffer[4096];
+  while(line.size() < MAX_REQUEST_LENGTH){
+    ssize_t n = recv(connection, buffer, sizeof(buffer), 0);
+    if(n <= 0)
+      return !line.empty();
+    line.append(buffer, n);
+    size_t end = line.find('\n');
+    if(end != std::string::npos){
+      line.resize(end);
+      return true;
+    }
+  }
+  return false;
+}
+
+std::vector<std::string> split(const std::string &line, char separator){
+  std::vector<std::string> fields;
+  size_t start = 0;
+  for(;;){
+    size_t end = line.find(separator, start);
+    fields.push_back(line.substr(start, end == std::string::npos ? std::string::npos : end - start));
+    if(end == std::string::npos)
+      return fields;
+    start = end + 1;
+  }
+}
+
+double percentile(const std::vector<double> &sorted, double p){
+  if(sorted.empty())
+    return 0;
+  size_t i = std::min(sorted.size() - 1, size_t(p * sorted.size()));
+  return sorted[i];
+}
+
+}
+
+dcmHelpersJobService::dcmHelpersJobService(const Handler &handler, size_t maxQueue, size_t memoryBudget,
+                                           size_t jobMemory) :
+  handler(handler), maxQueue(maxQueue ? maxQueue : 1), memoryBudget(memoryBudget), jobMemory(jobMemory),
+  running(false), stopping(false),
+  maxQueueDepth(0), accepted(0), completed(0), failed(0), rejected(0), nextLatency(0){
+}
+
+size_t dcmHelpersJobService::getResidentMemory(){
+  long pages = 0, resident = 0;
+  FILE *f = fopen("/proc/self/statm", "r");
+  if(!f)
+    return 0;
+  if(fscanf(f, "%ld %ld", &pages, &resident) != 2)
+    resident = 0;
+  fclose(f);
+  return size_t(resident) * sysconf(_SC_PAGESIZE);
+}
+
+bool dcmHelpersJobService::run(const std::string &socketPath){
+  struct sockaddr_un address;
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  if(socketPath.size() >= sizeof(address.sun_path)){
+    std::cerr << "Socket path is too long: " << socketPath << std::endl;
+    return false;
+  }
+  strcpy(address.sun_path, socketPath.c_str());
+
+  int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+  if(listener < 0){
+    std::cerr << "Cannot create socket: " << strerror(errno) << std::endl;
+    return false;
+  }
+  unlink(socketPath.c_str());
+  if(bind(listener, (struct sockaddr*)&address, sizeof(address)) || listen(listener, 64)){
+    std::cerr << "Cannot listen on " << socketPath << ": " << strerror(errno) << std::endl;
+    close(listener);
+    return false;
+  }
+
+  std::thread worker(&dcmHelpersJobService::runWorker, this);
+  while(true){
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      if(stopping)
+        break;
+    }
+    int connection = accept(listener, NULL, NULL);
+    if(connection < 0){
+      if(errno == EINTR)
+        continue;
+      std::cerr << "Failed to accept a connection: " << strerror(errno) << std::endl;
+      break;
+    }
+    handleConnection(connection, std::chrono::steady_clock::now());
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+    jobAvailable.notify_all();
+  }
+  worker.join();
+  close(listener);
+  unlink(socketPath.c_str());
+  return true;
+}
+
+void dcmHelpersJobService::handleConnection(int connection, std::chrono::steady_clock::time_point received){
+  // a client that does not send its request cannot block the service
+  struct timeval timeout = {5, 0};
+  setsockopt(connection, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+  std::string line;
+  if(!readLine(connection, line)){
+    close(connection);
+    return;
+  }
+  if(!line.empty() && line[line.size()-1] == '\r')
+    line.resize(line.size()-1);
+  std::vector<std::string> fields = split(line, '\t');
+
+  if(fields[0] == "STATS"){
+    std::ostringstream json;
+    writeStatistics(json);
+    reply(connection, json.str());
+  } else if(fields[0] == "SHUTDOWN"){
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+    jobAvailable.notify_all();
+    reply(connection, "OK shutting down after " + std::to_string(queue.size()) + " queued jobs");
+  } else if(fields[0] == "JOB"){
+    Job job;
+    job.connection = connection;
+    job.received = received;
+    for(size_t i=1;i<fields.size();i++){
+      size_t equals = fields[i].find('=');
+      if(equals == std::string::npos || !equals){
+        reply(connection, "ERROR malformed field " + fields[i]);
+        return;
+      }
+      job.request.insert(Request::value_type(fields[i].substr(0, equals), fields[i].substr(equals+1)));
+    }
+    std::string reason;
+    if(!admit(reason)){
+      reply(connection, "BUSY " + reason);
+      return;
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    queue.push_back(job);
+    accepted++;
+    maxQueueDepth = std::max(maxQueueDepth, queue.size());
+    jobAvailable.notify_one();
+  } else {
+    reply(connection, "ERROR unknown request " + fields[0]);
+  }
+}
+
+size_t dcmHelpersJobService::getAccountedMemory(size_t jobs){
+  return (memoryUsage ? memoryUsage() : 0) + jobs * jobMemory;
+}
+
+bool dcmHelpersJobService::admit(std::string &reason){
+  size_t pending;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    if(queue.size() >= maxQueue){
+      rejected++;
+      reason = "queue full";
+      return false;
+    }
+    pending = queue.size() + (running ? 1 : 0);
+  }
+  // the usage callback locks the cache it reports on, so it is called without
+  //  holding the queue lock
+  if(memoryBudget && getAccountedMemory(pending + 1) > memoryBudget){
+    if(memoryRelief)
+      memoryRelief();
+    if(pending && getAccountedMemory(pending + 1) > memoryBudget){
+      std::lock_guard<std::mutex> lock(mutex);
+      rejected++;
+      reason = "memory budget exceeded";
+      return false;
+    }
+  }
+  return true;
+}
+
+void dcmHelpersJobService::runWorker(){
+  while(true){
+    Job job;
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      jobAvailable.wait(lock, [this]{ return stopping || !queue.empty(); });
+      if(queue.empty())
+        return;
+      job = queue.front();
+      queue.pop_front();
+      running = true;
+    }
+
+    std::string message;
+    bool ok = handler(job.request, message);
+    double latency = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - job.received).count();
+    reply(job.connection, (ok ? "OK " : "ERROR ") + message);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    running = false;
+    if(ok)
+      completed++;
+    else
+      failed++;
+    if(latencies.size() < LATENCY_WINDOW)
+      latencies.push_back(latency);
+    else
+      latencies[nextLatency] = latency;
+    nextLatency = (nextLatency + 1) % LATENCY_WINDOW;
+  }
+}
+
+void dcmHelpersJobService::reply(int connection, const std::string &message){
+  std::string line = message + "\n";
+  for(size_t sent=0;sent<line.size();){
+    // MSG_NOSIGNAL: a client that went away must not terminate the service
+    ssize_t n = send(connection, line.data() + sent, line.size() - sent, MSG_NOSIGNAL);
+    if(n <= 0)
+      break;
+    sent += n;
+  }
+  close(connection);
+}
+
+void dcmHelpersJobService::writeStatistics(std::ostream &out){
+  std::vector<double> sorted;
+  size_t pending;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    sorted = latencies;
+    pending = queue.size() + (running ? 1 : 0);
+    out << "{\"queue_depth\": " << queue.size() << ", \"max_queue_depth\": " << maxQueueDepth
+        << ", \"accepted\": " << accepted << ", \"completed\": " << completed
+        << ", \"failed\": " << failed << ", \"rejected\": " << rejected;
+  }
+  std::sort(sorted.begin(), sorted.end());
+  out << std::fixed << std::setprecision(3)
+      << ", \"latency_ms\": {\"p50\": " << percentile(sorted, 0.5) << ", \"p90\": " << percentile(sorted, 0.9)
+      << ", \"p99\": " << percentile(sorted, 0.99) << ", \"max\": " << (sorted.empty() ? 0. : sorted.back())
+      << "}, \"accounted_bytes\": " << getAccountedMemory(pending)
+      << ", \"memory_budget_bytes\": " << memoryBudget << ", \"rss_bytes\": " << getResidentMemory();
+  if(statisticsWriter){
+    out << ", ";
+    statisticsWriter(out);
+  }
+  out << "}";
+}
@@ -0,0 +1,92 @@
+#ifndef __dcmHelpersJobService_h
+#define __dcmHelpersJobService_h
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <iosfwd>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Accepts jobs on a Unix domain socket and runs them one after another on a
+// worker thread, so that state kept between jobs (parsed headers, decoder
+// threads, the data dictionary) is reused. Each connection carries a single
+// request line, with tab-separated fields:
+//
+//   JOB<TAB>key=value<TAB>key=value...  ->  OK <message> | ERROR <message> | BUSY <reason>
+//   STATS                               ->  one line of JSON
+//   SHUTDOWN                            ->  OK; queued jobs are completed first
+//
+// The reply to a job is sent when the job is done. A job is refused with BUSY
+// when maxQueue jobs are waiting, or when the memory the service accounts for
+// would exceed memoryBudget bytes even after calling the memory relief
+// callback: the memory reported by the usage callback (cached headers) plus
+// jobMemory bytes reserved for each queued or running job, the new one
+// included. The resident memory of the process is not used, as freed heap
+// memory is rarely returned to the system; it is reported by STATS only. A job
+// is always admitted when no other job is queued or running.
+class dcmHelpersJobService {
+  public:
+    typedef std::multimap<std::string, std::string> Request;
+    // runs a job; returns false on failure, with the reply message set
+    typedef std::function<bool(const Request&, std::string &message)> Handler;
+
+    dcmHelpersJobService(const Handler &handler, size_t maxQueue = 64, size_t memoryBudget = 2048*1048576UL,
+                         size_t jobMemory = 64*1048576UL);
+
+    // memory kept between jobs, in bytes, that counts against the budget
+    void setMemoryUsage(const std::function<size_t()> &usage) { memoryUsage = usage; }
+    // called before refusing a job for lack of memory, to release caches
+    void setMemoryRelief(const std::function<void()> &relief) { memoryRelief = relief; }
+    // adds members to the STATS reply, written without the enclosing braces
+    void setStatisticsWriter(const std::function<void(std::ostream&)> &writer) { statisticsWriter = writer; }
+
+    // serve until a SHUTDOWN request; returns false if the socket cannot be set up
+    bool run(const std::string &socketPath);
+
+    static size_t getResidentMemory();
+
+  private:
+    dcmHelpersJobService(const dcmHelpersJobService&);
+    dcmHelpersJobService& operator=(const dcmHelpersJobService&);
+
+    struct Job {
+      int connection;
+      Request request;
+      std::chrono::steady_clock::time_point received;
+    };
+
+    void handleConnection(int connection, std::chrono::steady_clock::time_point received);
+    bool admit(std::string &reason);
+    void runWorker();
+    void writeStatistics(std::ostream&);
+    static void reply(int connection, const std::string &message);
+
+    size_t getAccountedMemory(size_t jobs);
+
+    Handler handler;
+    std::function<size_t()> memoryUsage;
+    std::function<void()> memoryRelief;
+    std::function<void(std::ostream&)> statisticsWriter;
+    size_t maxQueue;
+    size_t memoryBudget;
+    size_t jobMemory;
+
+    std::mutex mutex;
+    std::condition_variable jobAvailable;
+    std::deque<Job> queue;
+    // the worker is running a job
+    bool running;
+    bool stopping;
+
+    // statistics; latencies of the most recent jobs, in milliseconds
+    size_t maxQueueDepth;
+    unsigned long accepted, completed, failed, rejected;
+    std::vector<double> latencies;
+    size_t nextLatency;
+};
+
+#endif
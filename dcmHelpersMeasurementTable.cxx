@@ -0,0 +1,429 @@
+#include "dcmHelpersMeasurementTable.h"
+#include "dcmHelpersTerminology.h"
+#include "dcmtk/config/osconfig.h"
+#include "dcmtk/dcmdata/dctk.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <map>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+struct dcmHelpersMeasurementTable::ColumnEntry {
+  char name[40];
+  unsigned int type;
+  unsigned int reserved;
+  unsigned long long offset;
+  unsigned long long length;
+};
+
+namespace {
+
+const char MAGIC[8] = {'S','R','M','X','T','B','L','1'};
+
+struct FileHeader {
+  char magic[8];
+  unsigned long long rows;
+  unsigned int columns;
+  unsigned int reserved;
+};
+
+struct StringColumn {
+  const char *name;
+  std::string dcmHelpersMeasurement::*member;
+};
+
+// columns in file order; value and segment_number follow the strings
+const StringColumn STRING_COLUMNS[] = {
+  {"file", &dcmHelpersMeasurement::fileName},
+  {"sr_instance_uid", &dcmHelpersMeasurement::srInstanceUID},
+  {"tracking_identifier", &dcmHelpersMeasurement::trackingIdentifier},
+  {"tracking_uid", &dcmHelpersMeasurement::trackingUID},
+  {"concept_value", &dcmHelpersMeasurement::conceptValue},
+  {"concept_scheme", &dcmHelpersMeasurement::conceptScheme},
+  {"concept_meaning", &dcmHelpersMeasurement::conceptMeaning},
+  {"units_value", &dcmHelpersMeasurement::unitsValue},
+  {"units_scheme", &dcmHelpersMeasurement::unitsScheme},
+  {"derivation_value", &dcmHelpersMeasurement::derivationValue},
+  {"derivation_meaning", &dcmHelpersMeasurement::derivationMeaning},
+  {"segmentation_instance_uid", &dcmHelpersMeasurement::segmentationInstanceUID},
+  {"source_series_instance_uid", &dcmHelpersMeasurement::sourceSeriesInstanceUID}
+};
+const unsigned NUMBER_OF_STRING_COLUMNS = sizeof(STRING_COLUMNS) / sizeof(STRING_COLUMNS[0]);
+
+std::string getStringValue(DcmItem *item, const DcmTagKey &tag){
+  OFString value;
+  item->findAndGetOFString(tag, value);
+  return value.c_str();
+}
+
+bool getCode(DcmItem *item, const DcmTagKey &sequence, std::string &value, std::string &scheme,
+             std::string *meaning = NULL){
+  DcmItem *code;
+  if(item->findAndGetSequenceItem(sequence, code).bad())
+    return false;
+  value = getStringValue(code, DCM_CodeValue);
+  scheme = getStringValue(code, DCM_CodingSchemeDesignator);
+  if(meaning)
+    *meaning = getStringValue(code, DCM_CodeMeaning);
+  return true;
+}
+
+bool hasConcept(DcmItem *item, dcmHelpersTerminology::Code code){
+  std::string itemValue, itemScheme;
+  return getCode(item, DCM_ConceptNameCodeSequence, itemValue, itemScheme) &&
+         itemValue == dcmHelpersTerminology::getValue(code) &&
+         itemScheme == dcmHelpersTerminology::getScheme(code);
+}
+
+// SOPInstanceUID -> SeriesInstanceUID of the instances listed as evidence
+void indexEvidence(DcmItem *dataset, const DcmTagKey &evidence, std::map<std::string, std::string> &seriesOf){
+  DcmItem *study, *series, *instance;
+  for(long s=0;dataset->findAndGetSequenceItem(evidence, study, s).good();s++)
+    for(long r=0;study->findAndGetSequenceItem(DCM_ReferencedSeriesSequence, series, r).good();r++){
+      std::string seriesInstanceUID = getStringValue(series, DCM_SeriesInstanceUID);
+      for(long i=0;series->findAndGetSequenceItem(DCM_ReferencedSOPSequence, instance, i).good();i++)
+        seriesOf[getStringValue(instance, DCM_ReferencedSOPInstanceUID)] = seriesInstanceUID;
+    }
+}
+
+struct ExtractContext {
+  std::string fileName, srInstanceUID;
+  std::map<std::string, std::string> seriesOf;
+  std::vector<dcmHelpersMeasurement> *measurements;
+};
+
+void extractGroup(DcmItem *group, ExtractContext &context){
+  dcmHelpersMeasurement common;
+  common.fileName = context.fileName;
+  common.srInstanceUID = context.srInstanceUID;
+  common.value = std::numeric_limits<double>::quiet_NaN();
+  common.segmentNumber = 0;
+
+  // group level items first, then one row per NUM item
+  std::string sourceInstanceUID;
+  std::vector<DcmItem*> numItems;
+  DcmItem *item, *reference;
+  for(long i=0;group->findAndGetSequenceItem(DCM_ContentSequence, item, i).good();i++){
+    std::string valueType = getStringValue(item, DCM_ValueType);
+    if(valueType == "NUM"){
+      numItems.push_back(item);
+    } else if(valueType == "TEXT" && hasConcept(item, dcmHelpersTerminology::CODE_TrackingIdentifier)){
+      common.trackingIdentifier = getStringValue(item, DCM_TextValue);
+    } else if(valueType == "UIDREF" && hasConcept(item, dcmHelpersTerminology::CODE_TrackingUniqueIdentifier)){
+      common.trackingUID = getStringValue(item, DCM_UID);
+    } else if(valueType == "UIDREF" && hasConcept(item, dcmHelpersTerminology::CODE_SourceSeriesForSegmentation)){
+      common.sourceSeriesInstanceUID = getStringValue(item, DCM_UID);
+    } else if(valueType == "IMAGE" && item->findAndGetSequenceItem(DCM_ReferencedSOPSequence, reference).good()){
+      if(hasConcept(item, dcmHelpersTerminology::CODE_ReferencedSegment)){
+        Uint16 segmentNumber = 0;
+        common.segmentationInstanceUID = getStringValue(reference, DCM_ReferencedSOPInstanceUID);
+        if(reference->findAndGetUint16(DCM_ReferencedSegmentNumber, segmentNumber).good())
+          common.segmentNumber = segmentNumber;
+      } else if(hasConcept(item, dcmHelpersTerminology::CODE_SourceImageForSegmentation) && sourceInstanceUID.empty()){
+        sourceInstanceUID = getStringValue(reference, DCM_ReferencedSOPInstanceUID);
+      }
+    }
+  }
+  if(common.sourceSeriesInstanceUID.empty() && !sourceInstanceUID.empty()){
+    std::map<std::string, std::string>::const_iterator series = context.seriesOf.find(sourceInstanceUID);
+    if(series != context.seriesOf.end())
+      common.sourceSeriesInstanceUID = series->second;
+  }
+
+  for(size_t i=0;i<numItems.size();i++){
+    dcmHelpersMeasurement measurement = common;
+    getCode(numItems[i], DCM_ConceptNameCodeSequence, measurement.conceptValue,
+            measurement.conceptScheme, &measurement.conceptMeaning);
+    DcmItem *measuredValue;
+    if(numItems[i]->findAndGetSequenceItem(DCM_MeasuredValueSequence, measuredValue).good()){
+      Float64 value;
+      if(measuredValue->findAndGetFloat64(DCM_NumericValue, value).good())
+        measurement.value = value;
+      getCode(measuredValue, DCM_MeasurementUnitsCodeSequence, measurement.unitsValue, measurement.unitsScheme);
+    }
+    DcmItem *modifier;
+    for(long m=0;numItems[i]->findAndGetSequenceItem(DCM_ContentSequence, modifier, m).good();m++){
+      std::string unused;
+      if(hasConcept(modifier, dcmHelpersTerminology::CODE_Derivation))
+        getCode(modifier, DCM_ConceptCodeSequence, measurement.derivationValue, unused,
+                &measurement.derivationMeaning);
+    }
+    context.measurements->push_back(measurement);
+  }
+}
+
+void extractContent(DcmItem *item, ExtractContext &context){
+  DcmItem *child;
+  for(long i=0;item->findAndGetSequenceItem(DCM_ContentSequence, child, i).good();i++){
+    if(getStringValue(child, DCM_ValueType) != "CONTAINER")
+      continue;
+    if(hasConcept(child, dcmHelpersTerminology::CODE_MeasurementGroup))
+      extractGroup(child, context);
+    else
+      extractContent(child, context);
+  }
+}
+
+void alignTo8(std::vector<unsigned char> &out){
+  out.resize((out.size() + 7) & ~size_t(7), 0);
+}
+
+void append(std::vector<unsigned char> &out, const void *data, size_t length){
+  out.insert(out.end(), OFstatic_cast(const unsigned char*, data),
+             OFstatic_cast(const unsigned char*, data) + length);
+}
+
+void writeCSVField(std::ostream &out, const std::string &value){
+  if(value.find_first_of(",\"\n") == std::string::npos){
+    out << value;
+    return;
+  }
+  out << '"';
+  for(size_t i=0;i<value.size();i++){
+    if(value[i] == '"')
+      out << '"';
+    out << value[i];
+  }
+  out << '"';
+}
+
+}
+
+bool dcmHelpersMeasurementTable::extract(DcmItem *dataset, const std::string &fileName,
+                                         std::vector<dcmHelpersMeasurement> &measurements){
+  if(!dataset->tagExists(DCM_ContentSequence))
+    return false;
+  ExtractContext context;
+  context.fileName = fileName;
+  context.srInstanceUID = getStringValue(dataset, DCM_SOPInstanceUID);
+  context.measurements = &measurements;
+  indexEvidence(dataset, DCM_CurrentRequestedProcedureEvidenceSequence, context.seriesOf);
+  indexEvidence(dataset, DCM_PertinentOtherEvidenceSequence, context.seriesOf);
+  extractContent(dataset, context);
+  return true;
+}
+
+bool dcmHelpersMeasurementTable::writeColumnar(const std::string &path,
+                                               const std::vector<dcmHelpersMeasurement> &measurements){
+  const unsigned numberOfColumns = NUMBER_OF_STRING_COLUMNS + 2;
+  unsigned long long numberOfRows = measurements.size();
+  std::vector<ColumnEntry> directory(numberOfColumns);
+  memset(&directory[0], 0, directory.size() * sizeof(ColumnEntry));
+
+  std::vector<unsigned char> out;
+  FileHeader header;
+  memcpy(header.magic, MAGIC, sizeof(MAGIC));
+  header.rows = numberOfRows;
+  header.columns = numberOfColumns;
+  header.reserved = 0;
+  append(out, &header, sizeof(header));
+  size_t directoryOffset = out.size();
+  out.resize(out.size() + directory.size() * sizeof(ColumnEntry));
+
+  for(unsigned c=0;c<numberOfColumns;c++){
+    alignTo8(out);
+    ColumnEntry &entry = directory[c];
+    entry.offset = out.size();
+    if(c < NUMBER_OF_STRING_COLUMNS){
+      strncpy(entry.name, STRING_COLUMNS[c].name, sizeof(entry.name) - 1);
+      entry.type = CT_String;
+      std::string dcmHelpersMeasurement::*member = STRING_COLUMNS[c].member;
+      unsigned long long characters = 0;
+      append(out, &characters, sizeof(characters));
+      for(size_t r=0;r<measurements.size();r++){
+        characters += (measurements[r].*member).size();
+        append(out, &characters, sizeof(characters));
+      }
+      for(size_t r=0;r<measurements.size();r++)
+        append(out, (measurements[r].*member).data(), (measurements[r].*member).size());
+    } else if(c == NUMBER_OF_STRING_COLUMNS){
+      strncpy(entry.name, "value", sizeof(entry.name) - 1);
+      entry.type = CT_Float64;
+      for(size_t r=0;r<measurements.size();r++)
+        append(out, &measurements[r].value, sizeof(double));
+    } else {
+      strncpy(entry.name, "segment_number", sizeof(entry.name) - 1);
+      entry.type = CT_Int64;
+      for(size_t r=0;r<measurements.size();r++)
+        append(out, &measurements[r].segmentNumber, sizeof(long long));
+    }
+    entry.length = out.size() - entry.offset;
+  }
+  memcpy(&out[directoryOffset], &directory[0], directory.size() * sizeof(ColumnEntry));
+
+  FILE *f = fopen(path.c_str(), "wb");
+  if(!f || fwrite(&out[0], 1, out.size(), f) != out.size()){
+    std::cerr << "Failed to write " << path << std::endl;
+    if(f)
+      fclose(f);
+    return false;
+  }
+  return !fclose(f);
+}
+
+void dcmHelpersMeasurementTable::writeCSV(std::ostream &out, const std::vector<dcmHelpersMeasurement> &measurements){
+  for(unsigned c=0;c<NUMBER_OF_STRING_COLUMNS;c++)
+    out << STRING_COLUMNS[c].name << ",";
+  out << "value,segment_number" << std::endl;
+  char value[32];
+  for(size_t r=0;r<measurements.size();r++){
+    for(unsigned c=0;c<NUMBER_OF_STRING_COLUMNS;c++){
+      writeCSVField(out, measurements[r].*STRING_COLUMNS[c].member);
+      out << ",";
+    }
+    if(std::isnan(measurements[r].value))
+      value[0] = 0;
+    else
+      sprintf(value, "%.17g", measurements[r].value);
+    out << value << "," << measurements[r].segmentNumber << std::endl;
+  }
+}
+
+dcmHelpersMeasurementTable::dcmHelpersMeasurementTable() : data(NULL), size(0), rows(0), columns(0){
+}
+
+dcmHelpersMeasurementTable::~dcmHelpersMeasurementTable(){
+  close();
+}
+
+void dcmHelpersMeasurementTable::close(){
+  if(data)
+    munmap(OFconst_cast(unsigned char*, data), size);
+  data = NULL;
+  size = 0;
+  rows = 0;
+  columns = 0;
+}
+
+bool dcmHelpersMeasurementTable::open(const std::string &path){
+  close();
+  int fd = ::open(path.c_str(), O_RDONLY);
+  struct stat st;
+  if(fd < 0 || fstat(fd, &st) || size_t(st.st_size) < sizeof(FileHeader)){
+    std::cerr << "Cannot open measurement table " << path << std::endl;
+    if(fd >= 0)
+      ::close(fd);
+    return false;
+  }
+  void *mapped = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if(mapped == MAP_FAILED){
+    std::cerr << "Cannot map measurement table " << path << std::endl;
+    return false;
+  }
+  data = OFstatic_cast(const unsigned char*, mapped);
+  size = st.st_size;
+
+  const FileHeader *header = OFreinterpret_cast(const FileHeader*, data);
+  if(memcmp(header->magic, MAGIC, sizeof(MAGIC)) ||
+     sizeof(FileHeader) + header->columns * sizeof(ColumnEntry) > size){
+    std::cerr << path << " is not a measurement table" << std::endl;
+    close();
+    return false;
+  }
+  rows = header->rows;
+  columns = header->columns;
+  if(rows > size / 8){
+    std::cerr << path << " is truncated" << std::endl;
+    close();
+    return false;
+  }
+  for(unsigned c=0;c<columns;c++){
+    const ColumnEntry *entry = column(c);
+    unsigned long long expected = entry->type == CT_String ? (rows + 1) * 8 : rows * 8;
+    if(entry->type > CT_String || entry->offset % 8 ||
+       entry->offset > size || entry->length > size - entry->offset || entry->length < expected){
+      std::cerr << path << " is truncated" << std::endl;
+      close();
+      return false;
+    }
+    if(entry->type != CT_String)
+      continue;
+    // the character data of row r is [offsets[r], offsets[r+1]) after the offsets
+    const unsigned long long *offsets = OFreinterpret_cast(const unsigned long long*, data + entry->offset);
+    unsigned long long characters = entry->length - expected;
+    bool valid = offsets[0] == 0;
+    for(unsigned long long r=0;r<rows && valid;r++)
+      valid = offsets[r] <= offsets[r+1];
+    if(!valid || offsets[rows] > characters){
+      std::cerr << path << ": invalid offsets in column " << getColumnName(c) << std::endl;
+      close();
+      return false;
+    }
+  }
+  return true;
+}
+
+const dcmHelpersMeasurementTable::ColumnEntry* dcmHelpersMeasurementTable::column(unsigned c) const {
+  return OFreinterpret_cast(const ColumnEntry*, data + sizeof(FileHeader)) + c;
+}
+
+int dcmHelpersMeasurementTable::findColumn(const std::string &name) const {
+  for(unsigned c=0;c<columns;c++)
+    if(getColumnName(c) == name)
+      return c;
+  return -1;
+}
+
+std::string dcmHelpersMeasurementTable::getColumnName(unsigned c) const {
+  const ColumnEntry *entry = column(c);
+  return std::string(entry->name, strnlen(entry->name, sizeof(entry->name)));
+}
+
+dcmHelpersMeasurementTable::ColumnType dcmHelpersMeasurementTable::getColumnType(unsigned c) const {
+  return ColumnType(column(c)->type);
+}
+
+bool dcmHelpersMeasurementTable::checkCell(unsigned c, unsigned long long row, ColumnType type) const {
+  if(c >= columns || row >= rows){
+    std::cerr << "No cell at column " << c << ", row " << row << " of the measurement table" << std::endl;
+    return false;
+  }
+  if(getColumnType(c) != type){
+    std::cerr << "Column " << getColumnName(c) << " of the measurement table has another type" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+bool dcmHelpersMeasurementTable::getFloat64(unsigned c, unsigned long long row, double &value) const {
+  if(!checkCell(c, row, CT_Float64))
+    return false;
+  value = OFreinterpret_cast(const double*, data + column(c)->offset)[row];
+  return true;
+}
+
+bool dcmHelpersMeasurementTable::getInt64(unsigned c, unsigned long long row, long long &value) const {
+  if(!checkCell(c, row, CT_Int64))
+    return false;
+  value = OFreinterpret_cast(const long long*, data + column(c)->offset)[row];
+  return true;
+}
+
+bool dcmHelpersMeasurementTable::getString(unsigned c, unsigned long long row, std::string &value) const {
+  if(!checkCell(c, row, CT_String))
+    return false;
+  const ColumnEntry *entry = column(c);
+  const unsigned long long *offsets = OFreinterpret_cast(const unsigned long long*, data + entry->offset);
+  const char *characters = OFreinterpret_cast(const char*, offsets + rows + 1);
+  value.assign(characters + offsets[row], offsets[row+1] - offsets[row]);
+  return true;
+}
+
+bool dcmHelpersMeasurementTable::getMeasurement(unsigned long long row, dcmHelpersMeasurement &measurement) const {
+  for(unsigned c=0;c<NUMBER_OF_STRING_COLUMNS;c++){
+    int index = findColumn(STRING_COLUMNS[c].name);
+    if(index < 0 || !getString(index, row, measurement.*STRING_COLUMNS[c].member))
+      return false;
+  }
+  int value = findColumn("value"), segmentNumber = findColumn("segment_number");
+  return value >= 0 && segmentNumber >= 0 &&
+         getFloat64(value, row, measurement.value) && getInt64(segmentNumber, row, measurement.segmentNumber);
+}
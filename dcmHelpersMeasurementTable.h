@@ -0,0 +1,83 @@
+#ifndef __dcmHelpersMeasurementTable_h
+#define __dcmHelpersMeasurementTable_h
+
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+class DcmItem;
+
+// One numeric measurement of a TID 1411 Measurement Group; the group level
+// attributes are repeated for every measurement of the group.
+struct dcmHelpersMeasurement {
+  std::string fileName;
+  std::string srInstanceUID;
+  std::string trackingIdentifier;
+  std::string trackingUID;
+  std::string conceptValue, conceptScheme, conceptMeaning;
+  double value;
+  std::string unitsValue, unitsScheme;
+  std::string derivationValue, derivationMeaning;
+  std::string segmentationInstanceUID;
+  long long segmentNumber;
+  std::string sourceSeriesInstanceUID;
+};
+
+// Measurements of SR documents in a columnar file that can be mapped into
+// memory and queried without parsing. Layout (little endian):
+//
+//   header      "SRMXTBL1", uint64 rows, uint32 columns, uint32 reserved
+//   directory   per column: char name[40], uint32 type, uint32 reserved,
+//               uint64 offset, uint64 length
+//   columns     8-byte aligned; float64 and int64 columns hold one value per
+//               row, string columns hold rows+1 uint64 offsets into the
+//               character data that follows them
+//
+// Extraction walks the content tree of the dataset directly, without building
+// a DSRDocument.
+class dcmHelpersMeasurementTable {
+  public:
+    enum ColumnType { CT_Float64, CT_Int64, CT_String };
+
+    // all Measurement Groups (125007) of the SR content tree
+    static bool extract(DcmItem *dataset, const std::string &fileName,
+                        std::vector<dcmHelpersMeasurement> &measurements);
+
+    static bool writeColumnar(const std::string &path, const std::vector<dcmHelpersMeasurement>&);
+    static void writeCSV(std::ostream&, const std::vector<dcmHelpersMeasurement>&);
+
+    // read access to a columnar file; open() checks the directory and the
+    //  string offsets, the accessors fail for a row, column or type that is
+    //  not in the table
+    dcmHelpersMeasurementTable();
+    ~dcmHelpersMeasurementTable();
+
+    bool open(const std::string &path);
+    unsigned long long getNumberOfRows() const { return rows; }
+    unsigned getNumberOfColumns() const { return columns; }
+    // -1 if there is no such column
+    int findColumn(const std::string &name) const;
+    std::string getColumnName(unsigned column) const;
+    ColumnType getColumnType(unsigned column) const;
+    bool getFloat64(unsigned column, unsigned long long row, double &value) const;
+    bool getInt64(unsigned column, unsigned long long row, long long &value) const;
+    bool getString(unsigned column, unsigned long long row, std::string &value) const;
+    // all columns of a row, as extracted
+    bool getMeasurement(unsigned long long row, dcmHelpersMeasurement &measurement) const;
+
+  private:
+    dcmHelpersMeasurementTable(const dcmHelpersMeasurementTable&);
+    dcmHelpersMeasurementTable& operator=(const dcmHelpersMeasurementTable&);
+
+    struct ColumnEntry;
+    const ColumnEntry* column(unsigned) const;
+    bool checkCell(unsigned column, unsigned long long row, ColumnType type) const;
+    void close();
+
+    const unsigned char *data;
+    size_t size;
+    unsigned long long rows;
+    unsigned columns;
+};
+
+#endif
@@ -0,0 +1,482 @@
+#include "dcmHelpersOutputWriter.h"
+#include "dcmtk/config/osconfig.h"
+#include "dcmtk/dcmdata/dctk.h"
+#include "dcmtk/dcmdata/dcddirif.h"
+#include "dcmtk/dcmdata/dcostrmb.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <iomanip>
+#include <iostream>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+namespace {
+
+double secondsSince(const std::chrono::steady_clock::time_point &start){
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// little endian fields of the zip headers
+void put16(std::string &out, unsigned v){
+  out += char(v & 0xff);
+  out += char((v >> 8) & 0xff);
+}
+
+void put32(std::string &out, unsigned long v){
+  put16(out, v & 0xffff);
+  put16(out, (v >> 16) & 0xffff);
+}
+
+void put64(std::string &out, unsigned long long v){
+  put32(out, v & 0xffffffffUL);
+  put32(out, (unsigned long)(v >> 32));
+}
+
+// ustar header of a regular file; names longer than 100 characters are split
+//  into prefix and name at a directory separator
+bool makeTarHeader(const std::string &name, unsigned long long size, char header[512]){
+  memset(header, 0, 512);
+  std::string prefix, base = name;
+  if(name.size() > 100){
+    size_t split = name.find('/', name.size() - 101);
+    if(split == std::string::npos || split > 155 || split == 0){
+      std::cerr << "File name too long for a tar archive: " << name << std::endl;
+      return false;
+    }
+    prefix = name.substr(0, split);
+    base = name.substr(split + 1);
+  }
+  if(size >= 077777777777ULL){
+    std::cerr << "File too large for a tar archive: " << name << std::endl;
+    return false;
+  }
+  memcpy(header, base.data(), base.size());
+  memcpy(header + 100, "0000644", 7);
+  memcpy(header + 108, "0000000", 7);
+  memcpy(header + 116, "0000000", 7);
+  snprintf(header + 124, 12, "%011llo", size);
+  snprintf(header + 136, 12, "%011lo", (unsigned long)time(NULL));
+  header[156] = '0';
+  memcpy(header + 257, "ustar", 6);
+  memcpy(header + 263, "00", 2);
+  memcpy(header + 345, prefix.data(), prefix.size());
+
+  // the checksum is computed with the checksum field set to blanks
+  memset(header + 148, ' ', 8);
+  unsigned long sum = 0;
+  for(int i=0;i<512;i++)
+    sum += (unsigned char)header[i];
+  snprintf(header + 148, 8, "%06lo", sum);
+  header[155] = ' ';
+  return true;
+}
+
+// modification time and date of the zip entries, in MS-DOS format
+void getDOSTime(unsigned &dosTime, unsigned &dosDate){
+  time_t now = time(NULL);
+  struct tm local;
+  localtime_r(&now, &local);
+  dosTime = (local.tm_hour << 11) | (local.tm_min << 5) | (local.tm_sec / 2);
+  dosDate = ((local.tm_year - 80) << 9) | ((local.tm_mon + 1) << 5) | local.tm_mday;
+}
+
+bool writeAll(int fd, const void *data, size_t length){
+  const char *p = OFstatic_cast(const char*, data);
+  while(length){
+    ssize_t written = ::write(fd, p, length);
+    if(written < 0 && errno == EINTR)
+      continue;
+    if(written <= 0)
+      return false;
+    p += written;
+    length -= written;
+  }
+  return true;
+}
+
+const unsigned long ZIP_LIMIT = 0xffffffffUL;
+
+}
+
+dcmHelpersOutputWriter::dcmHelpersOutputWriter(Format format, const std::string &path,
+                                               unsigned syncBatch, unsigned maxQueue, unsigned syncDelayMs) :
+  format(format), path(path), syncBatch(syncBatch ? syncBatch : 1), syncDelay(syncDelayMs), queue(maxQueue),
+  fd(-1), opened(false), offset(0), unsynced(0), queuedFiles(0), nextFileID(0), failed(false),
+  seconds(0), syncSeconds(0), files(0), syncs(0), bytes(0){
+}
+
+dcmHelpersOutputWriter::~dcmHelpersOutputWriter(){
+  close();
+}
+
+bool dcmHelpersOutputWriter::parseFormat(const std::string &name, Format &format){
+  if(name == "tar")
+    format = F_Tar;
+  else if(name == "zip")
+    format = F_Zip;
+  else if(name == "dicomdir")
+    format = F_DICOMDIR;
+  else
+    return false;
+  return true;
+}
+
+bool dcmHelpersOutputWriter::open(){
+  if(format == F_DICOMDIR){
+    if((mkdir(path.c_str(), 0755) && errno != EEXIST) ||
+       (mkdir((path + "/REPORTS").c_str(), 0755) && errno != EEXIST) ||
+       (mkdir((path + "/EXPORTS").c_str(), 0755) && errno != EEXIST)){
+      std::cerr << "Cannot create " << path << ": " << strerror(errno) << std::endl;
+      return false;
+    }
+    fd = ::open(path.c_str(), O_RDONLY | O_DIRECTORY);
+    dicomdir.reset(new DicomDirInterface());
+    // an existing DICOMDIR is replaced
+    OFCondition cond = dicomdir->createNewDicomDir(DicomDirInterface::AP_GeneralPurpose,
+                                                   (path + "/DICOMDIR").c_str(), "SRREPORTS");
+    if(cond.bad()){
+      std::cerr << "Cannot create the DICOMDIR in " << path << ": " << cond.text() << std::endl;
+      dicomdir.reset();
+      if(fd >= 0)
+        ::close(fd);
+      fd = -1;
+      return false;
+    }
+  } else {
+    fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  }
+  if(fd < 0){
+    std::cerr << "Cannot open " << path << ": " << strerror(errno) << std::endl;
+    return false;
+  }
+
+  startTime = std::chrono::steady_clock::now();
+  opened = true;
+  thread = std::thread(&dcmHelpersOutputWriter::run, this);
+  return true;
+}
+
+std::string dcmHelpersOutputWriter::write(const std::string &name, std::string &content, bool dicom){
+  File file;
+  file.dicom = dicom;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    if(!opened || failed)
+      return std::string();
+    if(format == F_DICOMDIR){
+      if(dicom){
+        // file IDs are limited to 8 characters per component
+        char id[32];
+        snprintf(id, sizeof(id), "REPORTS/R%07lu", ++nextFileID);
+        file.name = id;
+      } else {
+        file.name = "EXPORTS/" + name.substr(name.rfind('/') + 1);
+      }
+    } else {
+      // archive members are relative
+      size_t start = name.find_first_not_of('/');
+      file.name = start == std::string::npos ? name : name.substr(start);
+    }
+  }
+  file.content.swap(content);
+  std::string stored = file.name;
+  if(!queue.push(std::move(file)))
+    return std::string();
+  std::lock_guard<std::mutex> lock(mutex);
+  queuedFiles++;
+  return stored;
+}
+
+bool dcmHelpersOutputWriter::waitForWrites(){
+  std::unique_lock<std::mutex> lock(mutex);
+  progress.wait(lock, [this]{ return failed || !opened || files >= queuedFiles; });
+  return !failed && files >= queuedFiles;
+}
+
+std::string dcmHelpersOutputWriter::write(const std::string &name, DcmFileFormat &fileFormat){
+  std::string content;
+  if(!serialize(fileFormat, content))
+    return std::string();
+  return write(name, content, true);
+}
+
+bool dcmHelpersOutputWriter::close(){
+  if(!opened)
+    return !failed;
+  queue.close();
+  thread.join();
+  std::lock_guard<std::mutex> lock(mutex);
+  opened = false;
+  seconds = secondsSince(startTime);
+  progress.notify_all();
+  return !failed;
+}
+
+bool dcmHelpersOutputWriter::serialize(DcmFileFormat &fileFormat, std::string &content){
+  // the same encoding as saveFile(fileName, EXS_LittleEndianExplicit)
+  const E_TransferSyntax xfer = EXS_LittleEndianExplicit;
+  std::vector<Uint8> chunk(65536);
+  DcmOutputBufferStream out(&chunk[0], chunk.size());
+  void *data;
+  offile_off_t length;
+  OFCondition cond;
+
+  content.clear();
+  fileFormat.transferInit();
+  while((cond = fileFormat.write(out, xfer, EET_UndefinedLength, NULL, EGL_recalcGL, EPD_noChange))
+        == EC_StreamNotifyClient){
+    out.flushBuffer(data, length);
+    content.append(OFstatic_cast(const char*, data), length);
+  }
+  fileFormat.transferEnd();
+  if(cond.bad()){
+    std::cerr << "Failed to encode the report: " << cond.text() << std::endl;
+    return false;
+  }
+  out.flush();
+  out.flushBuffer(data, length);
+  content.append(OFstatic_cast(const char*, data), length);
+  return true;
+}
+
+void dcmHelpersOutputWriter::run(){
+  File file;
+  bool ok = true;
+  for(;;){
+    // a batch is synced when it is full, or syncDelay after its first file
+    //  was written, also if no further files arrive
+    bool timedOut = false;
+    bool popped = unsynced ? queue.pop(file, firstUnsynced + syncDelay - std::chrono::steady_clock::now(), timedOut)
+                           : queue.pop(file);
+    if(!popped && !timedOut)
+      break;
+    if(popped){
+      // after a failure the queue is drained, so that producers do not block
+      if(ok && !writeFile(file))
+        ok = false;
+      if(ok && unsynced++ == 0)
+        firstUnsynced = std::chrono::steady_clock::now();
+    }
+    if(ok && unsynced && (unsynced >= syncBatch ||
+                          std::chrono::steady_clock::now() - firstUnsynced >= syncDelay) && !sync())
+      ok = false;
+    if(!ok)
+      unsynced = 0;
+    std::lock_guard<std::mutex> lock(mutex);
+    failed = !ok;
+    progress.notify_all();
+  }
+  if(ok && !finish())
+    ok = false;
+  if(fd >= 0)
+    ::close(fd);
+  fd = -1;
+  std::lock_guard<std::mutex> lock(mutex);
+  failed = !ok;
+  progress.notify_all();
+}
+
+bool dcmHelpersOutputWriter::append(const void *data, size_t length){
+  if(!writeAll(fd, data, length)){
+    std::cerr << "Failed to write " << path << ": " << strerror(errno) << std::endl;
+    return false;
+  }
+  offset += length;
+  return true;
+}
+
+bool dcmHelpersOutputWriter::writeFile(const File &file){
+  const std::string &content = file.content;
+  switch(format){
+    case F_Tar: {
+      char header[512];
+      static const char padding[512] = {0};
+      if(!makeTarHeader(file.name, content.size(), header) ||
+         !append(header, 512) || !append(content.data(), content.size()) ||
+         !append(padding, (512 - content.size() % 512) % 512))
+        return false;
+      break;
+    }
+    case F_Zip: {
+      if(content.size() >= ZIP_LIMIT || file.name.size() > 0xffff){
+        std::cerr << "File too large for a zip archive: " << file.name << std::endl;
+        return false;
+      }
+      ZipEntry entry;
+      entry.name = file.name;
+      entry.size = content.size();
+      entry.offset = offset;
+      entry.crc = crc32(crc32(0L, Z_NULL, 0), OFreinterpret_cast(const Bytef*, content.data()), content.size());
+
+      unsigned dosTime, dosDate;
+      getDOSTime(dosTime, dosDate);
+      std::string header;
+      put32(header, 0x04034b50);
+      put16(header, 20);        // version needed
+      put16(header, 0x0800);    // UTF-8 names
+      put16(header, 0);         // stored
+      put16(header, dosTime);
+      put16(header, dosDate);
+      put32(header, entry.crc);
+      put32(header, entry.size);
+      put32(header, entry.size);
+      put16(header, entry.name.size());
+      put16(header, 0);
+      header += entry.name;
+      if(!append(header.data(), header.size()) || !append(content.data(), content.size()))
+        return false;
+      zipEntries.push_back(entry);
+      break;
+    }
+    case F_DICOMDIR: {
+      std::string filePath = path + "/" + file.name;
+      int out = ::open(filePath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+      if(out < 0){
+        std::cerr << "Cannot create " << filePath << ": " << strerror(errno) << std::endl;
+        return false;
+      }
+      bool written = writeAll(out, content.data(), content.size());
+      if(::close(out) || !written){
+        std::cerr << "Failed to write " << filePath << ": " << strerror(errno) << std::endl;
+        return false;
+      }
+      // read back from the page cache; the record tree is kept in memory
+      //  until the DICOMDIR is written on close
+      if(file.dicom){
+        OFCondition cond = dicomdir->addDicomFile(file.name.c_str(), path.c_str());
+        if(cond.bad()){
+          std::cerr << "Cannot add " << filePath << " to the DICOMDIR: " << cond.text() << std::endl;
+          return false;
+        }
+      }
+      break;
+    }
+  }
+
+  std::lock_guard<std::mutex> lock(mutex);
+  files++;
+  bytes += content.size();
+  return true;
+}
+
+bool dcmHelpersOutputWriter::sync(){
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  // syncfs() writes back the files of the whole batch, and the directory
+  //  entries, with one call instead of one fsync() per file
+  int result = format == F_DICOMDIR ? syncfs(fd) : fdatasync(fd);
+  if(result){
+    std::cerr << "Failed to sync " << path << ": " << strerror(errno) << std::endl;
+    return false;
+  }
+  unsynced = 0;
+  std::lock_guard<std::mutex> lock(mutex);
+  syncs++;
+  syncSeconds += secondsSince(start);
+  return true;
+}
+
+bool dcmHelpersOutputWriter::finish(){
+  switch(format){
+    case F_Tar: {
+      static const char trailer[1024] = {0};
+      if(!append(trailer, sizeof(trailer)))
+        return false;
+      break;
+    }
+    case F_Zip: {
+      unsigned dosTime, dosDate;
+      getDOSTime(dosTime, dosDate);
+      unsigned long long directoryOffset = offset;
+      std::string directory;
+      for(size_t i=0;i<zipEntries.size();i++){
+        const ZipEntry &entry = zipEntries[i];
+        bool zip64 = entry.offset >= ZIP_LIMIT;
+        put32(directory, 0x02014b50);
+        put16(directory, 0x0300 | 45);   // made by: Unix, 4.5
+        put16(directory, zip64 ? 45 : 20);
+        put16(directory, 0x0800);
+        put16(directory, 0);
+        put16(directory, dosTime);
+        put16(directory, dosDate);
+        put32(directory, entry.crc);
+        put32(directory, entry.size);
+        put32(directory, entry.size);
+        put16(directory, entry.name.size());
+        put16(directory, zip64 ? 12 : 0);
+        put16(directory, 0);             // comment
+        put16(directory, 0);             // disk
+        put16(directory, 0);             // internal attributes
+        put32(directory, 0100644UL << 16);
+        put32(directory, zip64 ? ZIP_LIMIT : entry.offset);
+        directory += entry.name;
+        if(zip64){
+          put16(directory, 0x0001);
+          put16(directory, 8);
+          put64(directory, entry.offset);
+        }
+      }
+      unsigned long long directorySize = directory.size();
+      unsigned long long count = zipEntries.size();
+      if(count >= 0xffff || directoryOffset >= ZIP_LIMIT || directorySize >= ZIP_LIMIT){
+        unsigned long long recordOffset = directoryOffset + directorySize;
+        put32(directory, 0x06064b50);
+        put64(directory, 44);
+        put16(directory, 45);
+        put16(directory, 45);
+        put32(directory, 0);
+        put32(directory, 0);
+        put64(directory, count);
+        put64(directory, count);
+        put64(directory, directorySize);
+        put64(directory, directoryOffset);
+        put32(directory, 0x07064b50);
+        put32(directory, 0);
+        put64(directory, recordOffset);
+        put32(directory, 1);
+      }
+      put32(directory, 0x06054b50);
+      put16(directory, 0);
+      put16(directory, 0);
+      put16(directory, count < 0xffff ? count : 0xffff);
+      put16(directory, count < 0xffff ? count : 0xffff);
+      put32(directory, directorySize < ZIP_LIMIT ? directorySize : ZIP_LIMIT);
+      put32(directory, directoryOffset < ZIP_LIMIT ? directoryOffset : ZIP_LIMIT);
+      put16(directory, 0);
+      if(!append(directory.data(), directory.size()))
+        return false;
+      break;
+    }
+    case F_DICOMDIR: {
+      OFCondition cond = dicomdir->writeDicomDir();
+      if(cond.bad()){
+        std::cerr << "Failed to write the DICOMDIR in " << path << ": " << cond.text() << std::endl;
+        return false;
+      }
+      break;
+    }
+  }
+  return sync();
+}
+
+void dcmHelpersOutputWriter::printStatistics(std::ostream &out) const {
+  std::lock_guard<std::mutex> lock(mutex);
+  double elapsed = opened ? secondsSince(startTime) : seconds;
+  out << "Output " << path << ": " << files << " files, "
+      << std::fixed << std::setprecision(1) << bytes / 1048576. << " MB, "
+      << (elapsed > 0 ? files / elapsed : 0.) << " files/s, "
+      << syncs << " syncs (" << std::setprecision(3) << syncSeconds << " s)" << std::endl;
+}
+
+void dcmHelpersOutputWriter::writeJSON(std::ostream &out) const {
+  std::lock_guard<std::mutex> lock(mutex);
+  double elapsed = opened ? secondsSince(startTime) : seconds;
+  out << "\"output_files\": " << files << ", \"output_bytes\": " << bytes
+      << ", \"output_files_per_s\": " << (elapsed > 0 ? files / elapsed : 0.)
+      << ", \"output_syncs\": " << syncs << ", \"output_sync_seconds\": " << syncSeconds;
+}
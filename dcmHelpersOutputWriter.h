@@ -0,0 +1,118 @@
+#ifndef __dcmHelpersOutputWriter_h
+#define __dcmHelpersOutputWriter_h
+
+#include <chrono>
+#include <condition_variable>
+#include <iosfwd>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "dcmHelpersThreadPool.h"
+
+class DcmFileFormat;
+class DicomDirInterface;
+
+// Output of batch runs that write many small reports. Instead of one
+// saveFile() per report, with its own metadata updates, files are packed
+//  - into one uncompressed tar archive (F_Tar),
+//  - into one zip archive with stored entries (F_Zip), or
+//  - into a directory indexed by a DICOMDIR (F_DICOMDIR), written on close.
+// The files are written by a dedicated thread behind a queue of at most
+// maxQueue files, so producers only block when storage falls behind. Data is
+// synced once per syncBatch files rather than per file: with fdatasync() of
+// the archive, or with syncfs() for the directory. A batch that does not fill
+// is synced syncDelayMs after its first file was written, whether or not more
+// files arrive. Files written since the last sync are lost on a crash; files
+// from completed batches are not.
+class dcmHelpersOutputWriter {
+  public:
+    enum Format { F_Tar, F_Zip, F_DICOMDIR };
+
+    dcmHelpersOutputWriter(Format format, const std::string &path,
+                           unsigned syncBatch = 64, unsigned maxQueue = 16, unsigned syncDelayMs = 1000);
+    // closes the output if still open
+    ~dcmHelpersOutputWriter();
+
+    // "tar", "zip" or "dicomdir"; false for other names
+    static bool parseFormat(const std::string &name, Format &format);
+
+    // create the archive or directory and start the writer thread
+    bool open();
+
+    // queue a file; the content is taken over. In a DICOMDIR directory, DICOM
+    // files are given DICOM file IDs, and other files are stored unindexed
+    // below EXPORTS. Returns the name in the output, or an empty string if the
+    // writer failed before.
+    std::string write(const std::string &name, std::string &content, bool dicom = true);
+    std::string write(const std::string &name, DcmFileFormat &fileFormat);
+
+    // block until the files queued so far are written to the output, which
+    // is synced with their batch; false if the writer failed
+    bool waitForWrites();
+
+    // write the remaining files, the archive trailer or DICOMDIR, and sync
+    bool close();
+
+    // file meta information and dataset as saveFile() would write them
+    static bool serialize(DcmFileFormat &fileFormat, std::string &content);
+
+    void printStatistics(std::ostream&) const;
+    // statistics as JSON members, without the enclosing braces
+    void writeJSON(std::ostream&) const;
+
+  private:
+    dcmHelpersOutputWriter(const dcmHelpersOutputWriter&);
+    dcmHelpersOutputWriter& operator=(const dcmHelpersOutputWriter&);
+
+    struct File {
+      std::string name;
+      std::string content;
+      bool dicom;
+    };
+
+    struct ZipEntry {
+      std::string name;
+      unsigned long crc;
+      unsigned long long size;
+      unsigned long long offset;
+    };
+
+    void run();
+    bool writeFile(const File &file);
+    bool append(const void *data, size_t length);
+    bool sync();
+    bool finish();
+
+    Format format;
+    std::string path;
+    unsigned syncBatch;
+    std::chrono::milliseconds syncDelay;
+    dcmHelpersBoundedQueue<File> queue;
+    std::thread thread;
+    int fd;
+    bool opened;
+
+    // writer thread state
+    unsigned long long offset;
+    std::vector<ZipEntry> zipEntries;
+    std::unique_ptr<DicomDirInterface> dicomdir;
+    unsigned long unsynced;
+    std::chrono::steady_clock::time_point firstUnsynced;
+
+    mutable std::mutex mutex;
+    // signalled when a file is written or the writer fails
+    std::condition_variable progress;
+    unsigned long queuedFiles;
+    unsigned long nextFileID;
+    bool failed;
+    std::chrono::steady_clock::time_point startTime;
+    double seconds, syncSeconds;
+    unsigned long files, syncs;
+    unsigned long long bytes;
+};
+
+#endif
@@ -0,0 +1,335 @@
+#include "dcmHelpersPrefetcher.h"
+#include "dcmtk/config/osconfig.h"
+#include "dcmtk/dcmdata/dctk.h"
+#include "dcmtk/dcmdata/dcistrmb.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <fcntl.h>
+#include <iomanip>
+#include <iostream>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef HAVE_LIBURING
+#include <liburing.h>
+#endif
+
+namespace {
+
+// files larger than the memory budget are not buffered; only the part that
+// holds the header is announced to the kernel, pixel data is read on demand
+const size_t ADVISE_LENGTH = 4*1048576UL;
+
+}
+
+dcmHelpersPrefetcher::dcmHelpersPrefetcher(unsigned queueDepth, size_t memoryBudget) :
+  queueDepth(queueDepth ? queueDepth : 1), memoryBudget(memoryBudget),
+  current(NULL), bufferedBytes(0), stopping(false), ring(NULL), usingUring(false),
+  inFlight(0), maxInFlight(0), inFlightIntegral(0), busySeconds(0), waitSeconds(0),
+  startTime(std::chrono::steady_clock::now()), lastChange(0),
+  filesBuffered(0), filesAdvised(0), filesMissed(0), bytesRead(0){
+#ifdef HAVE_LIBURING
+  struct io_uring *uring = new struct io_uring;
+  if(io_uring_queue_init(this->queueDepth, uring, 0) == 0){
+    ring = uring;
+    usingUring = true;
+    threads.push_back(std::thread(&dcmHelpersPrefetcher::runUring, this));
+  } else {
+    delete uring;
+  }
+#endif
+  if(!usingUring)
+    for(unsigned i=0;i<this->queueDepth;i++)
+      threads.push_back(std::thread(&dcmHelpersPrefetcher::runThreads, this));
+}
+
+dcmHelpersPrefetcher::~dcmHelpersPrefetcher(){
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  workAvailable.notify_all();
+  for(size_t i=0;i<threads.size();i++)
+    threads[i].join();
+  for(std::map<std::string, Entry*>::iterator it=entries.begin();it!=entries.end();++it){
+    if(it->second->fd >= 0)
+      close(it->second->fd);
+    delete it->second;
+  }
+}
+
+void dcmHelpersPrefetcher::prefetch(const std::vector<std::string> &paths){
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    for(size_t i=0;i<paths.size();i++){
+      if(entries.count(paths[i]))
+        continue;
+      Entry *entry = new Entry();
+      entry->path = paths[i];
+      entry->state = ES_Queued;
+      entry->fd = -1;
+      entry->size = entry->nextOffset = entry->completed = 0;
+      entry->outstanding = 0;
+      entry->buffered = false;
+      entries[paths[i]] = entry;
+      pending.push_back(entry);
+    }
+  }
+  workAvailable.notify_all();
+}
+
+void dcmHelpersPrefetcher::updateInFlight(int delta){
+  double now = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+  inFlightIntegral += inFlight * (now - lastChange);
+  if(inFlight)
+    busySeconds += now - lastChange;
+  lastChange = now;
+  inFlight += delta;
+  maxInFlight = std::max(maxInFlight, inFlight);
+}
+
+void dcmHelpersPrefetcher::deleteEntry(Entry *entry){
+  std::map<std::string, Entry*>::iterator it = entries.find(entry->path);
+  if(it != entries.end() && it->second == entry)
+    entries.erase(it);
+  if(entry->fd >= 0)
+    close(entry->fd);
+  delete entry;
+}
+
+// called with the mutex held
+void dcmHelpersPrefetcher::finishEntry(Entry *entry, EntryState state){
+  entry->state = state;
+  if(entry->fd >= 0 && !entry->outstanding){
+    close(entry->fd);
+    entry->fd = -1;
+  }
+  if(current == entry)
+    current = NULL;
+  entryReady.notify_all();
+}
+
+bool dcmHelpersPrefetcher::nextChunk(Chunk &chunk, bool wait){
+  std::unique_lock<std::mutex> lock(mutex);
+  for(;;){
+    if(stopping)
+      return false;
+
+    if(!retries.empty()){
+      chunk = retries.front();
+      retries.pop_front();
+      updateInFlight(1);
+      return true;
+    }
+
+    if(current && current->nextOffset < current->size){
+      chunk.entry = current;
+      chunk.offset = current->nextOffset;
+      chunk.length = std::min(CHUNK_SIZE, current->size - current->nextOffset);
+      current->nextOffset += chunk.length;
+      current->outstanding++;
+      updateInFlight(1);
+      return true;
+    }
+    current = NULL;
+
+    if(!pending.empty()){
+      Entry *entry = pending.front();
+      if(entry->fd < 0){
+        // open outside the lock, the consumer may be waiting for another file
+        pending.pop_front();
+        lock.unlock();
+        int fd = open(entry->path.c_str(), O_RDONLY);
+        struct stat st;
+        bool ok = fd >= 0 && !fstat(fd, &st);
+        lock.lock();
+        entry->fd = fd;
+        if(!ok || entry->state != ES_Queued){
+          // failed, or loaded directly by the consumer in the meantime
+          if(entry->state == ES_Queued)
+            finishEntry(entry, ES_Failed);
+          else
+            deleteEntry(entry);
+          continue;
+        }
+        entry->size = st.st_size;
+        pending.push_front(entry);
+      }
+
+      if(entry->size > memoryBudget){
+        pending.pop_front();
+        posix_fadvise(entry->fd, 0, std::min(entry->size, ADVISE_LENGTH), POSIX_FADV_WILLNEED);
+        filesAdvised++;
+        finishEntry(entry, ES_Ready);
+        continue;
+      }
+      if(!bufferedBytes || bufferedBytes + entry->size <= memoryBudget){
+        pending.pop_front();
+        bufferedBytes += entry->size;
+        entry->buffer.resize(entry->size);
+        entry->buffered = true;
+        entry->state = ES_Reading;
+        filesBuffered++;
+        current = entry;
+        if(!entry->size)
+          finishEntry(entry, ES_Ready);
+        continue;
+      }
+    }
+
+    if(!wait)
+      return false;
+    workAvailable.wait(lock);
+  }
+}
+
+void dcmHelpersPrefetcher::completeChunk(const Chunk &chunk, long result){
+  std::lock_guard<std::mutex> lock(mutex);
+  updateInFlight(-1);
+  Entry *entry = chunk.entry;
+  if(result > 0 && (size_t)result < chunk.length && entry->state == ES_Reading){
+    // short read, queue the remainder
+    Chunk rest = {entry, chunk.offset + result, chunk.length - result};
+    retries.push_back(rest);
+    entry->completed += result;
+    bytesRead += result;
+    workAvailable.notify_one();
+    return;
+  }
+  entry->outstanding--;
+  if(result <= 0){
+    if(entry->state == ES_Reading)
+      finishEntry(entry, ES_Failed);
+  } else {
+    entry->completed += result;
+    bytesRead += result;
+    if(entry->completed == entry->size && entry->state == ES_Reading)
+      finishEntry(entry, ES_Ready);
+  }
+  if(!entry->outstanding && entry->fd >= 0 && entry->state != ES_Reading){
+    close(entry->fd);
+    entry->fd = -1;
+    entryReady.notify_all();
+  }
+}
+
+void dcmHelpersPrefetcher::runThreads(){
+  Chunk chunk;
+  while(nextChunk(chunk, true)){
+    ssize_t result;
+    do {
+      result = pread(chunk.entry->fd, &chunk.entry->buffer[chunk.offset], chunk.length, chunk.offset);
+    } while(result < 0 && errno == EINTR);
+    completeChunk(chunk, result);
+  }
+}
+
+void dcmHelpersPrefetcher::runUring(){
+#ifdef HAVE_LIBURING
+  struct io_uring *uring = OFstatic_cast(struct io_uring*, ring);
+  unsigned submitted = 0;
+  for(;;){
+    Chunk chunk;
+    // block for new work only when no reads are in flight
+    while(submitted < queueDepth && nextChunk(chunk, submitted == 0)){
+      struct io_uring_sqe *sqe = io_uring_get_sqe(uring);
+      io_uring_prep_read(sqe, chunk.entry->fd, &chunk.entry->buffer[chunk.offset],
+                         chunk.length, chunk.offset);
+      io_uring_sqe_set_data(sqe, new Chunk(chunk));
+      submitted++;
+    }
+    if(!submitted)
+      break;
+    io_uring_submit(uring);
+
+    struct io_uring_cqe *cqe;
+    if(io_uring_wait_cqe(uring, &cqe) < 0)
+      continue;
+    Chunk *completed = OFstatic_cast(Chunk*, io_uring_cqe_get_data(cqe));
+    int result = cqe->res;
+    io_uring_cqe_seen(uring, cqe);
+    submitted--;
+    completeChunk(*completed, result);
+    delete completed;
+  }
+  io_uring_queue_exit(uring);
+  delete uring;
+#endif
+}
+
+bool dcmHelpersPrefetcher::takeBuffer(const std::string &path, std::vector<unsigned char> &buffer){
+  std::unique_lock<std::mutex> lock(mutex);
+  std::map<std::string, Entry*>::iterator it = entries.find(path);
+  Entry *entry = it == entries.end() ? NULL : it->second;
+  if(!entry || entry->state == ES_Consumed)
+    return false;
+  if(entry->state == ES_Queued){
+    // not started yet (files are loaded out of order, or the budget is
+    // taken by files loaded later), so do not wait for it; a file being
+    // opened is deleted by the reader that opens it
+    std::deque<Entry*>::iterator queued = std::find(pending.begin(), pending.end(), entry);
+    if(queued != pending.end()){
+      pending.erase(queued);
+      deleteEntry(entry);
+    } else {
+      entry->state = ES_Consumed;
+    }
+    return false;
+  }
+
+  std::chrono::steady_clock::time_point waitStart = std::chrono::steady_clock::now();
+  entryReady.wait(lock, [entry]{
+    return (entry->state == ES_Ready || entry->state == ES_Failed) && !entry->outstanding; });
+  waitSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - waitStart).count();
+  if(entry->state == ES_Ready && entry->buffered)
+    buffer.swap(entry->buffer);
+  if(entry->buffered)
+    bufferedBytes -= entry->size;
+  deleteEntry(entry);
+  workAvailable.notify_all();
+  return true;
+}
+
+void dcmHelpersPrefetcher::discard(const std::vector<std::string> &paths){
+  std::vector<unsigned char> buffer;
+  for(size_t i=0;i<paths.size();i++){
+    takeBuffer(paths[i], buffer);
+    std::vector<unsigned char>().swap(buffer);
+  }
+}
+
+OFCondition dcmHelpersPrefetcher::loadFile(const std::string &path, DcmFileFormat &fileFormat){
+  std::vector<unsigned char> buffer;
+  if(!takeBuffer(path, buffer)){
+    std::lock_guard<std::mutex> lock(mutex);
+    filesMissed++;
+  }
+
+  if(!buffer.empty()){
+    DcmInputBufferStream stream;
+    stream.setBuffer(&buffer[0], buffer.size());
+    stream.setEos();
+    fileFormat.transferInit();
+    OFCondition cond = fileFormat.read(stream);
+    fileFormat.transferEnd();
+    if(cond.good())
+      return cond;
+    std::cerr << "Failed to parse prefetched " << path << ", reading it again" << std::endl;
+  }
+  return fileFormat.loadFile(path.c_str());
+}
+
+void dcmHelpersPrefetcher::printStatistics(std::ostream &out) const {
+  std::lock_guard<std::mutex> lock(mutex);
+  out << "Prefetch (" << (usingUring ? "io_uring" : "reader threads") << ", queue depth "
+      << queueDepth << ", budget " << memoryBudget / 1048576 << " MB): "
+      << filesBuffered << " files buffered, " << filesAdvised << " advised, "
+      << filesMissed << " loaded directly, "
+      << std::fixed << std::setprecision(1) << bytesRead / 1048576. << " MB read" << std::endl;
+  out << "  achieved queue depth " << std::setprecision(2)
+      << (busySeconds > 0 ? inFlightIntegral / busySeconds : 0.) << " (max " << maxInFlight << "), "
+      << "overlap ratio " << (busySeconds > 0 ? std::max(0., 1. - waitSeconds / busySeconds) : 0.)
+      << " (" << std::setprecision(3) << busySeconds << " s reading, "
+      << waitSeconds << " s waiting)" << std::endl;
+}
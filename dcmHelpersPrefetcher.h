@@ -0,0 +1,106 @@
+#ifndef __dcmHelpersPrefetcher_h
+#define __dcmHelpersPrefetcher_h
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <iosfwd>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+class DcmFileFormat;
+class OFCondition;
+
+// Reads input files ahead of their use, so that storage latency overlaps with
+// parsing and processing of the files before them. Files are read in chunks
+// with up to queueDepth reads in flight, through io_uring when available
+// (HAVE_LIBURING) or a set of reader threads otherwise. Files are kept in
+// memory until loaded, within memoryBudget bytes; larger files are only
+// announced to the kernel with posix_fadvise(WILLNEED).
+//
+// A prefetcher is meant to be kept for the life of a process, so that its
+// ring or reader threads serve all jobs. A file is forgotten once loaded, and
+// files a job queued but did not load are to be discarded when it ends.
+class dcmHelpersPrefetcher {
+  public:
+    dcmHelpersPrefetcher(unsigned queueDepth = 4, size_t memoryBudget = 256*1048576UL);
+    ~dcmHelpersPrefetcher();
+
+    // queue files for reading, in the order they will be loaded
+    void prefetch(const std::vector<std::string> &paths);
+
+    // load a file, from memory if it was prefetched; waits for reads in flight
+    OFCondition loadFile(const std::string &path, DcmFileFormat &fileFormat);
+
+    // drop queued or buffered files that are not going to be loaded
+    void discard(const std::vector<std::string> &paths);
+
+    void printStatistics(std::ostream&) const;
+
+  private:
+    dcmHelpersPrefetcher(const dcmHelpersPrefetcher&);
+    dcmHelpersPrefetcher& operator=(const dcmHelpersPrefetcher&);
+
+    enum EntryState { ES_Queued, ES_Reading, ES_Ready, ES_Failed, ES_Consumed };
+
+    struct Entry {
+      std::string path;
+      EntryState state;
+      int fd;
+      size_t size;
+      size_t nextOffset;
+      size_t completed;
+      unsigned outstanding;
+      bool buffered;
+      std::vector<unsigned char> buffer;
+    };
+
+    struct Chunk {
+      Entry *entry;
+      size_t offset;
+      size_t length;
+    };
+
+    static const size_t CHUNK_SIZE = 1048576;
+
+    // remove the entry of a file, with the data read ahead if any; false if
+    //  the file was not read ahead
+    bool takeBuffer(const std::string &path, std::vector<unsigned char> &buffer);
+    // with the mutex held
+    void deleteEntry(Entry*);
+    bool nextChunk(Chunk&, bool wait);
+    void finishEntry(Entry*, EntryState);
+    void completeChunk(const Chunk&, long result);
+    void updateInFlight(int delta);
+    void runThreads();
+    void runUring();
+
+    unsigned queueDepth;
+    size_t memoryBudget;
+
+    mutable std::mutex mutex;
+    std::condition_variable workAvailable;
+    std::condition_variable entryReady;
+    std::map<std::string, Entry*> entries;
+    std::deque<Entry*> pending;
+    std::deque<Chunk> retries;
+    Entry *current;
+    size_t bufferedBytes;
+    bool stopping;
+    std::vector<std::thread> threads;
+    void *ring;
+
+    // statistics
+    bool usingUring;
+    unsigned inFlight, maxInFlight;
+    double inFlightIntegral, busySeconds, waitSeconds;
+    std::chrono::steady_clock::time_point startTime;
+    double lastChange;
+    unsigned long filesBuffered, filesAdvised, filesMissed;
+    double bytesRead;
+};
+
+#endif
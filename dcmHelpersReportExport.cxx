@@ -0,0 +1,379 @@
+#include "dcmHelpersReportExport.h"
+#include "dcmtk/config/osconfig.h"
+#include "dcmtk/dcmdata/dctk.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cctype>
+#include <iostream>
+
+#include <libxml/xmlwriter.h>
+
+namespace {
+
+// value representations as their two characters, for switching on
+#define VR_CODE(a, b) ((unsigned(a) << 8) | unsigned(b))
+
+unsigned getVRCode(DcmObject *object){
+  const char *name = DcmVR(object->getVR()).getVRName();
+  return name && name[0] && name[1] ? VR_CODE(name[0], name[1]) : 0;
+}
+
+bool isBinaryVR(unsigned vr){
+  switch(vr){
+    case VR_CODE('O','B'): case VR_CODE('O','W'): case VR_CODE('O','F'): case VR_CODE('O','D'):
+    case VR_CODE('O','L'): case VR_CODE('O','V'): case VR_CODE('U','N'):
+      return true;
+  }
+  return false;
+}
+
+// VRs with a single value that may contain backslashes
+bool isSingleValuedText(unsigned vr){
+  return vr == VR_CODE('L','T') || vr == VR_CODE('S','T') || vr == VR_CODE('U','T') || vr == VR_CODE('U','R');
+}
+
+const char HEX[] = "0123456789ABCDEF";
+
+void appendTag(std::string &out, const DcmTagKey &tag, bool json){
+  Uint16 group = tag.getGroup(), element = tag.getElement();
+  const char *hex = json ? HEX : "0123456789abcdef";
+  for(int shift=12;shift>=0;shift-=4)
+    out += hex[(group >> shift) & 0xf];
+  if(!json)
+    out += ',';
+  for(int shift=12;shift>=0;shift-=4)
+    out += hex[(element >> shift) & 0xf];
+}
+
+void appendBase64(std::string &out, const std::string &data){
+  static const char CHARS[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  const unsigned char *p = (const unsigned char*)data.data();
+  size_t n = data.size(), i = 0;
+  for(;i+2<n;i+=3){
+    unsigned v = (p[i] << 16) | (p[i+1] << 8) | p[i+2];
+    out += CHARS[v >> 18]; out += CHARS[(v >> 12) & 63]; out += CHARS[(v >> 6) & 63]; out += CHARS[v & 63];
+  }
+  if(i < n){
+    unsigned v = p[i] << 16 | (i+1 < n ? p[i+1] << 8 : 0);
+    out += CHARS[v >> 18]; out += CHARS[(v >> 12) & 63];
+    out += i+1 < n ? CHARS[(v >> 6) & 63] : '=';
+    out += '=';
+  }
+}
+
+// IS and DS are JSON numbers; values that are not in JSON number syntax
+//  (leading '+', missing digits around '.') are reformatted
+bool isJSONNumber(const char *s){
+  if(*s == '-')
+    s++;
+  if(!isdigit((unsigned char)*s))
+    return false;
+  if(*s == '0' && isdigit((unsigned char)s[1]))
+    return false;
+  while(isdigit((unsigned char)*s))
+    s++;
+  if(*s == '.'){
+    s++;
+    if(!isdigit((unsigned char)*s))
+      return false;
+    while(isdigit((unsigned char)*s))
+      s++;
+  }
+  if(*s == 'e' || *s == 'E'){
+    s++;
+    if(*s == '+' || *s == '-')
+      s++;
+    if(!isdigit((unsigned char)*s))
+      return false;
+    while(isdigit((unsigned char)*s))
+      s++;
+  }
+  return !*s;
+}
+
+void appendDouble(std::string &out, double value, int precision){
+  if(std::isnan(value) || std::isinf(value)){
+    out += "null";
+    return;
+  }
+  char number[32];
+  snprintf(number, sizeof(number), "%.*g", precision, value);
+  out += number;
+}
+
+void appendNumberString(std::string &out, const OFString &value){
+  if(value.empty())
+    out += "null";
+  else if(isJSONNumber(value.c_str()))
+    out += value.c_str();
+  else
+    appendDouble(out, OFStandard::atof(value.c_str()), 17);
+}
+
+// raw value bytes, in local byte order
+void getBytes(DcmElement *element, std::string &bytes){
+  Uint32 length = element->getLength();
+  bytes.resize(length);
+  if(length && element->getPartialValue(&bytes[0], 0, length).bad())
+    bytes.clear();
+}
+
+// libxml2 output callback appending to the export buffer
+int appendToBuffer(void *context, const char *data, int length){
+  static_cast<std::string*>(context)->append(data, length);
+  return length;
+}
+
+bool isLatin1(DcmItem *dataset){
+  OFString characterSet;
+  dataset->findAndGetOFStringArray(DCM_SpecificCharacterSet, characterSet);
+  return characterSet.find("ISO_IR 100") != OFString_npos;
+}
+
+}
+
+// a string value as UTF-8 into text
+void dcmHelpersReportExport::appendText(const char *value, size_t length){
+  if(!latin1){
+    text.append(value, length);
+    return;
+  }
+  for(size_t i=0;i<length;i++){
+    unsigned char c = value[i];
+    if(c < 0x80){
+      text += char(c);
+    } else {
+      text += char(0xc0 | (c >> 6));
+      text += char(0x80 | (c & 0x3f));
+    }
+  }
+}
+
+const std::string& dcmHelpersReportExport::toJSON(DcmItem *dataset){
+  buffer.clear();
+  latin1 = isLatin1(dataset);
+  writeJSONItem(dataset);
+  buffer += '\n';
+  return buffer;
+}
+
+void dcmHelpersReportExport::writeJSONItem(DcmItem *item){
+  buffer += '{';
+  for(unsigned long e=0;e<item->card();e++){
+    DcmElement *element = item->getElement(e);
+    unsigned vr = getVRCode(element);
+    if(e)
+      buffer += ',';
+    buffer += '"';
+    appendTag(buffer, element->getTag(), true);
+    buffer += "\":{\"vr\":\"";
+    buffer += DcmVR(element->getVR()).getVRName();
+    buffer += '"';
+
+    if(element->ident() == EVR_SQ){
+      DcmSequenceOfItems *sequence = OFstatic_cast(DcmSequenceOfItems*, element);
+      if(sequence->card()){
+        buffer += ",\"Value\":[";
+        for(unsigned long i=0;i<sequence->card();i++){
+          if(i)
+            buffer += ',';
+          writeJSONItem(sequence->getItem(i));
+        }
+        buffer += ']';
+      }
+      buffer += '}';
+      continue;
+    }
+
+    if(element->isEmpty()){
+      buffer += '}';
+      continue;
+    }
+
+    if(isBinaryVR(vr)){
+      getBytes(element, bytes);
+      buffer += ",\"InlineBinary\":\"";
+      appendBase64(buffer, bytes);
+      buffer += "\"}";
+      continue;
+    }
+
+    unsigned long vm = isSingleValuedText(vr) ? 1 : element->getVM();
+    buffer += ",\"Value\":[";
+    for(unsigned long i=0;i<vm;i++){
+      if(i)
+        buffer += ',';
+      switch(vr){
+        case VR_CODE('U','S'): { Uint16 v = 0; element->getUint16(v, i); buffer += std::to_string(v); break; }
+        case VR_CODE('S','S'): { Sint16 v = 0; element->getSint16(v, i); buffer += std::to_string(v); break; }
+        case VR_CODE('U','L'): { Uint32 v = 0; element->getUint32(v, i); buffer += std::to_string(v); break; }
+        case VR_CODE('S','L'): { Sint32 v = 0; element->getSint32(v, i); buffer += std::to_string(v); break; }
+        case VR_CODE('F','L'): { Float32 v = 0; element->getFloat32(v, i); appendDouble(buffer, v, 9); break; }
+        case VR_CODE('F','D'): { Float64 v = 0; element->getFloat64(v, i); appendDouble(buffer, v, 17); break; }
+        case VR_CODE('A','T'): {
+          DcmTagKey tag;
+          element->getTagVal(tag, i);
+          buffer += '"';
+          appendTag(buffer, tag, true);
+          buffer += '"';
+          break;
+        }
+        default: {
+          OFString value;
+          if(isSingleValuedText(vr))
+            element->getOFStringArray(value);
+          else
+            element->getOFString(value, i);
+          if(vr == VR_CODE('I','S') || vr == VR_CODE('D','S')){
+            appendNumberString(buffer, value);
+            break;
+          }
+          if(value.empty()){
+            buffer += "null";
+            break;
+          }
+          text.clear();
+          appendText(value.c_str(), value.size());
+          if(vr == VR_CODE('P','N')){
+            // component groups: Alphabetic=Ideographic=Phonetic
+            static const char *const GROUPS[] = {"Alphabetic", "Ideographic", "Phonetic"};
+            buffer += '{';
+            size_t start = 0;
+            bool first = true;
+            for(int g=0;g<3 && start<=text.size();g++){
+              size_t end = text.find('=', start);
+              if(end == std::string::npos)
+                end = text.size();
+              if(end > start){
+                if(!first)
+                  buffer += ',';
+                first = false;
+                buffer += '"';
+                buffer += GROUPS[g];
+                buffer += "\":\"";
+                for(size_t c=start;c<end;c++){
+                  if(text[c] == '"' || text[c] == '\\')
+                    buffer += '\\';
+                  buffer += text[c];
+                }
+                buffer += '"';
+              }
+              start = end + 1;
+            }
+            buffer += '}';
+            break;
+          }
+          buffer += '"';
+          for(size_t c=0;c<text.size();c++){
+            unsigned char ch = text[c];
+            if(ch == '"' || ch == '\\'){
+              buffer += '\\';
+              buffer += char(ch);
+            } else if(ch < 0x20){
+              buffer += "\\u00";
+              buffer += HEX[ch >> 4];
+              buffer += HEX[ch & 0xf];
+            } else {
+              buffer += char(ch);
+            }
+          }
+          buffer += '"';
+        }
+      }
+    }
+    buffer += "]}";
+  }
+  buffer += '}';
+}
+
+const std::string& dcmHelpersReportExport::toXML(DcmItem *dataset){
+  buffer.clear();
+  latin1 = isLatin1(dataset);
+
+  xmlOutputBufferPtr output = xmlOutputBufferCreateIO(appendToBuffer, NULL, &buffer, NULL);
+  xmlTextWriterPtr writer = output ? xmlNewTextWriter(output) : NULL;
+  if(!writer){
+    std::cerr << "Cannot create the XML writer" << std::endl;
+    if(output)
+      xmlOutputBufferClose(output);
+    return buffer;
+  }
+
+  xmlTextWriterStartDocument(writer, NULL, "UTF-8", NULL);
+  xmlTextWriterStartElement(writer, BAD_CAST "data-set");
+  xmlTextWriterWriteAttribute(writer, BAD_CAST "xfer", BAD_CAST UID_LittleEndianExplicitTransferSyntax);
+  xmlTextWriterWriteAttribute(writer, BAD_CAST "name", BAD_CAST DcmXfer(EXS_LittleEndianExplicit).getXferName());
+  xmlTextWriterWriteRaw(writer, BAD_CAST "\n");
+
+  writeXMLItem(writer, dataset);
+
+  xmlTextWriterEndElement(writer);
+  xmlTextWriterEndDocument(writer);
+  xmlFreeTextWriter(writer);
+  return buffer;
+}
+
+void dcmHelpersReportExport::writeXMLItem(xmlTextWriterPtr writer, DcmItem *item){
+  std::string tagText;
+  for(unsigned long e=0;e<item->card();e++){
+    DcmElement *element = item->getElement(e);
+    DcmTag tag = element->getTag();
+    unsigned vr = getVRCode(element);
+    tagText.clear();
+    appendTag(tagText, tag, false);
+
+    if(element->ident() == EVR_SQ){
+      DcmSequenceOfItems *sequence = OFstatic_cast(DcmSequenceOfItems*, element);
+      xmlTextWriterStartElement(writer, BAD_CAST "sequence");
+      xmlTextWriterWriteAttribute(writer, BAD_CAST "tag", BAD_CAST tagText.c_str());
+      xmlTextWriterWriteAttribute(writer, BAD_CAST "vr", BAD_CAST "SQ");
+      xmlTextWriterWriteFormatAttribute(writer, BAD_CAST "card", "%lu", sequence->card());
+      xmlTextWriterWriteFormatAttribute(writer, BAD_CAST "len", "%lu", (unsigned long)element->getLength());
+      xmlTextWriterWriteAttribute(writer, BAD_CAST "name", BAD_CAST tag.getTagName());
+      xmlTextWriterWriteRaw(writer, BAD_CAST "\n");
+      for(unsigned long i=0;i<sequence->card();i++){
+        DcmItem *sequenceItem = sequence->getItem(i);
+        xmlTextWriterStartElement(writer, BAD_CAST "item");
+        xmlTextWriterWriteFormatAttribute(writer, BAD_CAST "card", "%lu", sequenceItem->card());
+        xmlTextWriterWriteFormatAttribute(writer, BAD_CAST "len", "%lu", (unsigned long)sequenceItem->getLength());
+        xmlTextWriterWriteRaw(writer, BAD_CAST "\n");
+        writeXMLItem(writer, sequenceItem);
+        xmlTextWriterEndElement(writer);
+        xmlTextWriterWriteRaw(writer, BAD_CAST "\n");
+      }
+      xmlTextWriterEndElement(writer);
+      xmlTextWriterWriteRaw(writer, BAD_CAST "\n");
+      continue;
+    }
+
+    xmlTextWriterStartElement(writer, BAD_CAST "element");
+    xmlTextWriterWriteAttribute(writer, BAD_CAST "tag", BAD_CAST tagText.c_str());
+    xmlTextWriterWriteAttribute(writer, BAD_CAST "vr", BAD_CAST DcmVR(element->getVR()).getVRName());
+    xmlTextWriterWriteFormatAttribute(writer, BAD_CAST "vm", "%lu", element->isEmpty() ? 0UL : element->getVM());
+    xmlTextWriterWriteFormatAttribute(writer, BAD_CAST "len", "%lu", (unsigned long)element->getLength());
+    xmlTextWriterWriteAttribute(writer, BAD_CAST "name", BAD_CAST tag.getTagName());
+    if(isBinaryVR(vr)){
+      xmlTextWriterWriteAttribute(writer, BAD_CAST "binary", BAD_CAST "hidden");
+    } else if(!element->isEmpty()){
+      OFString value;
+      element->getOFStringArray(value);
+      text.clear();
+      appendText(value.c_str(), value.size());
+      xmlTextWriterWriteString(writer, BAD_CAST text.c_str());
+    }
+    xmlTextWriterEndElement(writer);
+    xmlTextWriterWriteRaw(writer, BAD_CAST "\n");
+  }
+}
+
+bool dcmHelpersReportExport::writeFile(const std::string &path, const std::string &content){
+  FILE *f = fopen(path.c_str(), "wb");
+  bool written = f && fwrite(content.data(), 1, content.size(), f) == content.size();
+  // the stream is closed once, whether or not the write succeeded
+  if(f && fclose(f))
+    written = false;
+  if(!written)
+    std::cerr << "Failed to write " << path << std::endl;
+  return written;
+}
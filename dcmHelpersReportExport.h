@@ -0,0 +1,44 @@
+#ifndef __dcmHelpersReportExport_h
+#define __dcmHelpersReportExport_h
+
+#include <string>
+
+class DcmItem;
+struct _xmlTextWriter;
+
+// Text encodings of a report dataset, written straight from the in-memory
+// dataset at generation time, so that indexing does not need a second parse
+// of the saved file:
+//  - the DICOM JSON Model (PS3.18 Annex F)
+//  - the XML format of DcmDataset::writeXML() (as written by dcm2xml),
+//    through the libxml2 streaming writer
+// Both are produced in one pass without building a document tree. The output
+// buffer is kept across calls, so exporting a series of reports with one
+// object does not reallocate once the buffer has grown to the largest report.
+// Strings in ISO_IR 100 are converted to UTF-8; both outputs are UTF-8.
+class dcmHelpersReportExport {
+  public:
+    dcmHelpersReportExport() {}
+
+    // the returned buffer is valid until the next call
+    const std::string& toJSON(DcmItem *dataset);
+    const std::string& toXML(DcmItem *dataset);
+
+    static bool writeFile(const std::string &path, const std::string &content);
+
+  private:
+    dcmHelpersReportExport(const dcmHelpersReportExport&);
+    dcmHelpersReportExport& operator=(const dcmHelpersReportExport&);
+
+    void writeJSONItem(DcmItem *item);
+    void writeXMLItem(_xmlTextWriter *writer, DcmItem *item);
+    void appendText(const char *text, size_t length);
+
+    std::string buffer;
+    // scratch space for single values
+    std::string text;
+    std::string bytes;
+    bool latin1;
+};
+
+#endif
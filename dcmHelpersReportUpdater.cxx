@@ -0,0 +1,225 @@
+#include "dcmHelpersReportUpdater.h"
+#include "dcmHelpersTerminology.h"
+#include "dcmtk/config/osconfig.h"
+#include "dcmtk/dcmdata/dctk.h"
+
+#include <cstdio>
+#include <deque>
+#include <iostream>
+#include <set>
+#include <string>
+
+namespace {
+
+std::string getStringValue(DcmItem *item, const DcmTagKey &tag){
+  OFString value;
+  item->findAndGetOFString(tag, value);
+  return value.c_str();
+}
+
+// referenced instance and all of its referenced frames, if any
+std::string getImageKey(DcmItem *reference){
+  OFString frames;
+  reference->findAndGetOFStringArray(DCM_ReferencedFrameNumber, frames);
+  return getStringValue(reference, DCM_ReferencedSOPInstanceUID) + "/" + frames.c_str();
+}
+
+// segmentation instance and segment number of the Referenced Segment (121214)
+// of a Measurement Group, empty if it has none
+std::string getSegmentKey(DcmItem *group){
+  DcmItem *child, *concept, *reference;
+  for(long i=0;group->findAndGetSequenceItem(DCM_ContentSequence, child, i).good();i++){
+    if(getStringValue(child, DCM_ValueType) != "IMAGE" ||
+       child->findAndGetSequenceItem(DCM_ConceptNameCodeSequence, concept).bad() ||
+       getStringValue(concept, DCM_CodeValue) != dcmHelpersTerminology::getValue(dcmHelpersTerminology::CODE_ReferencedSegment) ||
+       getStringValue(concept, DCM_CodingSchemeDesignator) != dcmHelpersTerminology::getScheme(dcmHelpersTerminology::CODE_ReferencedSegment) ||
+       child->findAndGetSequenceItem(DCM_ReferencedSOPSequence, reference).bad())
+      continue;
+    OFString segments;
+    reference->findAndGetOFStringArray(DCM_ReferencedSegmentNumber, segments);
+    return getStringValue(reference, DCM_ReferencedSOPInstanceUID) + "/" + segments.c_str();
+  }
+  return "";
+}
+
+// item of sequence whose attribute tag has the given value; created if missing
+DcmItem* findOrCreateItem(DcmItem *parent, const DcmTagKey &sequence, const DcmTagKey &tag,
+                          const std::string &value, bool *created = NULL){
+  DcmItem *item;
+  for(long i=0;parent->findAndGetSequenceItem(sequence, item, i).good();i++)
+    if(getStringValue(item, tag) == value){
+      if(created)
+        *created = false;
+      return item;
+    }
+  parent->findOrCreateSequenceItem(sequence, item, -2);
+  item->putAndInsertString(tag, value.c_str());
+  if(created)
+    *created = true;
+  return item;
+}
+
+}
+
+DcmItem* dcmHelpersReportUpdater::findContainer(DcmItem *item, const char *codeValue, const char *codingScheme){
+  std::deque<DcmItem*> queue(1, item);
+  while(!queue.empty()){
+    DcmItem *parent = queue.front();
+    queue.pop_front();
+    DcmItem *child, *concept;
+    for(long i=0;parent->findAndGetSequenceItem(DCM_ContentSequence, child, i).good();i++){
+      if(getStringValue(child, DCM_ValueType) != "CONTAINER")
+        continue;
+      if(child->findAndGetSequenceItem(DCM_ConceptNameCodeSequence, concept).good() &&
+         getStringValue(concept, DCM_CodeValue) == codeValue &&
+         getStringValue(concept, DCM_CodingSchemeDesignator) == codingScheme)
+        return child;
+      queue.push_back(child);
+    }
+  }
+  return NULL;
+}
+
+void dcmHelpersReportUpdater::mergeEvidence(DcmItem *target, DcmItem *source, const DcmTagKey &sequence){
+  DcmItem *sourceStudy, *sourceSeries, *sourceInstance;
+  for(long s=0;source->findAndGetSequenceItem(sequence, sourceStudy, s).good();s++){
+    DcmItem *study = findOrCreateItem(target, sequence, DCM_StudyInstanceUID,
+                                      getStringValue(sourceStudy, DCM_StudyInstanceUID));
+    for(long r=0;sourceStudy->findAndGetSequenceItem(DCM_ReferencedSeriesSequence, sourceSeries, r).good();r++){
+      bool createdSeries;
+      DcmItem *series = findOrCreateItem(study, DCM_ReferencedSeriesSequence, DCM_SeriesInstanceUID,
+                                         getStringValue(sourceSeries, DCM_SeriesInstanceUID), &createdSeries);
+      if(createdSeries){
+        std::string retrieveAETitle = getStringValue(sourceSeries, DCM_RetrieveAETitle);
+        if(!retrieveAETitle.empty())
+          series->putAndInsertString(DCM_RetrieveAETitle, retrieveAETitle.c_str());
+      }
+      // series of large reports list thousands of instances
+      std::set<std::string> present;
+      DcmItem *instance;
+      for(long i=0;series->findAndGetSequenceItem(DCM_ReferencedSOPSequence, instance, i).good();i++)
+        present.insert(getStringValue(instance, DCM_ReferencedSOPInstanceUID));
+      for(long i=0;sourceSeries->findAndGetSequenceItem(DCM_ReferencedSOPSequence, sourceInstance, i).good();i++){
+        std::string sopInstanceUID = getStringValue(sourceInstance, DCM_ReferencedSOPInstanceUID);
+        if(!present.insert(sopInstanceUID).second)
+          continue;
+        series->findOrCreateSequenceItem(DCM_ReferencedSOPSequence, instance, -2);
+        instance->putAndInsertString(DCM_ReferencedSOPClassUID,
+                                     getStringValue(sourceInstance, DCM_ReferencedSOPClassUID).c_str());
+        instance->putAndInsertString(DCM_ReferencedSOPInstanceUID, sopInstanceUID.c_str());
+      }
+    }
+  }
+}
+
+int dcmHelpersReportUpdater::mergeImageLibrary(DcmItem *target, DcmItem *source){
+  const char *codeValue = dcmHelpersTerminology::getValue(dcmHelpersTerminology::CODE_ImageLibrary);
+  const char *codingScheme = dcmHelpersTerminology::getScheme(dcmHelpersTerminology::CODE_ImageLibrary);
+  DcmItem *library = findContainer(target, codeValue, codingScheme);
+  if(!library)
+    return -1;
+  DcmItem *sourceLibrary = findContainer(source, codeValue, codingScheme);
+  if(!sourceLibrary)
+    return 0;
+
+  // entries are identified by instance and frame list; an entry of a whole
+  //  image covers its frames
+  std::set<std::string> present;
+  DcmItem *entry, *reference;
+  for(long i=0;library->findAndGetSequenceItem(DCM_ContentSequence, entry, i).good();i++)
+    if(entry->findAndGetSequenceItem(DCM_ReferencedSOPSequence, reference).good())
+      present.insert(getImageKey(reference));
+  int added = 0;
+  for(long i=0;sourceLibrary->findAndGetSequenceItem(DCM_ContentSequence, entry, i).good();i++){
+    if(entry->findAndGetSequenceItem(DCM_ReferencedSOPSequence, reference).bad())
+      continue;
+    if(present.count(getStringValue(reference, DCM_ReferencedSOPInstanceUID) + "/") ||
+       !present.insert(getImageKey(reference)).second)
+      continue;
+    if(library->insertSequenceItem(DCM_ContentSequence, new DcmItem(*entry)).bad()){
+      std::cerr << "Failed to add Image Library entry" << std::endl;
+      return -1;
+    }
+    added++;
+  }
+  return added;
+}
+
+bool dcmHelpersReportUpdater::appendMeasurementGroups(DcmFileFormat &report, DcmDataset *update){
+  DcmDataset *dataset = report.getDataset();
+  DcmItem *findings = findContainer(dataset, dcmHelpersTerminology::getValue(dcmHelpersTerminology::CODE_Findings),
+                                    dcmHelpersTerminology::getScheme(dcmHelpersTerminology::CODE_Findings));
+  DcmItem *updateFindings = findContainer(update, dcmHelpersTerminology::getValue(dcmHelpersTerminology::CODE_Findings),
+                                          dcmHelpersTerminology::getScheme(dcmHelpersTerminology::CODE_Findings));
+  if(!findings){
+    std::cerr << "The report does not contain a Findings container" << std::endl;
+    return false;
+  }
+  if(!updateFindings){
+    std::cerr << "No measurements to append" << std::endl;
+    return false;
+  }
+
+  // a segment is measured by one group only, so that its Tracking Identifier
+  //  and UID stay unique within the report
+  DcmItem *group;
+  std::set<std::string> segments;
+  for(long i=0;findings->findAndGetSequenceItem(DCM_ContentSequence, group, i).good();i++)
+    segments.insert(getSegmentKey(group));
+  for(long i=0;updateFindings->findAndGetSequenceItem(DCM_ContentSequence, group, i).good();i++){
+    std::string segment = getSegmentKey(group);
+    if(!segment.empty() && !segments.insert(segment).second){
+      std::cerr << "The report already contains a measurement group of segment " << segment << std::endl;
+      return false;
+    }
+  }
+
+  unsigned long appended = 0;
+  for(long i=0;updateFindings->findAndGetSequenceItem(DCM_ContentSequence, group, i).good();i++){
+    if(findings->insertSequenceItem(DCM_ContentSequence, new DcmItem(*group)).bad()){
+      std::cerr << "Failed to append measurement group" << std::endl;
+      return false;
+    }
+    appended++;
+  }
+
+  // the library is extended by the sources of the new groups only, the
+  //  existing entries are kept as read
+  if(mergeImageLibrary(dataset, update) < 0){
+    std::cerr << "The report does not contain an Image Library" << std::endl;
+    return false;
+  }
+  mergeEvidence(dataset, update, DCM_CurrentRequestedProcedureEvidenceSequence);
+
+  // the updated report is a new instance in the same series, replacing the
+  // one it was read from
+  std::string studyInstanceUID = getStringValue(dataset, DCM_StudyInstanceUID);
+  std::string seriesInstanceUID = getStringValue(dataset, DCM_SeriesInstanceUID);
+  std::string sopClassUID = getStringValue(dataset, DCM_SOPClassUID);
+  std::string sopInstanceUID = getStringValue(dataset, DCM_SOPInstanceUID);
+  DcmItem *study = findOrCreateItem(dataset, DCM_PredecessorDocumentsSequence, DCM_StudyInstanceUID, studyInstanceUID);
+  DcmItem *series = findOrCreateItem(study, DCM_ReferencedSeriesSequence, DCM_SeriesInstanceUID, seriesInstanceUID);
+  DcmItem *instance = findOrCreateItem(series, DCM_ReferencedSOPSequence, DCM_ReferencedSOPInstanceUID, sopInstanceUID);
+  instance->putAndInsertString(DCM_ReferencedSOPClassUID, sopClassUID.c_str());
+
+  char uid[100];
+  dcmGenerateUniqueIdentifier(uid, SITE_INSTANCE_UID_ROOT);
+  dataset->putAndInsertString(DCM_SOPInstanceUID, uid);
+  report.getMetaInfo()->putAndInsertString(DCM_MediaStorageSOPInstanceUID, uid);
+
+  Sint32 instanceNumber = 0;
+  dataset->findAndGetSint32(DCM_InstanceNumber, instanceNumber);
+  char number[16];
+  sprintf(number, "%d", int(instanceNumber) + 1);
+  dataset->putAndInsertString(DCM_InstanceNumber, number);
+
+  OFString date, time;
+  DcmDate::getCurrentDate(date);
+  DcmTime::getCurrentTime(time);
+  dataset->putAndInsertString(DCM_ContentDate, date.c_str());
+  dataset->putAndInsertString(DCM_ContentTime, time.c_str());
+  dataset->putAndInsertString(DCM_InstanceCreationDate, date.c_str());
+  dataset->putAndInsertString(DCM_InstanceCreationTime, time.c_str());
+
+  return appended > 0;
+}
@@ -0,0 +1,36 @@
+#ifndef __dcmHelpersReportUpdater_h
+#define __dcmHelpersReportUpdater_h
+
+class DcmDataset;
+class DcmFileFormat;
+class DcmItem;
+class DcmTagKey;
+
+// Incremental update of an existing report at the dataset level: content items
+// are moved between the encoded content trees, so that the parts of the report
+// that do not change (the Image Library in particular) are written back as
+// read instead of being rebuilt through DSRDocument.
+class dcmHelpersReportUpdater {
+  public:
+    // first CONTAINER with the given concept name in the content tree, searched
+    // breadth first below item
+    static DcmItem* findContainer(DcmItem *item, const char *codeValue, const char *codingScheme);
+
+    // append the Measurement Groups of the Findings container (121070) of
+    // update to the Findings container of report, merge the Image Library and
+    // the evidence, and turn the report into a new instance that lists the old
+    // one as its predecessor; fails without changes if a new group references
+    // a segment that a group of the report already references
+    static bool appendMeasurementGroups(DcmFileFormat &report, DcmDataset *update);
+
+    // add the entries of the Image Library of source that reference images or
+    // frames not yet listed in the Image Library of target; returns the number
+    // of entries added, or -1 if target has no Image Library
+    static int mergeImageLibrary(DcmItem *target, DcmItem *source);
+
+    // add the instances of an evidence sequence (study / series / instance
+    // hierarchy) that are not yet present
+    static void mergeEvidence(DcmItem *target, DcmItem *source, const DcmTagKey &sequence);
+};
+
+#endif
@@ -0,0 +1,282 @@
+#include "dcmHelpersReportValidator.h"
+#include "dcmHelpersTerminology.h"
+#include "dcmtk/config/osconfig.h"
+#include "dcmtk/dcmdata/dctk.h"
+
+#include <set>
+
+namespace {
+
+struct Context {
+  std::vector<std::string> &problems;
+  // instances referenced by content items, and those listed as evidence
+  std::set<std::string> referenced;
+  std::set<std::string> imageLibrary;
+  std::set<std::string> segmentationSources;
+  unsigned imageLibraries, findings;
+
+  explicit Context(std::vector<std::string> &problems) :
+    problems(problems), imageLibraries(0), findings(0) {}
+
+  void problem(const std::string &where, const std::string &message){
+    problems.push_back(where + ": " + message);
+  }
+};
+
+std::string getStringValue(DcmItem *item, const DcmTagKey &tag){
+  OFString value;
+  item->findAndGetOFString(tag, value);
+  return value.c_str();
+}
+
+bool isCode(DcmItem *item, const DcmTagKey &sequence, dcmHelpersTerminology::Code code){
+  DcmItem *codeItem;
+  return item->findAndGetSequenceItem(sequence, codeItem).good() &&
+         getStringValue(codeItem, DCM_CodeValue) == dcmHelpersTerminology::getValue(code) &&
+         getStringValue(codeItem, DCM_CodingSchemeDesignator) == dcmHelpersTerminology::getScheme(code);
+}
+
+// Code Sequence Macro: a single item with the three type 1 attributes
+void checkCode(DcmItem *item, const DcmTagKey &sequence, const std::string &where,
+               const char *name, Context &context){
+  DcmItem *codeItem;
+  if(item->findAndGetSequenceItem(sequence, codeItem).bad()){
+    context.problem(where, std::string("missing ") + name);
+    return;
+  }
+  if(item->findAndGetSequenceItem(sequence, codeItem, 1).good())
+    context.problem(where, std::string("more than one item in ") + name);
+  if(getStringValue(codeItem, DCM_CodeValue).empty() ||
+     getStringValue(codeItem, DCM_CodingSchemeDesignator).empty() ||
+     getStringValue(codeItem, DCM_CodeMeaning).empty())
+    context.problem(where, std::string("incomplete ") + name);
+}
+
+void checkPresent(DcmItem *dataset, const DcmTagKey &tag, const char *name, bool type1, Context &context){
+  DcmElement *element;
+  if(dataset->findAndGetElement(tag, element).bad())
+    context.problem("dataset", std::string("missing ") + name);
+  else if(type1 && element->isEmpty())
+    context.problem("dataset", std::string("empty ") + name);
+}
+
+bool isReferencedSOPValid(DcmItem *item, const std::string &where, Context &context, std::string &instanceUID){
+  DcmItem *reference;
+  if(item->findAndGetSequenceItem(DCM_ReferencedSOPSequence, reference).bad()){
+    context.problem(where, "missing ReferencedSOPSequence");
+    return false;
+  }
+  instanceUID = getStringValue(reference, DCM_ReferencedSOPInstanceUID);
+  if(instanceUID.empty() || getStringValue(reference, DCM_ReferencedSOPClassUID).empty()){
+    context.problem(where, "incomplete ReferencedSOPSequence");
+    return false;
+  }
+  context.referenced.insert(instanceUID);
+  return true;
+}
+
+// TID 1411: content items of a Measurement Group, counted as the group is
+// walked and checked once all of them are seen
+struct MeasurementGroup {
+  MeasurementGroup() : trackingIdentifiers(0), trackingUIDs(0), segments(0), sources(0), measurements(0) {}
+  unsigned trackingIdentifiers, trackingUIDs, segments, sources, measurements;
+};
+
+void countGroupItem(DcmItem *child, const std::string &where, MeasurementGroup &group, Context &context){
+  DcmItem *reference;
+  std::string valueType = getStringValue(child, DCM_ValueType);
+  if(isCode(child, DCM_ConceptNameCodeSequence, dcmHelpersTerminology::CODE_TrackingIdentifier))
+    group.trackingIdentifiers++;
+  else if(isCode(child, DCM_ConceptNameCodeSequence, dcmHelpersTerminology::CODE_TrackingUniqueIdentifier))
+    group.trackingUIDs++;
+  else if(isCode(child, DCM_ConceptNameCodeSequence, dcmHelpersTerminology::CODE_ReferencedSegment)){
+    group.segments++;
+    if(valueType != "IMAGE" || child->findAndGetSequenceItem(DCM_ReferencedSOPSequence, reference).bad() ||
+       getStringValue(reference, DCM_ReferencedSOPClassUID) != UID_SegmentationStorage ||
+       getStringValue(reference, DCM_ReferencedSegmentNumber).empty())
+      context.problem(where, "Referenced Segment is not a segment of a segmentation");
+  } else if(isCode(child, DCM_ConceptNameCodeSequence, dcmHelpersTerminology::CODE_SourceImageForSegmentation)){
+    group.sources++;
+    if(child->findAndGetSequenceItem(DCM_ReferencedSOPSequence, reference).good())
+      context.segmentationSources.insert(getStringValue(reference, DCM_ReferencedSOPInstanceUID));
+  } else if(isCode(child, DCM_ConceptNameCodeSequence, dcmHelpersTerminology::CODE_SourceSeriesForSegmentation))
+    group.sources++;
+  else if(valueType == "NUM")
+    group.measurements++;
+}
+
+void checkMeasurementGroup(const MeasurementGroup &group, const std::string &where, Context &context){
+  if(group.trackingIdentifiers != 1)
+    context.problem(where, "Measurement Group needs one Tracking Identifier");
+  if(group.trackingUIDs != 1)
+    context.problem(where, "Measurement Group needs one Tracking Unique Identifier");
+  if(group.segments != 1)
+    context.problem(where, "Measurement Group needs one Referenced Segment");
+  if(!group.sources)
+    context.problem(where, "Measurement Group does not reference the source of the segmentation");
+  if(!group.measurements)
+    context.problem(where, "Measurement Group contains no measurement");
+}
+
+// Content Item Macro and the Comprehensive SR relationship constraints, for an
+// item and its descendants; the template structure is checked on the same walk
+void checkContentItem(DcmItem *item, const std::string &where, const std::string &parentValueType,
+                      unsigned depth, bool measurementGroup, Context &context){
+  std::string valueType = getStringValue(item, DCM_ValueType);
+  std::string relationship = getStringValue(item, DCM_RelationshipType);
+
+  if(depth && relationship.empty())
+    context.problem(where, "missing RelationshipType");
+  if(depth && parentValueType != "CONTAINER" && relationship == "CONTAINS")
+    context.problem(where, "CONTAINS below a " + parentValueType + " item");
+  if(relationship == "HAS CONCEPT MOD" && valueType != "CODE" && valueType != "TEXT")
+    context.problem(where, "HAS CONCEPT MOD target is " + valueType);
+  if(valueType == "CONTAINER" && depth && relationship != "CONTAINS")
+    context.problem(where, "CONTAINER must be the target of CONTAINS");
+
+  // the concept name may only be omitted for references
+  DcmItem *codeItem;
+  if(item->findAndGetSequenceItem(DCM_ConceptNameCodeSequence, codeItem).good() ||
+     (valueType != "IMAGE" && valueType != "COMPOSITE" && valueType != "WAVEFORM"))
+    checkCode(item, DCM_ConceptNameCodeSequence, where, "ConceptNameCodeSequence", context);
+
+  std::string instanceUID;
+  if(valueType == "CONTAINER"){
+    if(getStringValue(item, DCM_ContinuityOfContent).empty())
+      context.problem(where, "missing ContinuityOfContent");
+  } else if(valueType == "TEXT"){
+    if(getStringValue(item, DCM_TextValue).empty())
+      context.problem(where, "missing TextValue");
+  } else if(valueType == "CODE"){
+    checkCode(item, DCM_ConceptCodeSequence, where, "ConceptCodeSequence", context);
+  } else if(valueType == "UIDREF"){
+    if(getStringValue(item, DCM_UID).empty())
+      context.problem(where, "missing UID");
+  } else if(valueType == "NUM"){
+    DcmItem *measuredValue;
+    if(item->findAndGetSequenceItem(DCM_MeasuredValueSequence, measuredValue).good()){
+      if(getStringValue(measuredValue, DCM_NumericValue).empty())
+        context.problem(where, "missing NumericValue");
+      checkCode(measuredValue, DCM_MeasurementUnitsCodeSequence, where, "MeasurementUnitsCodeSequence", context);
+    } else {
+      DcmElement *element;
+      if(item->findAndGetElement(DCM_MeasuredValueSequence, element).bad())
+        context.problem(where, "missing MeasuredValueSequence");
+    }
+  } else if(valueType == "IMAGE" || valueType == "COMPOSITE" || valueType == "WAVEFORM"){
+    isReferencedSOPValid(item, where, context, instanceUID);
+  } else if(valueType != "DATE" && valueType != "TIME" && valueType != "DATETIME" &&
+            valueType != "PNAME" && valueType != "SCOORD" && valueType != "SCOORD3D" &&
+            valueType != "TCOORD"){
+    context.problem(where, "invalid ValueType " + valueType);
+  }
+
+  // template structure, checked where the enclosing container is visited
+  bool imageLibrary = false, findings = false;
+  if(valueType == "CONTAINER" && depth == 1){
+    if(isCode(item, DCM_ConceptNameCodeSequence, dcmHelpersTerminology::CODE_ImageLibrary)){
+      context.imageLibraries++;
+      imageLibrary = true;
+    } else if(isCode(item, DCM_ConceptNameCodeSequence, dcmHelpersTerminology::CODE_Findings)){
+      context.findings++;
+      findings = true;
+    }
+  }
+
+  MeasurementGroup group;
+  DcmItem *child;
+  for(long i=0;item->findAndGetSequenceItem(DCM_ContentSequence, child, i).good();i++){
+    std::string childWhere = where + "." + std::to_string(i+1);
+    bool childIsGroup = false;
+    if(imageLibrary){
+      // TID 4020: an image with its acquisition context
+      if(getStringValue(child, DCM_ValueType) != "IMAGE")
+        context.problem(childWhere, "Image Library entry is not an IMAGE");
+      DcmItem *reference;
+      if(child->findAndGetSequenceItem(DCM_ReferencedSOPSequence, reference).good())
+        context.imageLibrary.insert(getStringValue(reference, DCM_ReferencedSOPInstanceUID));
+    } else if(findings){
+      childIsGroup = getStringValue(child, DCM_ValueType) == "CONTAINER" &&
+                     isCode(child, DCM_ConceptNameCodeSequence, dcmHelpersTerminology::CODE_MeasurementGroup);
+      if(!childIsGroup)
+        context.problem(childWhere, "Findings may only contain Measurement Groups");
+    } else if(measurementGroup){
+      countGroupItem(child, where, group, context);
+    }
+    checkContentItem(child, childWhere, valueType, depth+1, childIsGroup, context);
+  }
+  if(measurementGroup)
+    checkMeasurementGroup(group, where, context);
+}
+
+}
+
+bool dcmHelpersReportValidator::validate(DcmItem *dataset, std::vector<std::string> &problems){
+  size_t numberOfProblems = problems.size();
+  Context context(problems);
+
+  if(getStringValue(dataset, DCM_SOPClassUID) != UID_ComprehensiveSRStorage)
+    context.problem("dataset", "not a Comprehensive SR");
+  if(getStringValue(dataset, DCM_Modality) != "SR")
+    context.problem("dataset", "Modality is not SR");
+
+  // type 1 and type 2 attributes of the Patient, General Study, SR Document
+  //  Series, General Equipment, SR Document General and SOP Common modules
+  checkPresent(dataset, DCM_SOPInstanceUID, "SOPInstanceUID", true, context);
+  checkPresent(dataset, DCM_StudyInstanceUID, "StudyInstanceUID", true, context);
+  checkPresent(dataset, DCM_SeriesInstanceUID, "SeriesInstanceUID", true, context);
+  checkPresent(dataset, DCM_SeriesNumber, "SeriesNumber", true, context);
+  checkPresent(dataset, DCM_InstanceNumber, "InstanceNumber", true, context);
+  checkPresent(dataset, DCM_CompletionFlag, "CompletionFlag", true, context);
+  checkPresent(dataset, DCM_VerificationFlag, "VerificationFlag", true, context);
+  checkPresent(dataset, DCM_ContentDate, "ContentDate", true, context);
+  checkPresent(dataset, DCM_ContentTime, "ContentTime", true, context);
+  checkPresent(dataset, DCM_PatientName, "PatientName", false, context);
+  checkPresent(dataset, DCM_PatientID, "PatientID", false, context);
+  checkPresent(dataset, DCM_PatientBirthDate, "PatientBirthDate", false, context);
+  checkPresent(dataset, DCM_PatientSex, "PatientSex", false, context);
+  checkPresent(dataset, DCM_StudyDate, "StudyDate", false, context);
+  checkPresent(dataset, DCM_StudyTime, "StudyTime", false, context);
+  checkPresent(dataset, DCM_ReferringPhysicianName, "ReferringPhysicianName", false, context);
+  checkPresent(dataset, DCM_StudyID, "StudyID", false, context);
+  checkPresent(dataset, DCM_AccessionNumber, "AccessionNumber", false, context);
+  checkPresent(dataset, DCM_Manufacturer, "Manufacturer", false, context);
+  checkPresent(dataset, DCM_ReferencedPerformedProcedureStepSequence, "ReferencedPerformedProcedureStepSequence", false, context);
+  checkPresent(dataset, DCM_PerformedProcedureCodeSequence, "PerformedProcedureCodeSequence", false, context);
+
+  // TID 1000 at the root
+  if(getStringValue(dataset, DCM_ValueType) != "CONTAINER")
+    context.problem("root", "not a CONTAINER");
+  if(!isCode(dataset, DCM_ConceptNameCodeSequence, dcmHelpersTerminology::CODE_QuantitativeMeasurementReport))
+    context.problem("root", "not a Quantitative measurement report");
+  DcmItem *templateItem;
+  if(dataset->findAndGetSequenceItem(DCM_ContentTemplateSequence, templateItem).bad() ||
+     getStringValue(templateItem, DCM_TemplateIdentifier) != "1000" ||
+     getStringValue(templateItem, DCM_MappingResource) != "99QIICR")
+    context.problem("root", "missing template identification 1000 (99QIICR)");
+
+  checkContentItem(dataset, "1", "", 0, false, context);
+
+  if(context.imageLibraries != 1)
+    context.problem("root", "needs one Image Library");
+  if(context.findings != 1)
+    context.problem("root", "needs one Findings container");
+
+  // every referenced instance is listed as evidence, and every source of a
+  //  measured segmentation is in the Image Library
+  std::set<std::string> evidence;
+  DcmItem *study, *series, *instance;
+  for(long s=0;dataset->findAndGetSequenceItem(DCM_CurrentRequestedProcedureEvidenceSequence, study, s).good();s++)
+    for(long r=0;study->findAndGetSequenceItem(DCM_ReferencedSeriesSequence, series, r).good();r++)
+      for(long i=0;series->findAndGetSequenceItem(DCM_ReferencedSOPSequence, instance, i).good();i++)
+        evidence.insert(getStringValue(instance, DCM_ReferencedSOPInstanceUID));
+  for(std::set<std::string>::const_iterator it=context.referenced.begin();it!=context.referenced.end();++it)
+    if(!evidence.count(*it))
+      context.problem("evidence", "referenced instance " + *it + " is not listed in CurrentRequestedProcedureEvidenceSequence");
+  for(std::set<std::string>::const_iterator it=context.segmentationSources.begin();
+      it!=context.segmentationSources.end();++it)
+    if(!context.imageLibrary.count(*it))
+      context.problem("Image Library", "source image " + *it + " is missing");
+
+  return problems.size() == numberOfProblems;
+}
@@ -0,0 +1,22 @@
+#ifndef __dcmHelpersReportValidator_h
+#define __dcmHelpersReportValidator_h
+
+#include <string>
+#include <vector>
+
+class DcmItem;
+
+// Conformance of an encoded report with the Comprehensive SR IOD and with the
+// structure written by the helpers: TID 1000 at the root (as 99QIICR 10001),
+// one TID 4020 Image Library, and a Findings container of TID 1411 Measurement
+// Groups. The dataset is checked in a single pass over its elements, so a
+// report can be validated right after DSRDocument::write() and before it is
+// saved, without reading it back through DSRDocument.
+class dcmHelpersReportValidator {
+  public:
+    // returns true if no problems were found; problems are appended as
+    // human readable messages
+    static bool validate(DcmItem *dataset, std::vector<std::string> &problems);
+};
+
+#endif
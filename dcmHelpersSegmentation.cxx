@@ -0,0 +1,137 @@
+#include "dcmHelpersSegmentation.h"
+#include "dcmHelpersFrameDecoder.h"
+#include "dcmHelpersFrameIndex.h"
+#include "dcmtk/config/osconfig.h"
+#include "dcmtk/dcmdata/dctk.h"
+
+#include <iostream>
+
+bool dcmHelpersSegmentation::getFrames(DcmDataset *seg, std::vector<dcmHelpersSegFrame> &frames){
+  DcmItem *item, *derivationItem, *sourceItem;
+  Sint32 numberOfFrames = 1;
+  seg->findAndGetSint32(DCM_NumberOfFrames, numberOfFrames);
+
+  // Some writers list the source image in the shared functional groups only;
+  // this is unambiguous if there is a single source image.
+  OFString sharedSOPClassUID, sharedSOPInstanceUID;
+  if(seg->findAndGetSequenceItem(DCM_SharedFunctionalGroupsSequence, item).good() &&
+     item->findAndGetSequenceItem(DCM_DerivationImageSequence, derivationItem).good() &&
+     derivationItem->findAndGetSequenceItem(DCM_SourceImageSequence, sourceItem, 1).bad() &&
+     derivationItem->findAndGetSequenceItem(DCM_SourceImageSequence, sourceItem).good()){
+    sourceItem->findAndGetOFString(DCM_ReferencedSOPClassUID, sharedSOPClassUID);
+    sourceItem->findAndGetOFString(DCM_ReferencedSOPInstanceUID, sharedSOPInstanceUID);
+  }
+
+  frames.clear();
+  for(Sint32 i=0;i<numberOfFrames;i++){
+    if(seg->findAndGetSequenceItem(DCM_PerFrameFunctionalGroupsSequence, item, i).bad()){
+      std::cerr << "Segmentation does not contain functional groups for frame " << i+1 << std::endl;
+      return false;
+    }
+
+    dcmHelpersSegFrame frame;
+    frame.segmentNumber = 0;
+    frame.referencedFrameNumber = 0;
+    frame.referencedSOPClassUID = sharedSOPClassUID.c_str();
+    frame.referencedSOPInstanceUID = sharedSOPInstanceUID.c_str();
+
+    DcmItem *segmentItem;
+    if(item->findAndGetSequenceItem(DCM_SegmentIdentificationSequence, segmentItem).good())
+      segmentItem->findAndGetUint16(DCM_ReferencedSegmentNumber, frame.segmentNumber);
+
+    if(item->findAndGetSequenceItem(DCM_DerivationImageSequence, derivationItem).good() &&
+       derivationItem->findAndGetSequenceItem(DCM_SourceImageSequence, sourceItem).good()){
+      OFString uid;
+      Sint32 referencedFrameNumber = 0;
+      if(sourceItem->findAndGetOFString(DCM_ReferencedSOPClassUID, uid).good())
+        frame.referencedSOPClassUID = uid.c_str();
+      if(sourceItem->findAndGetOFString(DCM_ReferencedSOPInstanceUID, uid).good())
+        frame.referencedSOPInstanceUID = uid.c_str();
+      if(sourceItem->findAndGetSint32(DCM_ReferencedFrameNumber, referencedFrameNumber).good())
+        frame.referencedFrameNumber = referencedFrameNumber;
+    }
+
+    frames.push_back(frame);
+  }
+
+  return !frames.empty();
+}
+
+bool dcmHelpersSegmentation::getFrameMask(const dcmHelpersFrameIndex &index, unsigned long frame,
+                                          std::vector<unsigned char> &mask){
+  unsigned short bitsAllocated = index.getBitsAllocated();
+  if(index.isEncapsulated() || (bitsAllocated != 1 && bitsAllocated != 8))
+    return false;
+
+  std::vector<unsigned char> pixels;
+  size_t firstBit = 0;
+  if(!index.readFrame(frame, pixels, &firstBit)){
+    std::cerr << "Failed to read segmentation frame " << frame+1 << std::endl;
+    return false;
+  }
+
+  size_t numPixels = size_t(index.getRows()) * index.getColumns();
+  if(bitsAllocated == 1){
+    unpackBits(&pixels[0], firstBit, numPixels, mask);
+  } else {
+    // FRACTIONAL segmentation: any non-zero occupancy counts
+    mask.resize(numPixels);
+    for(size_t i=0;i<numPixels;i++)
+      mask[i] = pixels[i] ? 1 : 0;
+  }
+  return true;
+}
+
+void dcmHelpersSegmentation::unpackBits(const unsigned char *bits, size_t firstBit, size_t numPixels,
+                                        std::vector<unsigned char> &mask){
+  mask.resize(numPixels);
+  // the first pixel is stored in the least significant bit
+  for(size_t i=0;i<numPixels;i++){
+    size_t bit = firstBit + i;
+    mask[i] = (bits[bit >> 3] >> (bit & 7)) & 1;
+  }
+}
+
+bool dcmHelpersSegmentation::accumulate(const dcmHelpersDecodedFrame &frame,
+                                        const std::vector<unsigned char> &mask,
+                                        dcmHelpersSegmentStatistics &statistics){
+  size_t numPixels = size_t(frame.rows) * frame.columns;
+  if(frame.samplesPerPixel != 1 || mask.size() != numPixels ||
+     frame.length < numPixels * (frame.bitsAllocated / 8))
+    return false;
+
+  double sum = 0;
+  unsigned long count = 0;
+  switch(frame.bitsAllocated){
+    case 8:
+      for(size_t i=0;i<numPixels;i++)
+        if(mask[i]){
+          sum += frame.pixelRepresentation ? OFreinterpret_cast(const Sint8*, frame.data)[i] : frame.data[i];
+          count++;
+        }
+      break;
+    case 16:
+      for(size_t i=0;i<numPixels;i++)
+        if(mask[i]){
+          sum += frame.pixelRepresentation ? OFreinterpret_cast(const Sint16*, frame.data)[i]
+                                           : OFreinterpret_cast(const Uint16*, frame.data)[i];
+          count++;
+        }
+      break;
+    case 32:
+      for(size_t i=0;i<numPixels;i++)
+        if(mask[i]){
+          sum += frame.pixelRepresentation ? OFreinterpret_cast(const Sint32*, frame.data)[i]
+                                           : OFreinterpret_cast(const Uint32*, frame.data)[i];
+          count++;
+        }
+      break;
+    default:
+      return false;
+  }
+
+  // the modality LUT is linear, so it can be applied to the sum
+  statistics.sum += sum * frame.rescaleSlope + count * frame.rescaleIntercept;
+  statistics.count += count;
+  return true;
+}
@@ -0,0 +1,48 @@
+#ifndef __dcmHelpersSegmentation_h
+#define __dcmHelpersSegmentation_h
+
+#include <string>
+#include <vector>
+
+class DcmDataset;
+class dcmHelpersFrameIndex;
+
+// Segment and source image referenced by one frame of a segmentation
+struct dcmHelpersSegFrame {
+  unsigned short segmentNumber;
+  std::string referencedSOPClassUID;
+  std::string referencedSOPInstanceUID;
+  // 1-based as in ReferencedFrameNumber; 0 if the source is a single frame image
+  long referencedFrameNumber;
+};
+
+// Mean and voxel count of the source image values covered by a segment
+struct dcmHelpersSegmentStatistics {
+  dcmHelpersSegmentStatistics() : count(0), sum(0) {}
+  double mean() const { return count ? sum / count : 0; }
+  unsigned long count;
+  double sum;
+};
+
+struct dcmHelpersDecodedFrame;
+
+class dcmHelpersSegmentation {
+  public:
+    // read the per-frame functional groups of a segmentation
+    static bool getFrames(DcmDataset *seg, std::vector<dcmHelpersSegFrame>&);
+
+    // mask (one byte per pixel) for the 0-based frame of a BINARY or FRACTIONAL
+    // segmentation in native encoding, read from the file with a single positioned
+    // read; encapsulated segmentations go through dcmHelpersFrameDecoder
+    static bool getFrameMask(const dcmHelpersFrameIndex&, unsigned long frame, std::vector<unsigned char> &mask);
+
+    // expand numPixels bits, starting at bit firstBit of the buffer, into a mask
+    static void unpackBits(const unsigned char *bits, size_t firstBit, size_t numPixels,
+                           std::vector<unsigned char> &mask);
+
+    // accumulate the rescaled values of a decoded source frame where mask is set
+    static bool accumulate(const dcmHelpersDecodedFrame&, const std::vector<unsigned char> &mask,
+                           dcmHelpersSegmentStatistics&);
+};
+
+#endif
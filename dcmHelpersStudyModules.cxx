@@ -0,0 +1,83 @@
+#include "dcmHelpersStudyModules.h"
+#include "dcmHelpersCommon.h"
+#include "dcmtk/config/osconfig.h"
+#include "dcmtk/dcmdata/dctk.h"
+
+#include <iostream>
+
+#include <sys/stat.h>
+
+struct dcmHelpersStudyModules::Modules {
+  // DCMTK objects are not safe for concurrent use, not even for reading
+  std::mutex mutex;
+  DcmDataset dataset;
+  long long size;
+  long long modified;
+};
+
+dcmHelpersStudyModules::dcmHelpersStudyModules(size_t maxSources) :
+  maxSources(maxSources ? maxSources : 1), hits(0), misses(0){
+}
+
+void dcmHelpersStudyModules::copy(const std::string &sourcePath, DcmDataset *source, DcmDataset *dataset){
+  struct stat st;
+  if(sourcePath.empty() || stat(sourcePath.c_str(), &st)){
+    dcmHelpersCommon::copyPatientModule(source, dataset);
+    dcmHelpersCommon::copyPatientStudyModule(source, dataset);
+    dcmHelpersCommon::copyGeneralStudyModule(source, dataset);
+    return;
+  }
+
+  std::string key = dcmHelpersCommon::canonicalPath(sourcePath);
+  std::shared_ptr<Modules> modules;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::map<std::string, std::shared_ptr<Modules> >::const_iterator it = sources.find(key);
+    if(it != sources.end() && it->second->size == st.st_size && it->second->modified == st.st_mtime){
+      modules = it->second;
+      hits++;
+    }
+  }
+
+  if(!modules){
+    std::shared_ptr<Modules> built(new Modules());
+    built->size = st.st_size;
+    built->modified = st.st_mtime;
+    dcmHelpersCommon::copyPatientModule(source, &built->dataset);
+    dcmHelpersCommon::copyPatientStudyModule(source, &built->dataset);
+    dcmHelpersCommon::copyGeneralStudyModule(source, &built->dataset);
+
+    // another report of the source may have added its set meanwhile; a set of
+    //  a previous version of the file is replaced
+    std::lock_guard<std::mutex> lock(mutex);
+    std::map<std::string, std::shared_ptr<Modules> >::iterator it = sources.find(key);
+    if(it != sources.end() && it->second->size == built->size && it->second->modified == built->modified){
+      modules = it->second;
+      hits++;
+    } else {
+      if(it == sources.end())
+        order.push_back(key);
+      // reports being built keep a replaced set alive
+      sources[key] = built;
+      modules = built;
+      misses++;
+      while(order.size() > maxSources){
+        sources.erase(order.front());
+        order.pop_front();
+      }
+    }
+  }
+
+  std::lock_guard<std::mutex> lock(modules->mutex);
+  for(unsigned long i=0;i<modules->dataset.card();i++){
+    DcmElement *element = OFstatic_cast(DcmElement*, modules->dataset.getElement(i)->clone());
+    if(dataset->insert(element, true).bad())
+      delete element;
+  }
+}
+
+void dcmHelpersStudyModules::printStatistics(std::ostream &out) const {
+  std::lock_guard<std::mutex> lock(mutex);
+  out << "Study modules: " << sources.size() << " source files, " << hits << " reports from the cache, "
+      << misses << " copied from a source" << std::endl;
+}
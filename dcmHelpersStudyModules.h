@@ -0,0 +1,48 @@
+#ifndef __dcmHelpersStudyModules_h
+#define __dcmHelpersStudyModules_h
+
+#include <deque>
+#include <iosfwd>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+class DcmDataset;
+
+// Patient, Patient Study and General Study module attributes shared by the
+// reports made from the same source file. The attributes are copied from the
+// source dataset once per file into a reference counted set, which is keyed on
+// the file's canonical path and rebuilt when its size or modification time
+// changes, so that a source sent again with corrected demographics is not
+// shadowed by the set of its previous version. The set is not changed after
+// it is built and never becomes part of a report. Each report receives fresh
+// copies of its elements, so that a report owns all of its elements: reports
+// may be written concurrently and outlive the set. This saves looking up each
+// module attribute in the source, not allocations.
+class dcmHelpersStudyModules {
+  public:
+    explicit dcmHelpersStudyModules(size_t maxSources = 256);
+
+    // copy the module attributes of source, read from sourcePath, into
+    //  dataset, replacing those present; they are copied from source itself
+    //  if the file cannot be found
+    void copy(const std::string &sourcePath, DcmDataset *source, DcmDataset *dataset);
+
+    void printStatistics(std::ostream&) const;
+
+  private:
+    dcmHelpersStudyModules(const dcmHelpersStudyModules&);
+    dcmHelpersStudyModules& operator=(const dcmHelpersStudyModules&);
+
+    struct Modules;
+
+    size_t maxSources;
+    mutable std::mutex mutex;
+    std::map<std::string, std::shared_ptr<Modules> > sources;
+    // oldest first
+    std::deque<std::string> order;
+    unsigned long hits, misses;
+};
+
+#endif
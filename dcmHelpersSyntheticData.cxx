@@ -0,0 +1,403 @@
+#include "dcmHelpersSyntheticData.h"
+#include "dcmtk/config/osconfig.h"
+#include "dcmtk/dcmdata/dctk.h"
+#include "dcmtk/dcmdata/dcrleerg.h"
+#include "dcmtk/dcmjpeg/djencode.h"
+#include "dcmtk/dcmjpls/djencode.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <iostream>
+
+namespace {
+
+// small deterministic generator, so that the data is identical for a seed
+class Random {
+  public:
+    Random(unsigned seed) : state(seed * 2654435761UL + 1) {}
+    unsigned next(){
+      state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+      return unsigned(state >> 33);
+    }
+  private:
+    unsigned long long state;
+};
+
+struct Series {
+  std::string studyInstanceUID, seriesInstanceUID, frameOfReferenceUID;
+  std::vector<std::string> sopInstanceUIDs;
+  std::vector<std::string> sopClassUIDs;
+};
+
+const double PIXEL_SPACING = 0.7;
+const double SLICE_THICKNESS = 1.25;
+
+std::string newUID(const char *root){
+  char uid[100];
+  dcmGenerateUniqueIdentifier(uid, root);
+  return uid;
+}
+
+std::string formatDS(double value){
+  char str[32];
+  sprintf(str, "%.6g", value);
+  return str;
+}
+
+std::string formatIS(unsigned long value){
+  char str[32];
+  sprintf(str, "%lu", value);
+  return str;
+}
+
+std::string positionOfSlice(const dcmHelpersSyntheticData::Options &options, unsigned slice){
+  return formatDS(-PIXEL_SPACING * options.columns / 2) + "\\" +
+         formatDS(-PIXEL_SPACING * options.rows / 2) + "\\" +
+         formatDS(-SLICE_THICKNESS * slice);
+}
+
+void putPatientAndStudy(DcmDataset *dataset, const Series &series){
+  dataset->putAndInsertString(DCM_PatientName, "Synthetic^Phantom");
+  dataset->putAndInsertString(DCM_PatientID, "SRBENCH");
+  dataset->putAndInsertString(DCM_PatientBirthDate, "19700101");
+  dataset->putAndInsertString(DCM_PatientSex, "O");
+  dataset->putAndInsertString(DCM_StudyInstanceUID, series.studyInstanceUID.c_str());
+  dataset->putAndInsertString(DCM_StudyDate, "20140311");
+  dataset->putAndInsertString(DCM_StudyTime, "120000");
+  dataset->putAndInsertString(DCM_StudyID, "1");
+  dataset->putAndInsertString(DCM_AccessionNumber, "SRBENCH1");
+  dataset->putAndInsertString(DCM_ReferringPhysicianName, "");
+
+  // sequences as found in clinical headers, repeated in every report of the study
+  DcmItem *item;
+  const char *otherIDs[] = {"SRBENCH-A", "SRBENCH-B"};
+  for(int i=0;i<2;i++)
+    if(dataset->findOrCreateSequenceItem(DCM_OtherPatientIDsSequence, item, i).good()){
+      item->putAndInsertString(DCM_PatientID, otherIDs[i]);
+      item->putAndInsertString(DCM_IssuerOfPatientID, "SRBENCH");
+      item->putAndInsertString(DCM_TypeOfPatientID, "TEXT");
+    }
+  if(dataset->findOrCreateSequenceItem(DCM_ProcedureCodeSequence, item, 0).good()){
+    item->putAndInsertString(DCM_CodeValue, "25045-6");
+    item->putAndInsertString(DCM_CodingSchemeDesignator, "LN");
+    item->putAndInsertString(DCM_CodeMeaning, "CT unspecified body region");
+  }
+
+  dataset->putAndInsertString(DCM_Manufacturer, "QIICR");
+  dataset->putAndInsertString(DCM_FrameOfReferenceUID, series.frameOfReferenceUID.c_str());
+  dataset->putAndInsertString(DCM_PositionReferenceIndicator, "");
+}
+
+// PackBits encoding of one RLE segment (PS3.5 G.3.1), padded to an even length
+void encodeRLESegment(const Uint8 *data, size_t length, std::vector<Uint8> &out){
+  size_t i = 0;
+  while(i < length){
+    size_t run = 1;
+    while(i + run < length && run < 128 && data[i + run] == data[i])
+      run++;
+    if(run > 1){
+      out.push_back(Uint8(257 - run));
+      out.push_back(data[i]);
+      i += run;
+      continue;
+    }
+    // literal bytes up to the next replicate run
+    size_t start = i;
+    while(i < length && i - start < 128 && !(i + 1 < length && data[i + 1] == data[i]))
+      i++;
+    out.push_back(Uint8(i - start - 1));
+    out.insert(out.end(), data + start, data + i);
+  }
+  if(out.size() % 2)
+    out.push_back(0);
+}
+
+// RLE Lossless frame of one byte per sample: the 64 byte header, then one segment
+void encodeRLEFrame(const std::vector<Uint8> &frame, std::vector<Uint8> &out){
+  out.assign(64, 0);
+  out[0] = 1;
+  out[4] = 64;
+  encodeRLESegment(&frame[0], frame.size(), out);
+}
+
+// CT values in HU of an elliptic body with noise, stored with intercept -1024
+void fillSlice(const dcmHelpersSyntheticData::Options &options, unsigned slice, Random &random, Uint16 *pixels){
+  double cz = (slice + 0.5) / options.slices - 0.5;
+  for(unsigned y=0;y<options.rows;y++){
+    double dy = (y + 0.5) / options.rows - 0.5;
+    for(unsigned x=0;x<options.columns;x++){
+      double dx = (x + 0.5) / options.columns - 0.5;
+      double r = dx*dx/0.16 + dy*dy/0.1 + cz*cz/0.3;
+      int hu = r < 1 ? 40 + int(random.next() % 41) - 20 : -1000;
+      *pixels++ = Uint16(hu + 1024);
+    }
+  }
+}
+
+bool writeCT(const dcmHelpersSyntheticData::Options &options, const std::string &path, Series &series,
+             unsigned firstSlice, unsigned numberOfFrames, unsigned instanceNumber, Random &random){
+  DcmFileFormat fileFormat;
+  DcmDataset *dataset = fileFormat.getDataset();
+  bool enhanced = options.framesPerFile > 1;
+  const char *sopClassUID = enhanced ? UID_EnhancedCTImageStorage : UID_CTImageStorage;
+  std::string sopInstanceUID = newUID(SITE_INSTANCE_UID_ROOT);
+
+  putPatientAndStudy(dataset, series);
+  dataset->putAndInsertString(DCM_SOPClassUID, sopClassUID);
+  dataset->putAndInsertString(DCM_SOPInstanceUID, sopInstanceUID.c_str());
+  dataset->putAndInsertString(DCM_Modality, "CT");
+  dataset->putAndInsertString(DCM_SeriesInstanceUID, series.seriesInstanceUID.c_str());
+  dataset->putAndInsertString(DCM_SeriesNumber, "1");
+  dataset->putAndInsertString(DCM_SeriesDescription, "Synthetic phantom");
+  dataset->putAndInsertString(DCM_InstanceNumber, formatIS(instanceNumber).c_str());
+  dataset->putAndInsertString(DCM_ImageType, "ORIGINAL\\PRIMARY\\AXIAL");
+  dataset->putAndInsertUint16(DCM_SamplesPerPixel, 1);
+  dataset->putAndInsertString(DCM_PhotometricInterpretation, "MONOCHROME2");
+  dataset->putAndInsertUint16(DCM_Rows, options.rows);
+  dataset->putAndInsertUint16(DCM_Columns, options.columns);
+  dataset->putAndInsertUint16(DCM_BitsAllocated, 16);
+  dataset->putAndInsertUint16(DCM_BitsStored, 12);
+  dataset->putAndInsertUint16(DCM_HighBit, 11);
+  dataset->putAndInsertUint16(DCM_PixelRepresentation, 0);
+
+  const std::string orientation = "1\\0\\0\\0\\1\\0";
+  const std::string spacing = formatDS(PIXEL_SPACING) + "\\" + formatDS(PIXEL_SPACING);
+  if(!enhanced){
+    dataset->putAndInsertString(DCM_ImagePositionPatient, positionOfSlice(options, firstSlice).c_str());
+    dataset->putAndInsertString(DCM_ImageOrientationPatient, orientation.c_str());
+    dataset->putAndInsertString(DCM_PixelSpacing, spacing.c_str());
+    dataset->putAndInsertString(DCM_SliceThickness, formatDS(SLICE_THICKNESS).c_str());
+    dataset->putAndInsertString(DCM_RescaleIntercept, "-1024");
+    dataset->putAndInsertString(DCM_RescaleSlope, "1");
+    dataset->putAndInsertString(DCM_RescaleType, "HU");
+  } else {
+    DcmItem *shared, *item;
+    dataset->putAndInsertString(DCM_NumberOfFrames, formatIS(numberOfFrames).c_str());
+    dataset->findOrCreateSequenceItem(DCM_SharedFunctionalGroupsSequence, shared, 0);
+    shared->findOrCreateSequenceItem(DCM_PixelMeasuresSequence, item, 0);
+    item->putAndInsertString(DCM_PixelSpacing, spacing.c_str());
+    item->putAndInsertString(DCM_SliceThickness, formatDS(SLICE_THICKNESS).c_str());
+    shared->findOrCreateSequenceItem(DCM_PlaneOrientationSequence, item, 0);
+    item->putAndInsertString(DCM_ImageOrientationPatient, orientation.c_str());
+    shared->findOrCreateSequenceItem(DCM_PixelValueTransformationSequence, item, 0);
+    item->putAndInsertString(DCM_RescaleIntercept, "-1024");
+    item->putAndInsertString(DCM_RescaleSlope, "1");
+    item->putAndInsertString(DCM_RescaleType, "HU");
+    for(unsigned f=0;f<numberOfFrames;f++){
+      DcmItem *perFrame;
+      dataset->findOrCreateSequenceItem(DCM_PerFrameFunctionalGroupsSequence, perFrame, -2);
+      perFrame->findOrCreateSequenceItem(DCM_PlanePositionSequence, item, 0);
+      item->putAndInsertString(DCM_ImagePositionPatient, positionOfSlice(options, firstSlice + f).c_str());
+    }
+  }
+
+  size_t framePixels = size_t(options.rows) * options.columns;
+  std::vector<Uint16> pixels(framePixels * numberOfFrames);
+  for(unsigned f=0;f<numberOfFrames;f++)
+    fillSlice(options, firstSlice + f, random, &pixels[f * framePixels]);
+  dataset->putAndInsertUint16Array(DCM_PixelData, &pixels[0], pixels.size());
+
+  E_TransferSyntax xfer = EXS_LittleEndianExplicit;
+  if(options.transferSyntax == "rle")
+    xfer = EXS_RLELossless;
+  else if(options.transferSyntax == "jpeg-ls")
+    xfer = EXS_JPEGLSLossless;
+  else if(options.transferSyntax == "jpeg-lossless")
+    xfer = EXS_JPEGProcess14SV1;
+  else if(options.transferSyntax != "native"){
+    std::cerr << "Unknown transfer syntax " << options.transferSyntax << std::endl;
+    return false;
+  }
+  if(xfer != EXS_LittleEndianExplicit && dataset->chooseRepresentation(xfer, NULL).bad()){
+    std::cerr << "Failed to encode " << path << " as " << options.transferSyntax << std::endl;
+    return false;
+  }
+  OFCondition cond = fileFormat.saveFile(path.c_str(), xfer);
+  if(cond.bad()){
+    std::cerr << "Failed to write " << path << ": " << cond.text() << std::endl;
+    return false;
+  }
+
+  for(unsigned f=0;f<numberOfFrames;f++){
+    series.sopInstanceUIDs.push_back(sopInstanceUID);
+    series.sopClassUIDs.push_back(sopClassUID);
+  }
+  return true;
+}
+
+bool writeSEG(const dcmHelpersSyntheticData::Options &options, const std::string &path, const Series &ct){
+  DcmFileFormat fileFormat;
+  DcmDataset *dataset = fileFormat.getDataset();
+  bool enhanced = options.framesPerFile > 1;
+  bool rle = options.segTransferSyntax == "rle";
+  if(!rle && options.segTransferSyntax != "native"){
+    std::cerr << "Unknown segmentation transfer syntax " << options.segTransferSyntax << std::endl;
+    return false;
+  }
+
+  putPatientAndStudy(dataset, ct);
+  dataset->putAndInsertString(DCM_SOPClassUID, UID_SegmentationStorage);
+  dataset->putAndInsertString(DCM_SOPInstanceUID, newUID(SITE_INSTANCE_UID_ROOT).c_str());
+  dataset->putAndInsertString(DCM_Modality, "SEG");
+  dataset->putAndInsertString(DCM_SeriesInstanceUID, newUID(SITE_SERIES_UID_ROOT).c_str());
+  dataset->putAndInsertString(DCM_SeriesNumber, "100");
+  dataset->putAndInsertString(DCM_InstanceNumber, "1");
+  dataset->putAndInsertString(DCM_ImageType, "DERIVED\\PRIMARY");
+  dataset->putAndInsertString(DCM_ContentLabel, "SYNTHETIC");
+  dataset->putAndInsertString(DCM_SegmentationType, "BINARY");
+  dataset->putAndInsertUint16(DCM_SamplesPerPixel, 1);
+  dataset->putAndInsertString(DCM_PhotometricInterpretation, "MONOCHROME2");
+  dataset->putAndInsertUint16(DCM_Rows, options.rows);
+  dataset->putAndInsertUint16(DCM_Columns, options.columns);
+  dataset->putAndInsertUint16(DCM_BitsAllocated, 1);
+  dataset->putAndInsertUint16(DCM_BitsStored, 1);
+  dataset->putAndInsertUint16(DCM_HighBit, 0);
+  dataset->putAndInsertUint16(DCM_PixelRepresentation, 0);
+  dataset->putAndInsertString(DCM_LossyImageCompression, "00");
+
+  DcmItem *item, *subitem;
+  dataset->findOrCreateSequenceItem(DCM_ReferencedSeriesSequence, item, 0);
+  item->putAndInsertString(DCM_SeriesInstanceUID, ct.seriesInstanceUID.c_str());
+  for(size_t i=0;i<ct.sopInstanceUIDs.size();i++){
+    if(i && ct.sopInstanceUIDs[i] == ct.sopInstanceUIDs[i-1])
+      continue;
+    item->findOrCreateSequenceItem(DCM_ReferencedInstanceSequence, subitem, -2);
+    subitem->putAndInsertString(DCM_ReferencedSOPClassUID, ct.sopClassUIDs[i].c_str());
+    subitem->putAndInsertString(DCM_ReferencedSOPInstanceUID, ct.sopInstanceUIDs[i].c_str());
+  }
+
+  dataset->findOrCreateSequenceItem(DCM_SharedFunctionalGroupsSequence, item, 0);
+  item->findOrCreateSequenceItem(DCM_PixelMeasuresSequence, subitem, 0);
+  subitem->putAndInsertString(DCM_PixelSpacing, (formatDS(PIXEL_SPACING) + "\\" + formatDS(PIXEL_SPACING)).c_str());
+  subitem->putAndInsertString(DCM_SliceThickness, formatDS(SLICE_THICKNESS).c_str());
+  item->findOrCreateSequenceItem(DCM_PlaneOrientationSequence, subitem, 0);
+  subitem->putAndInsertString(DCM_ImageOrientationPatient, "1\\0\\0\\0\\1\\0");
+
+  unsigned coveredSlices = std::max(1u, std::min(options.slices, unsigned(options.sparsity * options.slices + 0.5)));
+  size_t framePixels = size_t(options.rows) * options.columns;
+  std::vector<Uint8> bits, frameBits((framePixels + 7) / 8), encoded;
+  unsigned long numberOfFrames = 0;
+
+  // encapsulated frames start on a byte each; DCMTK's RLE encoder does not
+  //  take 1 bit pixels, so they are encoded here
+  DcmPixelSequence *pixelSequence = NULL;
+  DcmOffsetList offsets;
+  if(rle){
+    pixelSequence = new DcmPixelSequence(DcmTag(DCM_PixelData, EVR_OB));
+    pixelSequence->insert(new DcmPixelItem(DcmTag(DCM_Item, EVR_OB)));
+  }
+  for(unsigned segment=1;segment<=options.segments;segment++){
+    dataset->findOrCreateSequenceItem(DCM_SegmentSequence, item, -2);
+    item->putAndInsertUint16(DCM_SegmentNumber, segment);
+    item->putAndInsertString(DCM_SegmentLabel, ("Segment " + formatIS(segment)).c_str());
+    item->putAndInsertString(DCM_SegmentAlgorithmType, "MANUAL");
+    item->findOrCreateSequenceItem(DCM_SegmentedPropertyCategoryCodeSequence, subitem, 0);
+    subitem->putAndInsertString(DCM_CodeValue, "T-D0050");
+    subitem->putAndInsertString(DCM_CodingSchemeDesignator, "SRT");
+    subitem->putAndInsertString(DCM_CodeMeaning, "Tissue");
+    item->findOrCreateSequenceItem(DCM_SegmentedPropertyTypeCodeSequence, subitem, 0);
+    subitem->putAndInsertString(DCM_CodeValue, "M-03000");
+    subitem->putAndInsertString(DCM_CodingSchemeDesignator, "SRT");
+    subitem->putAndInsertString(DCM_CodeMeaning, "Mass");
+
+    // segments are spread along the volume and overlap when they do not fit
+    unsigned firstSlice = std::min((segment - 1) * options.slices / options.segments,
+                                   options.slices - coveredSlices);
+    double cx = options.columns * (0.3 + 0.4 * (segment % 5) / 4.), cy = options.rows * 0.5;
+    double radius = std::min(options.rows, options.columns) / 10.;
+    for(unsigned slice=firstSlice;slice<firstSlice+coveredSlices;slice++){
+      DcmItem *perFrame;
+      dataset->findOrCreateSequenceItem(DCM_PerFrameFunctionalGroupsSequence, perFrame, -2);
+      perFrame->findOrCreateSequenceItem(DCM_SegmentIdentificationSequence, item, 0);
+      item->putAndInsertUint16(DCM_ReferencedSegmentNumber, segment);
+      perFrame->findOrCreateSequenceItem(DCM_PlanePositionSequence, item, 0);
+      item->putAndInsertString(DCM_ImagePositionPatient, positionOfSlice(options, slice).c_str());
+      perFrame->findOrCreateSequenceItem(DCM_DerivationImageSequence, item, 0);
+      item->findOrCreateSequenceItem(DCM_SourceImageSequence, subitem, 0);
+      subitem->putAndInsertString(DCM_ReferencedSOPClassUID, ct.sopClassUIDs[slice].c_str());
+      subitem->putAndInsertString(DCM_ReferencedSOPInstanceUID, ct.sopInstanceUIDs[slice].c_str());
+      if(enhanced)
+        subitem->putAndInsertString(DCM_ReferencedFrameNumber, formatIS(slice % options.framesPerFile + 1).c_str());
+
+      // native frames are packed without padding, the first pixel in the least
+      //  significant bit
+      std::fill(frameBits.begin(), frameBits.end(), 0);
+      size_t bit = rle ? 0 : numberOfFrames * framePixels;
+      std::vector<Uint8> &target = rle ? frameBits : bits;
+      if(!rle)
+        bits.resize(((numberOfFrames + 1) * framePixels + 7) / 8, 0);
+      for(unsigned y=0;y<options.rows;y++)
+        for(unsigned x=0;x<options.columns;x++,bit++)
+          if((x - cx)*(x - cx) + (y - cy)*(y - cy) < radius*radius)
+            target[bit >> 3] |= Uint8(1 << (bit & 7));
+      if(rle){
+        encodeRLEFrame(frameBits, encoded);
+        pixelSequence->storeCompressedFrame(offsets, &encoded[0], encoded.size(), 0);
+      }
+      numberOfFrames++;
+    }
+  }
+  dataset->putAndInsertString(DCM_NumberOfFrames, formatIS(numberOfFrames).c_str());
+  if(rle){
+    DcmPixelItem *offsetTable = NULL;
+    pixelSequence->getItem(offsetTable, 0);
+    offsetTable->createOffsetTable(offsets);
+    DcmPixelData *pixelData = new DcmPixelData(DCM_PixelData);
+    pixelData->putOriginalRepresentation(EXS_RLELossless, NULL, pixelSequence);
+    dataset->insert(pixelData, OFTrue);
+  } else {
+    if(bits.size() % 2)
+      bits.push_back(0);
+    dataset->putAndInsertUint8Array(DCM_PixelData, &bits[0], bits.size());
+  }
+
+  OFCondition cond = fileFormat.saveFile(path.c_str(), rle ? EXS_RLELossless : EXS_LittleEndianExplicit);
+  if(cond.bad()){
+    std::cerr << "Failed to write " << path << ": " << cond.text() << std::endl;
+    return false;
+  }
+  return true;
+}
+
+}
+
+void dcmHelpersSyntheticData::registerCodecs(){
+  DJEncoderRegistration::registerCodecs();
+  DJLSEncoderRegistration::registerCodecs();
+  DcmRLEEncoderRegistration::registerCodecs();
+}
+
+void dcmHelpersSyntheticData::cleanupCodecs(){
+  DJEncoderRegistration::cleanup();
+  DJLSEncoderRegistration::cleanup();
+  DcmRLEEncoderRegistration::cleanup();
+}
+
+bool dcmHelpersSyntheticData::generate(const Options &options, const std::string &directory,
+                                       std::vector<std::string> &ctFiles, std::string &segFile){
+  if(!options.slices || !options.framesPerFile || !options.rows || !options.columns || !options.segments){
+    std::cerr << "Synthetic data needs at least one slice, frame, row, column and segment" << std::endl;
+    return false;
+  }
+
+  Series ct;
+  ct.studyInstanceUID = newUID(SITE_STUDY_UID_ROOT);
+  ct.seriesInstanceUID = newUID(SITE_SERIES_UID_ROOT);
+  ct.frameOfReferenceUID = newUID(SITE_INSTANCE_UID_ROOT);
+
+  Random random(options.seed);
+  ctFiles.clear();
+  for(unsigned slice=0;slice<options.slices;slice+=options.framesPerFile){
+    char name[32];
+    sprintf(name, "ct_%05u.dcm", unsigned(ctFiles.size()) + 1);
+    std::string path = directory + "/" + name;
+    unsigned numberOfFrames = std::min(options.framesPerFile, options.slices - slice);
+    if(!writeCT(options, path, ct, slice, numberOfFrames, ctFiles.size() + 1, random))
+      return false;
+    ctFiles.push_back(path);
+  }
+
+  segFile = directory + "/seg.dcm";
+  return writeSEG(options, segFile, ct);
+}
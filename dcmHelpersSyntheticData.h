@@ -0,0 +1,40 @@
+#ifndef __dcmHelpersSyntheticData_h
+#define __dcmHelpersSyntheticData_h
+
+#include <string>
+#include <vector>
+
+// Synthetic CT series and segmentations for benchmarks, generated offline.
+// The CT volume is an elliptic phantom with noise, written as one file per
+// slice or as enhanced CT objects with several frames per file. The SEG is
+// BINARY with one frame per segment and covered slice, native or RLE; each
+// segment covers a contiguous range of slices given by the sparsity.
+class dcmHelpersSyntheticData {
+  public:
+    struct Options {
+      Options() : slices(100), framesPerFile(1), rows(512), columns(512), segments(1),
+        sparsity(0.2), transferSyntax("native"), segTransferSyntax("native"), seed(1) {}
+      unsigned slices;
+      // 1 writes CT Image Storage, more writes Enhanced CT Image Storage
+      unsigned framesPerFile;
+      unsigned short rows, columns;
+      unsigned segments;
+      // fraction of the slices covered by each segment
+      double sparsity;
+      // of the CT: native, rle, jpeg-ls or jpeg-lossless
+      std::string transferSyntax;
+      // of the SEG: native or rle
+      std::string segTransferSyntax;
+      unsigned seed;
+    };
+
+    // encoders for the compressed transfer syntaxes
+    static void registerCodecs();
+    static void cleanupCodecs();
+
+    // writes ct_NNNNN.dcm and seg.dcm to an existing directory
+    static bool generate(const Options&, const std::string &directory,
+                         std::vector<std::string> &ctFiles, std::string &segFile);
+};
+
+#endif
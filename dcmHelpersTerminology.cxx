@@ -0,0 +1,113 @@
+#include "dcmHelpersTerminology.h"
+#include "dcmtk/config/osconfig.h"
+#include "dcmtk/dcmsr/dsrcodvl.h"
+
+#include <vector>
+
+namespace {
+
+struct Entry {
+  const char *value;
+  const char *scheme;
+  const char *meaning;
+  unsigned contextGroup;
+};
+
+constexpr Entry entries[] = {
+#define DCMHELPERS_TERMINOLOGY_ENTRY(name, value, scheme, meaning, cid) { value, scheme, meaning, cid },
+  DCMHELPERS_TERMINOLOGY(DCMHELPERS_TERMINOLOGY_ENTRY)
+#undef DCMHELPERS_TERMINOLOGY_ENTRY
+};
+
+// compile-time checks of the table, written as C++11 constexpr recursions
+
+constexpr unsigned length(const char *s){
+  return *s ? 1 + length(s+1) : 0;
+}
+
+constexpr bool equal(const char *a, const char *b){
+  return *a == *b && (!*a || equal(a+1, b+1));
+}
+
+constexpr bool isDigit(char c){
+  return c >= '0' && c <= '9';
+}
+
+constexpr bool allDigits(const char *s){
+  return !*s || (isDigit(*s) && allDigits(s+1));
+}
+
+// SNOMED-RT style codes, e.g. R-00317
+constexpr bool isSRTCode(const char *s){
+  return length(s) == 7 && s[0] >= 'A' && s[0] <= 'Z' && s[1] == '-';
+}
+
+constexpr bool noSeparator(const char *s){
+  return !*s || (*s != '\\' && noSeparator(s+1));
+}
+
+// Code Value is SH (16 characters), Code Meaning is LO (64 characters)
+constexpr bool validText(const char *s, unsigned maxLength){
+  return length(s) > 0 && length(s) <= maxLength && noSeparator(s);
+}
+
+constexpr bool validCode(const Entry &e){
+  return validText(e.value, 16) && validText(e.meaning, 64) &&
+         (equal(e.scheme, "DCM") ? allDigits(e.value) :
+          equal(e.scheme, "99QIICR") ? allDigits(e.value) :
+          equal(e.scheme, "SRT") ? isSRTCode(e.value) :
+          equal(e.scheme, "UCUM") || equal(e.scheme, "RFC3066") || equal(e.scheme, "ISO3166_1"));
+}
+
+constexpr bool sameCode(const Entry &a, const Entry &b){
+  return equal(a.value, b.value) && equal(a.scheme, b.scheme);
+}
+
+constexpr unsigned numberOfEntries = sizeof(entries) / sizeof(entries[0]);
+
+// no entry after i has the code of entry i
+constexpr bool uniqueFrom(unsigned i, unsigned j){
+  return j >= numberOfEntries || (!sameCode(entries[i], entries[j]) && uniqueFrom(i, j+1));
+}
+
+constexpr bool allValid(unsigned i){
+  return i >= numberOfEntries || (validCode(entries[i]) && uniqueFrom(i, i+1) && allValid(i+1));
+}
+
+static_assert(numberOfEntries == dcmHelpersTerminology::NumberOfCodes,
+              "terminology table and codes differ");
+static_assert(allValid(0), "invalid or duplicate code in DCMHELPERS_TERMINOLOGY");
+
+const std::vector<DSRCodedEntryValue>& codedEntries(){
+  // built once, on first use; initialization of local statics is thread-safe
+  static const std::vector<DSRCodedEntryValue> codes = []{
+    std::vector<DSRCodedEntryValue> codes;
+    codes.reserve(numberOfEntries);
+    for(unsigned i=0;i<numberOfEntries;i++)
+      codes.push_back(DSRCodedEntryValue(entries[i].value, entries[i].scheme, entries[i].meaning));
+    return codes;
+  }();
+  return codes;
+}
+
+}
+
+const DSRCodedEntryValue& dcmHelpersTerminology::get(Code code){
+  return codedEntries()[code];
+}
+
+const char* dcmHelpersTerminology::getValue(Code code){
+  return entries[code].value;
+}
+
+const char* dcmHelpersTerminology::getScheme(Code code){
+  return entries[code].scheme;
+}
+
+const char* dcmHelpersTerminology::getMeaning(Code code){
+  return entries[code].meaning;
+}
+
+unsigned dcmHelpersTerminology::getContextGroup(Code code){
+  return entries[code].contextGroup;
+}
@@ -0,0 +1,88 @@
+#ifndef __dcmHelpersTerminology_h
+#define __dcmHelpersTerminology_h
+
+class DSRCodedEntryValue;
+
+// Coded concepts used by the helpers:
+//  X(name, code value, coding scheme designator, code meaning, context group)
+// The context group is the CID the code is selected from, or 0 for concept
+// names that are fixed by their template. The entries are checked at compile
+// time (see dcmHelpersTerminology.cxx).
+#define DCMHELPERS_TERMINOLOGY(X) \
+  X(QuantitativeMeasurementReport, "10001",   "99QIICR",   "Quantitative measurement report", 0) \
+  X(ImageLibrary,                  "111028",  "DCM",       "Image Library", 0) \
+  X(Findings,                      "121070",  "DCM",       "Findings", 0) \
+  X(MeasurementGroup,              "125007",  "DCM",       "Measurement Group", 0) \
+  X(TrackingIdentifier,            "112039",  "DCM",       "Tracking Identifier", 0) \
+  X(TrackingUniqueIdentifier,      "112040",  "DCM",       "Tracking Unique Identifier", 0) \
+  X(ReferencedSegment,             "121191",  "DCM",       "Referenced Segment", 0) \
+  X(SourceSeriesForSegmentation,   "121232",  "DCM",       "Source series for segmentation", 0) \
+  X(SourceImageForSegmentation,    "121233",  "DCM",       "Source image for segmentation", 0) \
+  X(AttenuationCoefficient,        "112031",  "DCM",       "Attenuation Coefficient", 7180) \
+  X(ImageIntensity,                "10002",   "99QIICR",   "Image intensity", 0) \
+  X(Derivation,                    "121401",  "DCM",       "Derivation", 0) \
+  X(Mean,                          "R-00317", "SRT",       "Mean", 7464) \
+  X(LanguageOfContent,             "121049",  "DCM",       "Language of Content Item and Descendants", 0) \
+  X(CountryOfLanguage,             "121046",  "DCM",       "Country of Language", 0) \
+  X(English,                       "eng",     "RFC3066",   "English", 5000) \
+  X(UnitedStates,                  "US",      "ISO3166_1", "United States", 5001) \
+  X(ObserverType,                  "121005",  "DCM",       "Observer Type", 0) \
+  X(Device,                        "121007",  "DCM",       "Device", 270) \
+  X(DeviceObserverUID,             "121012",  "DCM",       "Device Observer UID", 0) \
+  X(DeviceObserverName,            "121013",  "DCM",       "Device Observer Name", 0) \
+  X(DeviceObserverManufacturer,    "121014",  "DCM",       "Device Observer Manufacturer", 0) \
+  X(DeviceObserverModelName,       "121015",  "DCM",       "Device Observer Model Name", 0) \
+  X(DeviceObserverSerialNumber,    "121016",  "DCM",       "Device Observer Serial Number", 0) \
+  X(ImageLaterality,               "111027",  "DCM",       "Image Laterality", 0) \
+  X(ImageView,                     "111031",  "DCM",       "Image View", 0) \
+  X(ImageViewModifier,             "111032",  "DCM",       "Image View Modifier", 0) \
+  X(PatientOrientationRow,         "111044",  "DCM",       "Patient Orientation Row", 0) \
+  X(PatientOrientationColumn,      "111043",  "DCM",       "Patient Orientation Column", 0) \
+  X(StudyDate,                     "111060",  "DCM",       "Study Date", 0) \
+  X(StudyTime,                     "111061",  "DCM",       "Study Time", 0) \
+  X(ContentDate,                   "111018",  "DCM",       "Content Date", 0) \
+  X(ContentTime,                   "111019",  "DCM",       "Content Time", 0) \
+  X(HorizontalPixelSpacing,        "111026",  "DCM",       "Horizontal Pixel Spacing", 0) \
+  X(VerticalPixelSpacing,          "111066",  "DCM",       "Vertical Pixel Spacing", 0) \
+  X(PositionerPrimaryAngle,        "112011",  "DCM",       "Positioner Primary Angle", 0) \
+  X(PositionerSecondaryAngle,      "112012",  "DCM",       "Positioner Secondary Angle", 0) \
+  X(SliceThickness,                "112225",  "DCM",       "Slice Thickness", 0) \
+  X(FrameOfReferenceUID,           "112227",  "DCM",       "Frame of Reference UID", 0) \
+  X(ImagePositionX,                "110901",  "DCM",       "Image Position (Patient) X", 0) \
+  X(ImagePositionY,                "110902",  "DCM",       "Image Position (Patient) Y", 0) \
+  X(ImagePositionZ,                "110903",  "DCM",       "Image Position (Patient) Z", 0) \
+  X(ImageOrientationRowX,          "110904",  "DCM",       "Image Orientation (Patient) Row X", 0) \
+  X(ImageOrientationRowY,          "110905",  "DCM",       "Image Orientation (Patient) Row Y", 0) \
+  X(ImageOrientationRowZ,          "110906",  "DCM",       "Image Orientation (Patient) Row Z", 0) \
+  X(ImageOrientationColumnX,       "110907",  "DCM",       "Image Orientation (Patient) Column X", 0) \
+  X(ImageOrientationColumnY,       "110908",  "DCM",       "Image Orientation (Patient) Column Y", 0) \
+  X(ImageOrientationColumnZ,       "110909",  "DCM",       "Image Orientation (Patient) Column Z", 0) \
+  X(PixelDataRows,                 "110910",  "DCM",       "Pixel Data Rows", 0) \
+  X(PixelDataColumns,              "110911",  "DCM",       "Pixel Data Columns", 0) \
+  X(UnitMillimeter,                "mm",      "UCUM",      "millimeter", 82) \
+  X(UnitDegree,                    "deg",     "UCUM",      "degrees of plane angle", 82) \
+  X(UnitMinusOneToOne,             "{-1:1}",  "UCUM",      "{-1:1}", 82) \
+  X(UnitPixels,                    "{pixels}","UCUM",      "pixels", 82) \
+  X(UnitHounsfield,                "[hnsf'U]","UCUM",      "Hounsfield unit", 82) \
+  X(UnitNoUnits,                   "1",       "UCUM",      "no units", 82)
+
+// Interned coded entries: each concept of the table above is constructed once
+// per process and then shared by all the reports.
+class dcmHelpersTerminology {
+  public:
+    enum Code {
+#define DCMHELPERS_TERMINOLOGY_ENUM(name, value, scheme, meaning, cid) CODE_##name,
+      DCMHELPERS_TERMINOLOGY(DCMHELPERS_TERMINOLOGY_ENUM)
+#undef DCMHELPERS_TERMINOLOGY_ENUM
+      NumberOfCodes
+    };
+
+    static const DSRCodedEntryValue& get(Code);
+
+    static const char* getValue(Code);
+    static const char* getScheme(Code);
+    static const char* getMeaning(Code);
+    static unsigned getContextGroup(Code);
+};
+
+#endif
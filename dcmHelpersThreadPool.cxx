@@ -0,0 +1,56 @@
+#include "dcmHelpersThreadPool.h"
+
+dcmHelpersThreadPool::dcmHelpersThreadPool(unsigned numThreads) :
+  busy(0), stopping(false){
+  if(!numThreads)
+    numThreads = std::thread::hardware_concurrency();
+  if(!numThreads)
+    numThreads = 1;
+  for(unsigned i=0;i<numThreads;i++)
+    workers.push_back(std::thread(&dcmHelpersThreadPool::run, this));
+}
+
+dcmHelpersThreadPool::~dcmHelpersThreadPool(){
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  taskAvailable.notify_all();
+  for(size_t i=0;i<workers.size();i++)
+    workers[i].join();
+}
+
+void dcmHelpersThreadPool::submit(const std::function<void()> &task){
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    tasks.push_back(task);
+  }
+  taskAvailable.notify_one();
+}
+
+void dcmHelpersThreadPool::wait(){
+  std::unique_lock<std::mutex> lock(mutex);
+  allDone.wait(lock, [this]{ return tasks.empty() && !busy; });
+}
+
+void dcmHelpersThreadPool::run(){
+  for(;;){
+    std::function<void()> task;
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      taskAvailable.wait(lock, [this]{ return stopping || !tasks.empty(); });
+      if(tasks.empty())
+        return;
+      task = tasks.front();
+      tasks.pop_front();
+      busy++;
+    }
+    task();
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      busy--;
+      if(tasks.empty() && !busy)
+        allDone.notify_all();
+    }
+  }
+}
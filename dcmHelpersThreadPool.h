@@ -0,0 +1,111 @@
+#ifndef __dcmHelpersThreadPool_h
+#define __dcmHelpersThreadPool_h
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// Fixed size pool of worker threads executing submitted tasks in FIFO order.
+class dcmHelpersThreadPool {
+  public:
+    // numThreads = 0 selects the number of hardware threads
+    explicit dcmHelpersThreadPool(unsigned numThreads = 0);
+    ~dcmHelpersThreadPool();
+
+    void submit(const std::function<void()> &task);
+    // block until all submitted tasks have completed
+    void wait();
+    unsigned size() const { return workers.size(); }
+
+  private:
+    dcmHelpersThreadPool(const dcmHelpersThreadPool&);
+    dcmHelpersThreadPool& operator=(const dcmHelpersThreadPool&);
+
+    void run();
+
+    std::vector<std::thread> workers;
+    std::deque<std::function<void()> > tasks;
+    std::mutex mutex;
+    std::condition_variable taskAvailable;
+    std::condition_variable allDone;
+    unsigned busy;
+    bool stopping;
+};
+
+// Queue with a fixed capacity: push() blocks while the queue is full and
+// pop() blocks while it is empty, which is what couples a producer stage to
+// the speed of its consumer.
+template<typename T>
+class dcmHelpersBoundedQueue {
+  public:
+    explicit dcmHelpersBoundedQueue(size_t capacity) :
+      capacity(capacity ? capacity : 1), closed(false) {}
+
+    // returns false if the queue was closed before the item could be queued
+    bool push(const T &item){
+      T copy(item);
+      return push(std::move(copy));
+    }
+
+    bool push(T &&item){
+      std::unique_lock<std::mutex> lock(mutex);
+      notFull.wait(lock, [this]{ return closed || items.size() < capacity; });
+      if(closed)
+        return false;
+      items.push_back(std::move(item));
+      notEmpty.notify_one();
+      return true;
+    }
+
+    // returns false once the queue is closed and drained
+    bool pop(T &item){
+      std::unique_lock<std::mutex> lock(mutex);
+      notEmpty.wait(lock, [this]{ return closed || !items.empty(); });
+      if(items.empty())
+        return false;
+      item = std::move(items.front());
+      items.pop_front();
+      notFull.notify_one();
+      return true;
+    }
+
+    // as pop(), but returns false with timedOut set when nothing arrives within
+    // timeout
+    bool pop(T &item, const std::chrono::steady_clock::duration &timeout, bool &timedOut){
+      std::unique_lock<std::mutex> lock(mutex);
+      timedOut = !notEmpty.wait_for(lock, timeout, [this]{ return closed || !items.empty(); });
+      if(items.empty())
+        return false;
+      item = std::move(items.front());
+      items.pop_front();
+      notFull.notify_one();
+      return true;
+    }
+
+    void close(){
+      std::lock_guard<std::mutex> lock(mutex);
+      closed = true;
+      notFull.notify_all();
+      notEmpty.notify_all();
+    }
+
+    size_t size(){
+      std::lock_guard<std::mutex> lock(mutex);
+      return items.size();
+    }
+
+  private:
+    size_t capacity;
+    bool closed;
+    std::deque<T> items;
+    std::mutex mutex;
+    std::condition_variable notFull;
+    std::condition_variable notEmpty;
+};
+
+#endif
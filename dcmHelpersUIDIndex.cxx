@@ -0,0 +1,106 @@
+#include "dcmHelpersUIDIndex.h"
+#include "dcmtk/config/osconfig.h"
+#include "dcmtk/dcmdata/dctk.h"
+
+#include <dirent.h>
+#include <sys/stat.h>
+
+dcmHelpersUIDIndex::dcmHelpersUIDIndex(){
+}
+
+unsigned long dcmHelpersUIDIndex::scan(const std::string &root){
+  unsigned long parsed = 0;
+  scanDirectory(root, parsed);
+  return parsed;
+}
+
+void dcmHelpersUIDIndex::scanDirectory(const std::string &directory, unsigned long &parsed){
+  DIR *dir = opendir(directory.c_str());
+  if(!dir)
+    return;
+  struct dirent *entry;
+  while((entry = readdir(dir)) != NULL){
+    std::string name = entry->d_name;
+    if(name == "." || name == "..")
+      continue;
+    std::string path = directory + "/" + name;
+    struct stat st;
+    if(stat(path.c_str(), &st))
+      continue;
+    if(S_ISDIR(st.st_mode)){
+      scanDirectory(path, parsed);
+    } else if(S_ISREG(st.st_mode)){
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::map<std::string, FileEntry>::const_iterator it = files.find(path);
+        if(it != files.end() && it->second.size == st.st_size && it->second.mtime == st.st_mtime)
+          continue;
+      }
+      addFile(path, st.st_size, st.st_mtime);
+      parsed++;
+    }
+  }
+  closedir(dir);
+}
+
+bool dcmHelpersUIDIndex::add(const std::string &path, std::string *sopClassUID){
+  struct stat st;
+  if(stat(path.c_str(), &st) || !S_ISREG(st.st_mode))
+    return false;
+  return addFile(path, st.st_size, st.st_mtime, sopClassUID);
+}
+
+bool dcmHelpersUIDIndex::addFile(const std::string &path, long long size, long long mtime, std::string *sopClassUID){
+  // the identifying attributes come first in the dataset: parsing stops at
+  //  the first element after SOPInstanceUID, so the functional groups of large
+  //  multi-frame objects are never read
+  DcmFileFormat fileFormat;
+  OFString sopInstanceUID;
+  bool isInstance = fileFormat.loadFileUntilTag(path.c_str(), EXS_Unknown, EGL_noChange, 256,
+                                                ERM_autoDetect, DcmTagKey(0x0008, 0x0019)).good() &&
+    fileFormat.getDataset()->findAndGetOFString(DCM_SOPInstanceUID, sopInstanceUID).good() &&
+    !sopInstanceUID.empty();
+  if(sopClassUID){
+    OFString uid;
+    if(isInstance)
+      fileFormat.getDataset()->findAndGetOFString(DCM_SOPClassUID, uid);
+    *sopClassUID = uid.c_str();
+  }
+
+  std::lock_guard<std::mutex> lock(mutex);
+  std::map<std::string, FileEntry>::iterator it = files.find(path);
+  if(it != files.end()){
+    std::map<std::string, std::string>::iterator instance = instances.find(it->second.sopInstanceUID);
+    if(instance != instances.end() && instance->second == path)
+      instances.erase(instance);
+  }
+  FileEntry &file = files[path];
+  file.size = size;
+  file.mtime = mtime;
+  file.sopInstanceUID = isInstance ? sopInstanceUID.c_str() : "";
+  if(isInstance)
+    instances[file.sopInstanceUID] = path;
+  return isInstance;
+}
+
+void dcmHelpersUIDIndex::remove(const std::string &path){
+  std::lock_guard<std::mutex> lock(mutex);
+  std::map<std::string, FileEntry>::iterator it = files.find(path);
+  if(it == files.end())
+    return;
+  std::map<std::string, std::string>::iterator instance = instances.find(it->second.sopInstanceUID);
+  if(instance != instances.end() && instance->second == path)
+    instances.erase(instance);
+  files.erase(it);
+}
+
+std::string dcmHelpersUIDIndex::find(const std::string &sopInstanceUID) const {
+  std::lock_guard<std::mutex> lock(mutex);
+  std::map<std::string, std::string>::const_iterator it = instances.find(sopInstanceUID);
+  return it == instances.end() ? std::string() : it->second;
+}
+
+size_t dcmHelpersUIDIndex::size() const {
+  std::lock_guard<std::mutex> lock(mutex);
+  return instances.size();
+}
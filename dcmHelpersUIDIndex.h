@@ -0,0 +1,47 @@
+#ifndef __dcmHelpersUIDIndex_h
+#define __dcmHelpersUIDIndex_h
+
+#include <map>
+#include <mutex>
+#include <string>
+
+// Map from SOPInstanceUID to the file holding the instance, built by scanning
+// a directory tree. Each file is parsed up to its SOPInstanceUID. Rescanning
+// skips files whose size and modification time did not change, so an index
+// over a large archive can be kept up to date cheaply. Safe for concurrent use.
+class dcmHelpersUIDIndex {
+  public:
+    dcmHelpersUIDIndex();
+
+    // index all files below root; returns the number of files (re)parsed
+    unsigned long scan(const std::string &root);
+
+    // index a single file; returns false if it is not a DICOM instance.
+    //  The SOPClassUID is returned as well, from the same parse.
+    bool add(const std::string &path, std::string *sopClassUID = NULL);
+    void remove(const std::string &path);
+
+    // empty string if the instance is unknown
+    std::string find(const std::string &sopInstanceUID) const;
+
+    size_t size() const;
+
+  private:
+    dcmHelpersUIDIndex(const dcmHelpersUIDIndex&);
+    dcmHelpersUIDIndex& operator=(const dcmHelpersUIDIndex&);
+
+    struct FileEntry {
+      long long size;
+      long long mtime;
+      std::string sopInstanceUID;
+    };
+
+    bool addFile(const std::string &path, long long size, long long mtime, std::string *sopClassUID = NULL);
+    void scanDirectory(const std::string &directory, unsigned long &parsed);
+
+    mutable std::mutex mutex;
+    std::map<std::string, FileEntry> files;
+    std::map<std::string, std::string> instances;
+};
+
+#endif
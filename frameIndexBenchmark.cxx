@@ -0,0 +1,310 @@
+// Random vs sequential frame access through dcmHelpersFrameIndex on a
+// synthetic multi-frame segmentation. The file is generated without DCMTK,
+// with native BINARY frames or with encapsulated (RLE-like) frames indexed
+// through an Extended Offset Table, a Basic Offset Table, or a fragment scan.
+
+// STL includes
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "dcmHelpersFrameIndex.h"
+
+struct BenchmarkOptions {
+  BenchmarkOptions() : fileName("frameIndexBenchmark.dcm"), sizeMB(3072), rows(512), columns(512),
+    bitsAllocated(1), encapsulated(false), offsetTable("basic"), fragmentsPerFrame(1),
+    reads(2000), keep(false) {}
+  std::string fileName;
+  unsigned long sizeMB;
+  unsigned short rows, columns, bitsAllocated;
+  bool encapsulated;
+  std::string offsetTable;
+  unsigned fragmentsPerFrame;
+  unsigned long reads;
+  bool keep;
+};
+
+class DicomWriter {
+  public:
+    DicomWriter(FILE *f) : f(f) {}
+
+    void tag(unsigned short group, unsigned short element){
+      put16(group);
+      put16(element);
+    }
+    // explicit VR little endian element header; the value is written by the caller
+    void header(unsigned short group, unsigned short element, const char *vr, unsigned long length){
+      tag(group, element);
+      fwrite(vr, 1, 2, f);
+      if(!strcmp(vr, "OB") || !strcmp(vr, "OW") || !strcmp(vr, "OV") || !strcmp(vr, "UN") || !strcmp(vr, "SQ")){
+        put16(0);
+        put32(length);
+      } else {
+        put16(length);
+      }
+    }
+    void element(unsigned short group, unsigned short element, const char *vr, const void *value, unsigned long length){
+      header(group, element, vr, length);
+      fwrite(value, 1, length, f);
+    }
+    void string(unsigned short group, unsigned short element, const char *vr, std::string value){
+      if(value.size() % 2)
+        value += vr[0] == 'U' && vr[1] == 'I' ? '\0' : ' ';
+      this->element(group, element, vr, value.c_str(), value.size());
+    }
+    void us(unsigned short group, unsigned short element, unsigned short value){
+      unsigned char v[2] = {(unsigned char)(value & 0xFF), (unsigned char)(value >> 8)};
+      this->element(group, element, "US", v, 2);
+    }
+    void item(unsigned long length){
+      tag(0xFFFE, 0xE000);
+      put32(length);
+    }
+    void put16(unsigned short v){
+      unsigned char b[2] = {(unsigned char)(v & 0xFF), (unsigned char)(v >> 8)};
+      fwrite(b, 1, 2, f);
+    }
+    void put32(unsigned long v){
+      put16(v & 0xFFFF);
+      put16(v >> 16);
+    }
+    void put64(unsigned long long v){
+      put32(v & 0xFFFFFFFFUL);
+      put32(v >> 32);
+    }
+
+  private:
+    FILE *f;
+};
+
+double secondsSince(const std::chrono::steady_clock::time_point &start){
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// drop the file from the page cache, so that every run starts cold
+void dropCache(const std::string &fileName){
+  int fd = open(fileName.c_str(), O_RDONLY);
+  if(fd >= 0){
+    fdatasync(fd);
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    close(fd);
+  }
+}
+
+unsigned long long getFrameBits(const BenchmarkOptions &options){
+  return (unsigned long long)options.rows * options.columns * options.bitsAllocated;
+}
+
+// synthetic "compressed" fragments, starting with an RLE header
+unsigned long getFragmentLength(const BenchmarkOptions &options){
+  unsigned long long frameBytes = (getFrameBits(options) + 7) / 8;
+  unsigned long fragmentLength = (unsigned long)((frameBytes / options.fragmentsPerFrame + 1) & ~1ULL);
+  return std::max(fragmentLength, 64UL);
+}
+
+// length of a frame as read through the index: its fragments without the item
+//  headers, or the bytes covering its bits
+unsigned long long getExpectedFrameLength(const BenchmarkOptions &options, unsigned long frame){
+  if(options.encapsulated)
+    return (unsigned long long)options.fragmentsPerFrame * getFragmentLength(options);
+  unsigned long long frameBits = getFrameBits(options);
+  return (frame * frameBits % 8 + frameBits + 7) / 8;
+}
+
+bool writeSyntheticSegmentation(const BenchmarkOptions &options, unsigned long &numberOfFrames){
+  unsigned long long frameBits = getFrameBits(options);
+  unsigned long long frameBytes = (frameBits + 7) / 8;
+  numberOfFrames = (unsigned long)(options.sizeMB * 1048576ULL / frameBytes);
+  if(!numberOfFrames)
+    numberOfFrames = 1;
+
+  unsigned long fragmentLength = getFragmentLength(options);
+  unsigned long long frameItemsLength = (unsigned long long)options.fragmentsPerFrame * (8 + fragmentLength);
+  if(options.encapsulated && options.offsetTable == "basic" && frameItemsLength * numberOfFrames > 0xFFFFFFFFULL){
+    std::cerr << "Basic Offset Table cannot address more than 4 GB, use --offset-table extended" << std::endl;
+    return false;
+  }
+
+  FILE *f = fopen(options.fileName.c_str(), "wb");
+  if(!f)
+    return false;
+  std::vector<char> fileBuffer(1 << 20);
+  setvbuf(f, &fileBuffer[0], _IOFBF, fileBuffer.size());
+  DicomWriter w(f);
+
+  std::vector<char> preamble(128, 0);
+  fwrite(&preamble[0], 1, preamble.size(), f);
+  fwrite("DICM", 1, 4, f);
+
+  std::string sopClass = "1.2.840.10008.5.1.4.1.1.66.4";
+  std::string sopInstance = "1.2";
+  std::string transferSyntax = options.encapsulated ? "1.2.840.10008.1.2.5" : "1.2.840.10008.1.2.1";
+  unsigned long metaLength = (12 + 2) + (8 + (sopClass.size() + 1) / 2 * 2) +
+                             (8 + (sopInstance.size() + 1) / 2 * 2) + (8 + (transferSyntax.size() + 1) / 2 * 2);
+  unsigned char metaLengthValue[4] = {(unsigned char)(metaLength & 0xFF), (unsigned char)((metaLength >> 8) & 0xFF),
+                                      (unsigned char)((metaLength >> 16) & 0xFF), (unsigned char)(metaLength >> 24)};
+  w.element(0x0002, 0x0000, "UL", metaLengthValue, 4);
+  unsigned char version[2] = {0, 1};
+  w.element(0x0002, 0x0001, "OB", version, 2);
+  w.string(0x0002, 0x0002, "UI", sopClass);
+  w.string(0x0002, 0x0003, "UI", sopInstance);
+  w.string(0x0002, 0x0010, "UI", transferSyntax);
+
+  char numberOfFramesStr[16];
+  sprintf(numberOfFramesStr, "%lu", numberOfFrames);
+  w.string(0x0008, 0x0016, "UI", sopClass);
+  w.us(0x0028, 0x0002, 1);
+  w.string(0x0028, 0x0008, "IS", numberOfFramesStr);
+  w.us(0x0028, 0x0010, options.rows);
+  w.us(0x0028, 0x0011, options.columns);
+  w.us(0x0028, 0x0100, options.bitsAllocated);
+  w.us(0x0028, 0x0101, options.bitsAllocated);
+  w.us(0x0028, 0x0102, options.bitsAllocated - 1);
+  w.us(0x0028, 0x0103, 0);
+
+  std::vector<unsigned char> frame(options.encapsulated ? fragmentLength : frameBytes);
+  for(size_t i=0;i<frame.size();i++)
+    frame[i] = (unsigned char)(i * 2654435761UL >> 13);
+
+  if(!options.encapsulated){
+    unsigned long long pixelDataLength = (frameBits * numberOfFrames + 7) / 8;
+    pixelDataLength += pixelDataLength % 2;
+    w.header(0x7FE0, 0x0010, "OB", (unsigned long)pixelDataLength);
+    // BINARY frames are packed without padding between frames
+    for(unsigned long long written=0;written<pixelDataLength;written+=frame.size())
+      fwrite(&frame[0], 1, std::min<unsigned long long>(frame.size(), pixelDataLength - written), f);
+  } else {
+    if(options.offsetTable == "extended"){
+      w.header(0x7FE0, 0x0001, "OV", 8 * numberOfFrames);
+      for(unsigned long n=0;n<numberOfFrames;n++)
+        w.put64(n * frameItemsLength);
+      w.header(0x7FE0, 0x0002, "OV", 8 * numberOfFrames);
+      for(unsigned long n=0;n<numberOfFrames;n++)
+        w.put64(fragmentLength);
+    }
+    w.header(0x7FE0, 0x0010, "OB", 0xFFFFFFFFUL);
+    if(options.offsetTable == "basic"){
+      w.item(4 * numberOfFrames);
+      for(unsigned long n=0;n<numberOfFrames;n++)
+        w.put32((unsigned long)(n * frameItemsLength));
+    } else {
+      w.item(0);
+    }
+    for(unsigned long n=0;n<numberOfFrames;n++){
+      for(unsigned p=0;p<options.fragmentsPerFrame;p++){
+        w.item(fragmentLength);
+        // RLE header (one segment at offset 64) in the first fragment of each frame only
+        memset(&frame[0], 0, 8);
+        frame[0] = p ? 0xAA : 1;
+        frame[4] = p ? 0xAA : 64;
+        fwrite(&frame[0], 1, fragmentLength, f);
+      }
+    }
+    w.tag(0xFFFE, 0xE0DD);
+    w.put32(0);
+  }
+
+  bool ok = !ferror(f);
+  return !fclose(f) && ok;
+}
+
+void report(const char *name, unsigned long frames, double bytes, double seconds){
+  std::cout << "  " << name << ": " << frames << " frames in " << seconds << " s, "
+            << (seconds > 0 ? frames / seconds : 0) << " frames/s, "
+            << (seconds > 0 ? bytes / 1048576. / seconds : 0) << " MB/s" << std::endl;
+}
+
+int main(int argc, char** argv)
+{
+  BenchmarkOptions options;
+  for(int i=1;i<argc;i++){
+    std::string arg = argv[i];
+    if(arg == "--file" && i+1<argc) options.fileName = argv[++i];
+    else if(arg == "--size-mb" && i+1<argc) options.sizeMB = atol(argv[++i]);
+    else if(arg == "--rows" && i+1<argc) options.rows = atoi(argv[++i]);
+    else if(arg == "--columns" && i+1<argc) options.columns = atoi(argv[++i]);
+    else if(arg == "--bits" && i+1<argc) options.bitsAllocated = atoi(argv[++i]);
+    else if(arg == "--encapsulated") options.encapsulated = true;
+    else if(arg == "--offset-table" && i+1<argc) options.offsetTable = argv[++i];
+    else if(arg == "--fragments-per-frame" && i+1<argc) options.fragmentsPerFrame = std::max(1, atoi(argv[++i]));
+    else if(arg == "--reads" && i+1<argc) options.reads = atol(argv[++i]);
+    else if(arg == "--keep") options.keep = true;
+    else {
+      std::cerr << "Usage: " << argv[0] << " [--file name] [--size-mb N] [--rows N] [--columns N]"
+                << " [--bits 1|8|16] [--encapsulated [--offset-table none|basic|extended]"
+                << " [--fragments-per-frame N]] [--reads N] [--keep]" << std::endl;
+      return -1;
+    }
+  }
+  // PS3.5 A.4: an Extended Offset Table requires each frame to be one fragment
+  if(options.encapsulated && options.offsetTable == "extended" && options.fragmentsPerFrame > 1){
+    std::cerr << "--offset-table extended requires one fragment per frame" << std::endl;
+    return -1;
+  }
+
+  unsigned long numberOfFrames;
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  if(!writeSyntheticSegmentation(options, numberOfFrames)){
+    std::cerr << "Failed to write " << options.fileName << std::endl;
+    return -1;
+  }
+  std::cout << "Generated " << options.fileName << ": " << numberOfFrames << " frames of "
+            << options.rows << "x" << options.columns << ", " << options.bitsAllocated << " bit"
+            << (options.encapsulated ? ", encapsulated, offset table: " + options.offsetTable : ", native")
+            << " in " << secondsSince(start) << " s" << std::endl;
+
+  dropCache(options.fileName);
+  start = std::chrono::steady_clock::now();
+  dcmHelpersFrameIndex index;
+  if(!index.open(options.fileName)){
+    std::cerr << "Failed to index " << options.fileName << std::endl;
+    return -1;
+  }
+  std::cout << "  index (" << index.getIndexSourceName() << "): " << index.getNumberOfFrames()
+            << " frames in " << secondsSince(start) << " s" << std::endl;
+
+  unsigned long reads = std::min(options.reads, index.getNumberOfFrames());
+  std::vector<unsigned long> sequential(reads), random(reads);
+  for(unsigned long i=0;i<reads;i++)
+    sequential[i] = i;
+  srand(1);
+  for(unsigned long i=0;i<reads;i++)
+    random[i] = (unsigned long)(((unsigned long long)rand() * RAND_MAX + rand()) % index.getNumberOfFrames());
+
+  std::vector<unsigned char> buffer;
+  const std::vector<unsigned long> *orders[2] = {&sequential, &random};
+  const char *names[2] = {"sequential", "random"};
+  for(int o=0;o<2;o++){
+    dropCache(options.fileName);
+    double bytes = 0;
+    start = std::chrono::steady_clock::now();
+    for(unsigned long i=0;i<reads;i++){
+      unsigned long frame = (*orders[o])[i];
+      if(!index.readFrame(frame, buffer)){
+        std::cerr << "Failed to read frame " << frame << std::endl;
+        return -1;
+      }
+      // a frame read only in part would make the reads look faster or slower
+      //  than they are; encapsulated frames start with their RLE header
+      if(buffer.size() != getExpectedFrameLength(options, frame) || (options.encapsulated && buffer[0] != 1)){
+        std::cerr << "Frame " << frame << " read with " << buffer.size() << " bytes, expected "
+                  << getExpectedFrameLength(options, frame) << std::endl;
+        return -1;
+      }
+      bytes += buffer.size();
+    }
+    report(names[o], reads, bytes, secondsSince(start));
+  }
+
+  if(!options.keep)
+    unlink(options.fileName.c_str());
+  return 0;
+}
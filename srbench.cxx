@@ -0,0 +1,508 @@
+// Benchmark of the report construction stages of tid1411test on synthetic
+// data: header load, Image Library construction, evidence, DSRDocument::write,
+// module copy, validation and file save, and of a full rebuild against
+// appending one Measurement Group over the images of a second series to the
+// saved report, and of the DICOM JSON and XML export against DCMTK writeXML()
+// and dcm2json, and of saving the reports of a study with the patient and
+// study modules copied from the source against from a set cached per source
+// file; the cached set saves attribute lookups in the source, each report
+// still allocates its own copies.
+// Reports wall time, heap allocations, peak RSS and, for the exports,
+// throughput per stage as JSON.
+
+// STL includes
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <new>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <sys/resource.h>
+#include <sys/stat.h>
+
+// DCMTK includes
+#include "dcmtk/config/osconfig.h"    /* make sure OS specific configuration is included first */
+
+#include "dcmtk/dcmsr/dsrdoc.h"
+#include "dcmtk/dcmdata/dcfilefo.h"
+#include "dcmHelpersCommon.h"
+#include "dcmHelpersReportExport.h"
+#include "dcmHelpersReportUpdater.h"
+#include "dcmHelpersReportValidator.h"
+#include "dcmHelpersStudyModules.h"
+#include "dcmHelpersSyntheticData.h"
+#include "dcmHelpersTerminology.h"
+
+// heap allocations of the whole process
+static std::atomic<unsigned long long> allocationCount(0), allocatedBytes(0);
+
+void* operator new(size_t size){
+  allocationCount++;
+  allocatedBytes += size;
+  if(void *p = malloc(size ? size : 1))
+    return p;
+  throw std::bad_alloc();
+}
+
+void* operator new[](size_t size){
+  return operator new(size);
+}
+
+void operator delete(void *p) noexcept {
+  free(p);
+}
+
+void operator delete[](void *p) noexcept {
+  free(p);
+}
+
+struct BenchmarkOptions {
+  BenchmarkOptions() : directory("srbench_data"), repetitions(5), reportsPerStudy(20), reuse(false), generateOnly(false) {}
+  dcmHelpersSyntheticData::Options data;
+  std::string directory;
+  std::string jsonFileName;
+  unsigned repetitions;
+  unsigned reportsPerStudy;
+  bool reuse, generateOnly;
+};
+
+struct StageResult {
+  StageResult(const std::string &name) : name(name), allocations(0), bytes(0), outputBytes(0), reports(1), peakRSSKB(0) {}
+  std::string name;
+  std::vector<double> seconds;
+  unsigned long long allocations, bytes, outputBytes;
+  // reports built by one iteration
+  unsigned reports;
+  long peakRSSKB;
+};
+
+// state shared by the stages of one repetition
+struct Report {
+  Report() : doc(NULL), fileFormat(NULL), outputBytes(0) {}
+  ~Report(){
+    delete doc;
+    delete fileFormat;
+    for(size_t i=0;i<inputs.size();i++)
+      delete inputs[i];
+  }
+  std::vector<DcmFileFormat*> inputs;
+  DSRDocument *doc;
+  DcmFileFormat *fileFormat;
+  // size of the text written by an export stage
+  size_t outputBytes;
+};
+
+long peakRSSKB(){
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_maxrss;
+}
+
+double secondsSince(const std::chrono::steady_clock::time_point &start){
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// ct_NNNNN.dcm of a previous run
+bool listCTFiles(const std::string &directory, std::vector<std::string> &ctFiles){
+  for(unsigned i=1;;i++){
+    char name[32];
+    sprintf(name, "/ct_%05u.dcm", i);
+    struct stat st;
+    if(stat((directory + name).c_str(), &st))
+      break;
+    ctFiles.push_back(directory + name);
+  }
+  if(ctFiles.empty())
+    std::cerr << "No synthetic data in " << directory << std::endl;
+  return !ctFiles.empty();
+}
+
+// TID 4020 entries of the source images, the inputs but the last (the SEG);
+//  one entry per frame of a multi-frame image
+void addImageLibraryEntries(DSRDocument *doc, const std::vector<DcmFileFormat*> &inputs){
+  for(size_t i=0;i+1<inputs.size();i++){
+    DcmDataset *dataset = inputs[i]->getDataset();
+    Sint32 numberOfFrames = 1;
+    if(dataset->findAndGetSint32(DCM_NumberOfFrames, numberOfFrames).bad() || numberOfFrames <= 1)
+      dcmHelpersCommon::addImageLibraryEntry(doc, dataset);
+    else
+      for(Sint32 f=1;f<=numberOfFrames;f++)
+        dcmHelpersCommon::addImageLibraryEntry(doc, dataset, f);
+  }
+}
+
+void getSourceUIDs(const std::vector<DcmFileFormat*> &inputs,
+                   std::vector<std::string> &classUIDs, std::vector<std::string> &instanceUIDs){
+  for(size_t i=0;i+1<inputs.size();i++){
+    OFString uid;
+    inputs[i]->getDataset()->findAndGetOFString(DCM_SOPClassUID, uid);
+    classUIDs.push_back(uid.c_str());
+    inputs[i]->getDataset()->findAndGetOFString(DCM_SOPInstanceUID, uid);
+    instanceUIDs.push_back(uid.c_str());
+  }
+}
+
+void usage(const char *name){
+  std::cerr << "Usage: " << name << " [options]" << std::endl
+            << "  --dir DIR              synthetic data directory (srbench_data)" << std::endl
+            << "  --slices N             CT slices (100)" << std::endl
+            << "  --frames-per-file N    1 for CT Image Storage, more for Enhanced CT (1)" << std::endl
+            << "  --rows N --columns N   frame size (512x512)" << std::endl
+            << "  --segments N           segments of the SEG (1)" << std::endl
+            << "  --sparsity F           fraction of slices covered by each segment (0.2)" << std::endl
+            << "  --transfer-syntax TS   native, rle, jpeg-ls or jpeg-lossless (native)" << std::endl
+            << "  --seg-transfer-syntax TS  native or rle (native)" << std::endl
+            << "  --repetitions N        (5)" << std::endl
+            << "  --reports-per-study N  reports of the study module stages (20)" << std::endl
+            << "  --json FILE            write the results to FILE instead of stdout" << std::endl
+            << "  --reuse                use the data generated by a previous run" << std::endl
+            << "  --generate-only" << std::endl;
+}
+
+void writeJSON(std::ostream &out, const BenchmarkOptions &options, const std::vector<StageResult> &results){
+  out << "{" << std::endl
+      << "  \"context\": {" << std::endl
+      << "    \"slices\": " << options.data.slices << "," << std::endl
+      << "    \"frames_per_file\": " << options.data.framesPerFile << "," << std::endl
+      << "    \"rows\": " << options.data.rows << "," << std::endl
+      << "    \"columns\": " << options.data.columns << "," << std::endl
+      << "    \"segments\": " << options.data.segments << "," << std::endl
+      << "    \"sparsity\": " << options.data.sparsity << "," << std::endl
+      << "    \"transfer_syntax\": \"" << options.data.transferSyntax << "\"," << std::endl
+      << "    \"seg_transfer_syntax\": \"" << options.data.segTransferSyntax << "\"," << std::endl
+      << "    \"repetitions\": " << options.repetitions << "," << std::endl
+      << "    \"peak_rss_kb\": " << peakRSSKB() << std::endl
+      << "  }," << std::endl
+      << "  \"benchmarks\": [" << std::endl;
+  for(size_t i=0;i<results.size();i++){
+    const StageResult &r = results[i];
+    double total = 0;
+    for(size_t k=0;k<r.seconds.size();k++)
+      total += r.seconds[k];
+    std::vector<double> sorted = r.seconds;
+    std::sort(sorted.begin(), sorted.end());
+    size_t n = std::max<size_t>(sorted.size(), 1);
+    out << "    {" << std::endl
+        << "      \"name\": \"" << r.name << "\"," << std::endl
+        << "      \"iterations\": " << r.seconds.size() << "," << std::endl
+        << "      \"mean_ms\": " << total / n * 1000 << "," << std::endl
+        << "      \"min_ms\": " << (sorted.empty() ? 0 : sorted.front() * 1000) << "," << std::endl
+        << "      \"median_ms\": " << (sorted.empty() ? 0 : sorted[sorted.size()/2] * 1000) << "," << std::endl
+        << "      \"max_ms\": " << (sorted.empty() ? 0 : sorted.back() * 1000) << "," << std::endl
+        << "      \"allocations_per_iteration\": " << r.allocations / n << "," << std::endl
+        << "      \"bytes_allocated_per_iteration\": " << r.bytes / n << "," << std::endl;
+    if(r.reports > 1)
+      out << "      \"reports_per_iteration\": " << r.reports << "," << std::endl
+          << "      \"bytes_allocated_per_report\": " << r.bytes / n / r.reports << "," << std::endl;
+    if(r.outputBytes)
+      out << "      \"output_bytes_per_iteration\": " << r.outputBytes / n << "," << std::endl
+          << "      \"mb_per_s\": " << (total > 0 ? r.outputBytes / 1048576. / total : 0.) << "," << std::endl;
+    out << "      \"peak_rss_kb\": " << r.peakRSSKB << std::endl
+        << "    }" << (i+1 < results.size() ? "," : "") << std::endl;
+  }
+  out << "  ]" << std::endl << "}" << std::endl;
+}
+
+int main(int argc, char** argv)
+{
+  BenchmarkOptions options;
+  for(int i=1;i<argc;i++){
+    std::string arg = argv[i];
+    bool hasValue = i+1 < argc;
+    if(arg == "--dir" && hasValue)
+      options.directory = argv[++i];
+    else if(arg == "--slices" && hasValue)
+      options.data.slices = atoi(argv[++i]);
+    else if(arg == "--frames-per-file" && hasValue)
+      options.data.framesPerFile = atoi(argv[++i]);
+    else if(arg == "--rows" && hasValue)
+      options.data.rows = atoi(argv[++i]);
+    else if(arg == "--columns" && hasValue)
+      options.data.columns = atoi(argv[++i]);
+    else if(arg == "--segments" && hasValue)
+      options.data.segments = atoi(argv[++i]);
+    else if(arg == "--sparsity" && hasValue)
+      options.data.sparsity = atof(argv[++i]);
+    else if(arg == "--transfer-syntax" && hasValue)
+      options.data.transferSyntax = argv[++i];
+    else if(arg == "--seg-transfer-syntax" && hasValue)
+      options.data.segTransferSyntax = argv[++i];
+    else if(arg == "--repetitions" && hasValue)
+      options.repetitions = atoi(argv[++i]);
+    else if(arg == "--reports-per-study" && hasValue)
+      options.reportsPerStudy = std::max(1, atoi(argv[++i]));
+    else if(arg == "--json" && hasValue)
+      options.jsonFileName = argv[++i];
+    else if(arg == "--reuse")
+      options.reuse = true;
+    else if(arg == "--generate-only")
+      options.generateOnly = true;
+    else {
+      usage(argv[0]);
+      return -1;
+    }
+  }
+
+  // the report is built over the first series; the appended group measures a
+  //  segmentation of a second, smaller series, whose images are new to it
+  std::vector<std::string> ctFiles, appendCTFiles;
+  std::string segFile = options.directory + "/seg.dcm";
+  std::string appendDirectory = options.directory + "/append";
+  std::string appendSegFile = appendDirectory + "/seg.dcm";
+  if(options.reuse){
+    if(!listCTFiles(options.directory, ctFiles) || !listCTFiles(appendDirectory, appendCTFiles))
+      return -1;
+  } else {
+    dcmHelpersSyntheticData::Options appendData = options.data;
+    appendData.slices = std::max(1u, unsigned(options.data.slices * options.data.sparsity + 0.5));
+    appendData.segments = 1;
+    appendData.sparsity = 1;
+    appendData.seed = options.data.seed + 1;
+    mkdir(options.directory.c_str(), 0755);
+    mkdir(appendDirectory.c_str(), 0755);
+    dcmHelpersSyntheticData::registerCodecs();
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    bool generated = dcmHelpersSyntheticData::generate(options.data, options.directory, ctFiles, segFile) &&
+                     dcmHelpersSyntheticData::generate(appendData, appendDirectory, appendCTFiles, appendSegFile);
+    dcmHelpersSyntheticData::cleanupCodecs();
+    if(!generated)
+      return -1;
+    std::cerr << "Generated " << ctFiles.size() << " CT files and " << segFile << ", "
+              << appendCTFiles.size() << " CT files and " << appendSegFile
+              << " in " << secondsSince(start) << " s" << std::endl;
+  }
+  if(options.generateOnly)
+    return 0;
+
+  // the headers of the appended group are read once, like those of the report
+  //  are kept for the full rebuild
+  Report appendSources;
+  for(size_t i=0;i<=appendCTFiles.size();i++){
+    DcmFileFormat *fileFormat = new DcmFileFormat();
+    fileFormat->loadFile(i < appendCTFiles.size() ? appendCTFiles[i].c_str() : appendSegFile.c_str());
+    appendSources.inputs.push_back(fileFormat);
+  }
+
+  std::vector<StageResult> results;
+  std::vector<std::pair<std::string, std::function<void(Report&)> > > stages;
+
+  stages.push_back(std::make_pair("header_load", std::function<void(Report&)>([&](Report &report){
+    // pixel data is larger than DCM_MaxReadLength and stays on disk
+    for(size_t i=0;i<=ctFiles.size();i++){
+      DcmFileFormat *fileFormat = new DcmFileFormat();
+      fileFormat->loadFile(i < ctFiles.size() ? ctFiles[i].c_str() : segFile.c_str());
+      report.inputs.push_back(fileFormat);
+    }
+  })));
+
+  stages.push_back(std::make_pair("image_library", std::function<void(Report&)>([&](Report &report){
+    report.doc = new DSRDocument();
+    report.doc->createNewDocument(DSRTypes::DT_ComprehensiveSR);
+    report.doc->getTree().addContentItem(DSRTypes::RT_isRoot, DSRTypes::VT_Container);
+    report.doc->getTree().getCurrentContentItem().setTemplateIdentification("1000", "99QIICR");
+    report.doc->getTree().getCurrentContentItem().setConceptName(
+                dcmHelpersTerminology::get(dcmHelpersTerminology::CODE_QuantitativeMeasurementReport));
+    report.doc->getTree().addContentItem(DSRTypes::RT_contains, DSRTypes::VT_Container, DSRTypes::AM_belowCurrent);
+    report.doc->getTree().getCurrentContentItem().setConceptName(
+                dcmHelpersTerminology::get(dcmHelpersTerminology::CODE_ImageLibrary));
+    addImageLibraryEntries(report.doc, report.inputs);
+  })));
+
+  stages.push_back(std::make_pair("evidence", std::function<void(Report&)>([&](Report &report){
+    for(size_t i=0;i<report.inputs.size();i++)
+      report.doc->getCurrentRequestedProcedureEvidence().addItem(*report.inputs[i]->getDataset());
+  })));
+
+  stages.push_back(std::make_pair("findings", std::function<void(Report&)>([&](Report &report){
+    std::vector<std::string> classUIDs, instanceUIDs;
+    getSourceUIDs(report.inputs, classUIDs, instanceUIDs);
+    OFString segInstanceUID;
+    report.inputs.back()->getDataset()->findAndGetOFString(DCM_SOPInstanceUID, segInstanceUID);
+    char trackingUID[100];
+    dcmGenerateUniqueIdentifier(trackingUID, SITE_INSTANCE_UID_ROOT);
+    report.doc->getTree().addContentItem(DSRTypes::RT_contains, DSRTypes::VT_Container, DSRTypes::AM_afterCurrent);
+    report.doc->getTree().getCurrentContentItem().setConceptName(
+                dcmHelpersTerminology::get(dcmHelpersTerminology::CODE_Findings));
+    dcmHelpersCommon::addMeasurementGroup(report.doc, "Object1", trackingUID, segInstanceUID.c_str(), 1,
+                                          classUIDs, instanceUIDs,
+                                          std::map<std::string, std::vector<long> >(), "42.000",
+                                          report.inputs.front()->getDataset());
+  })));
+
+  stages.push_back(std::make_pair("document_write", std::function<void(Report&)>([&](Report &report){
+    report.fileFormat = new DcmFileFormat();
+    report.doc->write(*report.fileFormat->getDataset());
+  })));
+
+  stages.push_back(std::make_pair("module_copy", std::function<void(Report&)>([&](Report &report){
+    DcmDataset *source = report.inputs.front()->getDataset();
+    DcmDataset *target = report.fileFormat->getDataset();
+    dcmHelpersCommon::copyPatientModule(source, target);
+    dcmHelpersCommon::copyPatientStudyModule(source, target);
+    dcmHelpersCommon::copyGeneralStudyModule(source, target);
+  })));
+
+  // part of generation in tid1411test, measured separately to keep its cost in view
+  bool reportedProblems = false;
+  const auto validate = [&reportedProblems](DcmDataset *dataset, const char *stage){
+    std::vector<std::string> problems;
+    if(!dcmHelpersReportValidator::validate(dataset, problems) && !reportedProblems){
+      std::cerr << "Report of " << stage << " does not conform (" << problems.size()
+                << " problems), first: " << problems[0] << std::endl;
+      reportedProblems = true;
+    }
+  };
+  stages.push_back(std::make_pair("validate", std::function<void(Report&)>([&](Report &report){
+    validate(report.fileFormat->getDataset(), "validate");
+  })));
+
+  std::string reportFileName = options.directory + "/srbench_report.dcm";
+  stages.push_back(std::make_pair("file_save", std::function<void(Report&)>([&](Report &report){
+    report.fileFormat->saveFile(reportFileName.c_str(), EXS_LittleEndianExplicit);
+  })));
+
+  // everything after header load again, against appending one more group
+  const size_t lastBuildStage = stages.size() - 1;
+  stages.push_back(std::make_pair("full_rebuild", std::function<void(Report&)>([&](Report &report){
+    Report rebuilt;
+    rebuilt.inputs.swap(report.inputs);
+    for(size_t s=1;s<=lastBuildStage;s++)
+      stages[s].second(rebuilt);
+    report.inputs.swap(rebuilt.inputs);
+  })));
+
+  std::string appendedFileName = options.directory + "/srbench_appended.dcm";
+  stages.push_back(std::make_pair("incremental_append", std::function<void(Report&)>([&](Report &report){
+    DcmFileFormat saved;
+    saved.loadFile(reportFileName.c_str());
+    std::vector<std::string> classUIDs, instanceUIDs;
+    getSourceUIDs(appendSources.inputs, classUIDs, instanceUIDs);
+    OFString segInstanceUID;
+    appendSources.inputs.back()->getDataset()->findAndGetOFString(DCM_SOPInstanceUID, segInstanceUID);
+    char trackingUID[100];
+    dcmGenerateUniqueIdentifier(trackingUID, SITE_INSTANCE_UID_ROOT);
+
+    // the group with the Image Library entries and evidence of its sources,
+    //  as tid1411test --append
+    DSRDocument update;
+    update.createNewDocument(DSRTypes::DT_ComprehensiveSR);
+    update.getTree().addContentItem(DSRTypes::RT_isRoot, DSRTypes::VT_Container);
+    update.getTree().getCurrentContentItem().setConceptName(
+                dcmHelpersTerminology::get(dcmHelpersTerminology::CODE_QuantitativeMeasurementReport));
+    update.getTree().addContentItem(DSRTypes::RT_contains, DSRTypes::VT_Container, DSRTypes::AM_belowCurrent);
+    update.getTree().getCurrentContentItem().setConceptName(
+                dcmHelpersTerminology::get(dcmHelpersTerminology::CODE_ImageLibrary));
+    addImageLibraryEntries(&update, appendSources.inputs);
+    update.getTree().addContentItem(DSRTypes::RT_contains, DSRTypes::VT_Container, DSRTypes::AM_afterCurrent);
+    update.getTree().getCurrentContentItem().setConceptName(
+                dcmHelpersTerminology::get(dcmHelpersTerminology::CODE_Findings));
+    dcmHelpersCommon::addMeasurementGroup(&update, "Object2", trackingUID, segInstanceUID.c_str(), 1,
+                                          classUIDs, instanceUIDs,
+                                          std::map<std::string, std::vector<long> >(), "17.000",
+                                          appendSources.inputs.front()->getDataset());
+    for(size_t i=0;i<appendSources.inputs.size();i++)
+      update.getCurrentRequestedProcedureEvidence().addItem(*appendSources.inputs[i]->getDataset());
+    DcmFileFormat updateFileFormat;
+    update.write(*updateFileFormat.getDataset());
+    dcmHelpersReportUpdater::appendMeasurementGroups(saved, updateFileFormat.getDataset());
+    validate(saved.getDataset(), "incremental_append");
+    saved.saveFile(appendedFileName.c_str(), EXS_LittleEndianExplicit);
+  })));
+
+  // the reports of one study, each written by DSRDocument and saved with the
+  //  patient and study modules: copied from the source into each, against
+  //  cloned from the set cached for the source file (built once per
+  //  iteration); both allocate the same elements per report
+  std::string studyReportFileName = options.directory + "/srbench_study_report.dcm";
+  stages.push_back(std::make_pair("study_module_copy", std::function<void(Report&)>([&](Report &report){
+    DcmDataset *source = report.inputs.front()->getDataset();
+    for(unsigned i=0;i<options.reportsPerStudy;i++){
+      DcmFileFormat target;
+      report.doc->write(*target.getDataset());
+      dcmHelpersCommon::copyPatientModule(source, target.getDataset());
+      dcmHelpersCommon::copyPatientStudyModule(source, target.getDataset());
+      dcmHelpersCommon::copyGeneralStudyModule(source, target.getDataset());
+      target.saveFile(studyReportFileName.c_str(), EXS_LittleEndianExplicit);
+    }
+  })));
+
+  stages.push_back(std::make_pair("study_module_shared", std::function<void(Report&)>([&](Report &report){
+    DcmDataset *source = report.inputs.front()->getDataset();
+    dcmHelpersStudyModules studyModules;
+    for(unsigned i=0;i<options.reportsPerStudy;i++){
+      DcmFileFormat target;
+      report.doc->write(*target.getDataset());
+      studyModules.copy(ctFiles.front(), source, target.getDataset());
+      target.saveFile(studyReportFileName.c_str(), EXS_LittleEndianExplicit);
+    }
+  })));
+
+  // text export of the report in memory, as tid1411test --json/--xml; the
+  //  exporter keeps its buffer across repetitions like the daemon does
+  dcmHelpersReportExport exporter;
+  stages.push_back(std::make_pair("export_json", std::function<void(Report&)>([&](Report &report){
+    report.outputBytes = exporter.toJSON(report.fileFormat->getDataset()).size();
+  })));
+
+  stages.push_back(std::make_pair("export_xml", std::function<void(Report&)>([&](Report &report){
+    report.outputBytes = exporter.toXML(report.fileFormat->getDataset()).size();
+  })));
+
+  stages.push_back(std::make_pair("dcmtk_write_xml", std::function<void(Report&)>([&](Report &report){
+    std::ostringstream out;
+    report.fileFormat->getDataset()->writeXML(out);
+    report.outputBytes = out.str().size();
+  })));
+
+  // the DCMTK command line tool, including process start and parsing of the
+  //  saved report; only measured when it is installed
+  std::string dcm2jsonFileName = options.directory + "/srbench_report.json";
+  if(system("dcm2json --version >/dev/null 2>&1") == 0){
+    std::string command = "dcm2json " + reportFileName + " " + dcm2jsonFileName + " >/dev/null 2>&1";
+    stages.push_back(std::make_pair("dcm2json", std::function<void(Report&)>([&, command](Report &report){
+      struct stat st;
+      if(system(command.c_str()) == 0 && !stat(dcm2jsonFileName.c_str(), &st))
+        report.outputBytes = st.st_size;
+    })));
+  } else {
+    std::cerr << "dcm2json not found, not measured" << std::endl;
+  }
+
+  for(size_t s=0;s<stages.size();s++){
+    results.push_back(StageResult(stages[s].first));
+    if(stages[s].first.compare(0, 13, "study_module_") == 0)
+      results.back().reports = options.reportsPerStudy;
+  }
+
+  for(unsigned r=0;r<options.repetitions;r++){
+    Report report;
+    for(size_t s=0;s<stages.size();s++){
+      unsigned long long allocations = allocationCount, bytes = allocatedBytes;
+      report.outputBytes = 0;
+      std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+      stages[s].second(report);
+      results[s].seconds.push_back(secondsSince(start));
+      results[s].allocations += allocationCount - allocations;
+      results[s].bytes += allocatedBytes - bytes;
+      results[s].outputBytes += report.outputBytes;
+      results[s].peakRSSKB = std::max(results[s].peakRSSKB, peakRSSKB());
+    }
+  }
+
+  if(options.jsonFileName.empty()){
+    writeJSON(std::cout, options, results);
+  } else {
+    std::ofstream out(options.jsonFileName.c_str());
+    writeJSON(out, options, results);
+  }
+
+  return 0;
+}
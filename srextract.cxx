@@ -0,0 +1,143 @@
+// Extracts the TID 1411 measurements of many SR documents into a columnar
+// table (see dcmHelpersMeasurementTable.h) and optionally CSV. Documents are
+// parsed in parallel as plain datasets, without DSRDocument::read. With
+// --query, prints the rows of an existing table that match column=value
+// filters on its string columns as CSV.
+
+// STL includes
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// DCMTK includes
+#include "dcmtk/config/osconfig.h"    /* make sure OS specific configuration is included first */
+
+#include "dcmtk/dcmdata/dcfilefo.h"
+#include "dcmHelpersCommon.h"
+#include "dcmHelpersMeasurementTable.h"
+#include "dcmHelpersThreadPool.h"
+
+int query(const std::string &tableFileName, const std::vector<std::string> &filters){
+  dcmHelpersMeasurementTable table;
+  if(!table.open(tableFileName))
+    return -1;
+
+  std::vector<std::pair<unsigned, std::string> > conditions;
+  for(size_t i=0;i<filters.size();i++){
+    size_t separator = filters[i].find('=');
+    int column = separator == std::string::npos ? -1 : table.findColumn(filters[i].substr(0, separator));
+    if(column < 0 || table.getColumnType(column) != dcmHelpersMeasurementTable::CT_String){
+      std::cerr << "Filter " << filters[i] << " does not name a string column" << std::endl;
+      return -1;
+    }
+    conditions.push_back(std::make_pair(unsigned(column), filters[i].substr(separator + 1)));
+  }
+
+  std::vector<dcmHelpersMeasurement> measurements;
+  std::string value;
+  for(unsigned long long row=0;row<table.getNumberOfRows();row++){
+    bool matches = true;
+    for(size_t i=0;i<conditions.size() && matches;i++){
+      if(!table.getString(conditions[i].first, row, value))
+        return -1;
+      matches = value == conditions[i].second;
+    }
+    if(!matches)
+      continue;
+    measurements.push_back(dcmHelpersMeasurement());
+    if(!table.getMeasurement(row, measurements.back())){
+      std::cerr << tableFileName << " lacks the measurement columns" << std::endl;
+      return -1;
+    }
+  }
+  dcmHelpersMeasurementTable::writeCSV(std::cout, measurements);
+  return 0;
+}
+
+int main(int argc, char** argv)
+{
+  unsigned threads = 0;
+  std::string csvFileName;
+  bool queryTable = false;
+  int argi = 1;
+  for(;argi<argc && !strncmp(argv[argi], "--", 2);argi++){
+    if(!strcmp(argv[argi], "--threads") && argi+1<argc){
+      threads = atoi(argv[++argi]);
+    } else if(!strcmp(argv[argi], "--csv") && argi+1<argc){
+      csvFileName = argv[++argi];
+    } else if(!strcmp(argv[argi], "--query")){
+      queryTable = true;
+    } else {
+      std::cerr << "Unknown option " << argv[argi] << std::endl;
+      return -1;
+    }
+  }
+
+  if(argc-argi < (queryTable ? 1 : 2)){
+    std::cerr << "Usage: " << argv[0] << " [--threads N] [--csv table.csv] table.srmx sr.dcm|directory ..." << std::endl
+              << "       " << argv[0] << " --query table.srmx [column=value ...]" << std::endl;
+    return -1;
+  }
+  if(queryTable)
+    return query(argv[argi], std::vector<std::string>(argv + argi + 1, argv + argc));
+
+  std::string tableFileName = argv[argi];
+  std::vector<std::string> files;
+  for(int i=argi+1;i<argc;i++)
+    dcmHelpersCommon::collectFiles(argv[i], files);
+
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+  // files are handed out in batches; results are kept per batch so that the
+  // table is in input order regardless of completion order
+  const size_t batchSize = 64;
+  size_t numberOfBatches = (files.size() + batchSize - 1) / batchSize;
+  std::vector<std::vector<dcmHelpersMeasurement> > results(numberOfBatches);
+  std::vector<unsigned long> failures(numberOfBatches, 0);
+  std::mutex errorMutex;
+  {
+    dcmHelpersThreadPool pool(threads);
+    for(size_t b=0;b<numberOfBatches;b++){
+      pool.submit([&, b](){
+        for(size_t i=b*batchSize;i<std::min(files.size(), (b+1)*batchSize);i++){
+          DcmFileFormat fileFormat;
+          if(fileFormat.loadFile(files[i].c_str()).bad() ||
+             !dcmHelpersMeasurementTable::extract(fileFormat.getDataset(), files[i], results[b])){
+            std::lock_guard<std::mutex> lock(errorMutex);
+            std::cerr << "Skipping " << files[i] << ", not a structured report" << std::endl;
+            failures[b]++;
+          }
+        }
+      });
+    }
+    pool.wait();
+  }
+
+  std::vector<dcmHelpersMeasurement> measurements;
+  unsigned long failed = 0;
+  for(size_t b=0;b<numberOfBatches;b++){
+    measurements.insert(measurements.end(), results[b].begin(), results[b].end());
+    std::vector<dcmHelpersMeasurement>().swap(results[b]);
+    failed += failures[b];
+  }
+  double extractSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  if(!dcmHelpersMeasurementTable::writeColumnar(tableFileName, measurements))
+    return -1;
+  if(!csvFileName.empty()){
+    std::ofstream csv(csvFileName.c_str());
+    dcmHelpersMeasurementTable::writeCSV(csv, measurements);
+  }
+
+  std::cout << "Extracted " << measurements.size() << " measurements from "
+            << files.size() - failed << " reports (" << failed << " skipped) in "
+            << extractSeconds << " s, " << (extractSeconds > 0 ? files.size() / extractSeconds : 0)
+            << " reports/s" << std::endl;
+  return 0;
+}
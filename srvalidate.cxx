@@ -0,0 +1,91 @@
+// Validates many SR documents in parallel (see dcmHelpersReportValidator.h)
+// and lists the problems of each nonconforming report. Exits with 1 if any
+// report does not conform.
+
+// STL includes
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// DCMTK includes
+#include "dcmtk/config/osconfig.h"    /* make sure OS specific configuration is included first */
+
+#include "dcmtk/dcmdata/dcfilefo.h"
+#include "dcmHelpersCommon.h"
+#include "dcmHelpersReportValidator.h"
+#include "dcmHelpersThreadPool.h"
+
+int main(int argc, char** argv)
+{
+  unsigned threads = 0;
+  bool quiet = false;
+  int argi = 1;
+  for(;argi<argc && !strncmp(argv[argi], "--", 2);argi++){
+    if(!strcmp(argv[argi], "--threads") && argi+1<argc){
+      threads = atoi(argv[++argi]);
+    } else if(!strcmp(argv[argi], "--quiet")){
+      quiet = true;
+    } else {
+      std::cerr << "Unknown option " << argv[argi] << std::endl;
+      return -1;
+    }
+  }
+
+  if(argc-argi < 1){
+    std::cerr << "Usage: " << argv[0] << " [--threads N] [--quiet] sr.dcm|directory ..." << std::endl;
+    return -1;
+  }
+
+  std::vector<std::string> files;
+  for(int i=argi;i<argc;i++)
+    dcmHelpersCommon::collectFiles(argv[i], files);
+
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+  // problems are kept per file and printed in input order
+  const size_t batchSize = 64;
+  size_t numberOfBatches = (files.size() + batchSize - 1) / batchSize;
+  std::vector<std::vector<std::string> > problems(files.size());
+  std::vector<char> unreadable(files.size(), 0);
+  {
+    dcmHelpersThreadPool pool(threads);
+    for(size_t b=0;b<numberOfBatches;b++){
+      pool.submit([&, b](){
+        for(size_t i=b*batchSize;i<std::min(files.size(), (b+1)*batchSize);i++){
+          DcmFileFormat fileFormat;
+          if(fileFormat.loadFile(files[i].c_str()).bad())
+            unreadable[i] = 1;
+          else
+            dcmHelpersReportValidator::validate(fileFormat.getDataset(), problems[i]);
+        }
+      });
+    }
+    pool.wait();
+  }
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  unsigned long invalid = 0, failed = 0;
+  for(size_t i=0;i<files.size();i++){
+    if(unreadable[i]){
+      failed++;
+      std::cerr << files[i] << ": cannot be read" << std::endl;
+      continue;
+    }
+    if(problems[i].empty())
+      continue;
+    invalid++;
+    if(quiet)
+      continue;
+    for(size_t p=0;p<problems[i].size();p++)
+      std::cout << files[i] << ": " << problems[i][p] << std::endl;
+  }
+
+  std::cout << "Validated " << files.size() - failed << " reports (" << failed << " unreadable), "
+            << invalid << " do not conform, in " << seconds << " s, "
+            << (seconds > 0 ? files.size() / seconds : 0) << " reports/s" << std::endl;
+  return invalid || failed ? 1 : 0;
+}
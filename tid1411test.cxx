@@ -1,5 +1,12 @@
 // STL includes
+#include <algorithm>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
+#include <map>
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -20,54 +27,447 @@
 #include "dcmtk/dcmdata/dcfilefo.h"
 #include "dcmtk/dcmsr/dsriodcc.h"
 #include "dcmHelpersCommon.h"
-
-#define WARN_IF_ERROR(FunctionCall,Message) if(!FunctionCall) std::cout << "Return value is 0 for " << Message << std::endl;
+#include "dcmHelpersFrameDecoder.h"
+#include "dcmHelpersFolderWatcher.h"
+#include "dcmHelpersFrameIndex.h"
+#include "dcmHelpersHeaderCache.h"
+#include "dcmHelpersInputRegistry.h"
+#include "dcmHelpersJobService.h"
+#include "dcmHelpersOutputWriter.h"
+#include "dcmHelpersPrefetcher.h"
+#include "dcmHelpersReportExport.h"
+#include "dcmHelpersReportUpdater.h"
+#include "dcmHelpersReportValidator.h"
+#include "dcmHelpersSegmentation.h"
+#include "dcmHelpersStudyModules.h"
+#include "dcmHelpersTerminology.h"
+#include "dcmHelpersUIDIndex.h"
+
+#define WARN_IF_ERROR(FunctionCall,Message) do { if(!(FunctionCall)) std::cout << "Return value is 0 for " << Message << std::endl; } while(0)
+
+struct ReportJob {
+  std::string segFileName;
+  std::vector<std::string> imageFileNames;
+  std::string archiveRoot;
+  std::string outputFileName;
+  std::string appendFileName;
+  // optional DICOM JSON and XML renderings of the written report
+  std::string jsonFileName;
+  std::string xmlFileName;
+  unsigned short segmentNumber;
+};
+
+// state shared by the reports of one process
+struct ReportContext {
+  dcmHelpersFrameDecoder *decoder;
+  dcmHelpersHeaderCache *headerCache;
+  dcmHelpersUIDIndex *uidIndex;
+  dcmHelpersReportExport *exporter;
+  // bulk output of batch runs; NULL to save each report as a file
+  dcmHelpersOutputWriter *writer;
+  dcmHelpersStudyModules *studyModules;
+  dcmHelpersPrefetcher *prefetcher;
+  // the UID index is kept current as files arrive, so the archive is not
+  //  rescanned for an instance it lacks
+  bool archiveIndexed;
+  bool verbose;
+};
+
+int generateReport(const ReportJob &job, ReportContext &context, std::string &writtenFileName);
+
+bool runReportJob(const dcmHelpersJobService::Request &request, ReportContext &context, std::string &message);
+
+bool runWatchJob(const std::string &segFileName, const ReportJob &options, const std::string &outputDirectory,
+                 ReportContext &context);
+
+void stopWatching(int);
 
 int getReferencedInstances(DcmDataset* dataset,
+                            const std::vector<dcmHelpersSegFrame> &segFrames,
                             std::vector<std::string> &classUIDs,
                             std::vector<std::string> &instanceUIDs);
 
+bool computeSegmentStatistics(DcmDataset* datasetSEG, const char* segFileName,
+                              const std::vector<dcmHelpersSegFrame> &segFrames,
+                              unsigned short segmentNumber,
+                              const std::map<std::string, const dcmHelpersInputRegistry::Input*> &sourceImages,
+                              dcmHelpersFrameDecoder &decoder,
+                              dcmHelpersSegmentStatistics &statistics);
+
+void addImageLibraryEntries(DSRDocument *doc, const dcmHelpersInputRegistry::Input *input,
+                            const std::map<std::string, std::vector<long> > &referencedFrames);
+
+bool isValidReport(DcmItem *dataset, const std::string &fileName);
+
+bool saveReport(DcmFileFormat &fileFormat, const ReportJob &job, ReportContext &context,
+                std::string &writtenFileName);
+
+bool exportReport(DcmItem *dataset, const ReportJob &job, ReportContext &context);
+
+bool appendMeasurementGroup(const std::string &reportFileName, const char* outputFileName,
+                            DcmFileFormat &report,
+                            const std::vector<const dcmHelpersInputRegistry::Input*> &sourceInputs,
+                            DcmDataset* datasetSEG, const char* trackingIdentifier,
+                            const char* segInstanceUID, unsigned short segmentNumber,
+                            const std::vector<std::string> &classUIDs,
+                            const std::vector<std::string> &instanceUIDs,
+                            const std::map<std::string, std::vector<long> > &referencedFrames,
+                            const std::string &meanValue);
+
 int main(int argc, char** argv)
 {
-  char* segFileName = argv[1];
+  ReportJob job;
+  job.outputFileName = "report.dcm";
+  job.segmentNumber = 1;
+  unsigned decodeThreads = 0;
+  std::string socketPath;
+  unsigned long cacheMB = 512, memoryBudgetMB = 2048, jobMemoryMB = 64, maxQueue = 64;
+  std::string containerPath;
+  dcmHelpersOutputWriter::Format containerFormat = dcmHelpersOutputWriter::F_Tar;
+  unsigned syncBatch = 64, writerQueue = 16, syncDelayMs = 1000;
+  std::string watchDirectory, outputDirectory = ".", watchStatistics;
+  unsigned debounceMs = 200;
+  unsigned prefetchDepth = 4;
+  unsigned long prefetchBudgetMB = 256;
+  ReportContext context;
+  context.archiveIndexed = false;
+  context.verbose = true;
+  int argi = 1;
+  for(;argi<argc && !strncmp(argv[argi], "--", 2);argi++){
+    if(!strcmp(argv[argi], "--decode-threads") && argi+1<argc){
+      decodeThreads = atoi(argv[++argi]);
+    } else if(!strcmp(argv[argi], "--prefetch-depth") && argi+1<argc){
+      prefetchDepth = atoi(argv[++argi]);
+    } else if(!strcmp(argv[argi], "--prefetch-budget-mb") && argi+1<argc){
+      prefetchBudgetMB = strtoul(argv[++argi], NULL, 10);
+    } else if(!strcmp(argv[argi], "--segment") && argi+1<argc){
+      job.segmentNumber = atoi(argv[++argi]);
+    } else if(!strcmp(argv[argi], "--append") && argi+1<argc){
+      job.appendFileName = argv[++argi];
+    } else if(!strcmp(argv[argi], "--output") && argi+1<argc){
+      job.outputFileName = argv[++argi];
+    } else if(!strcmp(argv[argi], "--json") && argi+1<argc){
+      job.jsonFileName = argv[++argi];
+    } else if(!strcmp(argv[argi], "--xml") && argi+1<argc){
+      job.xmlFileName = argv[++argi];
+    } else if(!strcmp(argv[argi], "--root") && argi+1<argc){
+      job.archiveRoot = argv[++argi];
+    } else if(!strcmp(argv[argi], "--daemon") && argi+1<argc){
+      socketPath = argv[++argi];
+    } else if(!strcmp(argv[argi], "--cache-mb") && argi+1<argc){
+      cacheMB = strtoul(argv[++argi], NULL, 10);
+    } else if(!strcmp(argv[argi], "--memory-budget-mb") && argi+1<argc){
+      memoryBudgetMB = strtoul(argv[++argi], NULL, 10);
+    } else if(!strcmp(argv[argi], "--job-memory-mb") && argi+1<argc){
+      jobMemoryMB = strtoul(argv[++argi], NULL, 10);
+    } else if(!strcmp(argv[argi], "--max-queue") && argi+1<argc){
+      maxQueue = strtoul(argv[++argi], NULL, 10);
+    } else if(!strcmp(argv[argi], "--container") && argi+2<argc &&
+              dcmHelpersOutputWriter::parseFormat(argv[argi+1], containerFormat)){
+      containerPath = argv[argi+2];
+      argi += 2;
+    } else if(!strcmp(argv[argi], "--sync-batch") && argi+1<argc){
+      syncBatch = atoi(argv[++argi]);
+    } else if(!strcmp(argv[argi], "--writer-queue") && argi+1<argc){
+      writerQueue = atoi(argv[++argi]);
+    } else if(!strcmp(argv[argi], "--sync-delay-ms") && argi+1<argc){
+      syncDelayMs = atoi(argv[++argi]);
+    } else if(!strcmp(argv[argi], "--watch") && argi+1<argc){
+      watchDirectory = argv[++argi];
+    } else if(!strcmp(argv[argi], "--output-dir") && argi+1<argc){
+      outputDirectory = argv[++argi];
+    } else if(!strcmp(argv[argi], "--debounce-ms") && argi+1<argc){
+      debounceMs = atoi(argv[++argi]);
+    } else if(!strcmp(argv[argi], "--watch-stats") && argi+1<argc){
+      watchStatistics = argv[++argi];
+    } else {
+      std::cerr << "Unknown option " << argv[argi] << std::endl;
+      return -1;
+    }
+  }
 
-  char* imageFileName = argv[2];
+  if(socketPath.empty() && watchDirectory.empty() &&
+     (argc-argi < 1 || (argc-argi < 2 && job.archiveRoot.empty()))){
+    std::cerr << "Usage: " << argv[0] << " [--decode-threads N] [--prefetch-depth N] [--prefetch-budget-mb N]"
+              << " [--segment N] [--append report.dcm] [--output report.dcm] [--json report.json]"
+              << " [--xml report.xml] [--root archive] seg.dcm [image.dcm ...]" << std::endl
+              << "       " << argv[0] << " --daemon socket [--cache-mb N] [--memory-budget-mb N] [--job-memory-mb N] [--max-queue N]"
+              << " [--decode-threads N] [--prefetch-depth N] [--prefetch-budget-mb N]"
+              << " [--container tar|zip|dicomdir path] [--sync-batch N] [--sync-delay-ms N] [--writer-queue N]" << std::endl
+              << "       " << argv[0] << " --watch directory [--output-dir directory] [--debounce-ms N]"
+              << " [--watch-stats stats.json] [--root archive] [--segment N] [--max-queue N] [--cache-mb N]"
+              << " [--container tar|zip|dicomdir path] [--sync-batch N] [--sync-delay-ms N] [--writer-queue N]" << std::endl;
+    return -1;
+  }
 
-  std::vector<std::string> referencedImages;
-  for(int i=2;i<argc;i++){
-    referencedImages.push_back(argv[i]);
+  dcmHelpersFrameDecoder::registerCodecs();
+
+  dcmHelpersFrameDecoder decoder(decodeThreads);
+  dcmHelpersHeaderCache headerCache(cacheMB*1048576UL);
+  dcmHelpersUIDIndex uidIndex;
+  dcmHelpersReportExport exporter;
+  dcmHelpersStudyModules studyModules;
+  // the ring or reader threads of the prefetcher serve all jobs
+  dcmHelpersPrefetcher prefetcher(prefetchDepth, prefetchBudgetMB*1048576UL);
+  context.decoder = &decoder;
+  context.headerCache = socketPath.empty() && watchDirectory.empty() ? NULL : &headerCache;
+  context.uidIndex = &uidIndex;
+  context.exporter = &exporter;
+  context.studyModules = &studyModules;
+  context.prefetcher = &prefetcher;
+
+  // reports and exports of all jobs go into one container, synced per batch
+  std::unique_ptr<dcmHelpersOutputWriter> writer;
+  if(!containerPath.empty()){
+    writer.reset(new dcmHelpersOutputWriter(containerFormat, containerPath, syncBatch, writerQueue, syncDelayMs));
+    if(!writer->open())
+      return -1;
+  }
+  context.writer = writer.get();
+
+  int result = 0;
+  if(!watchDirectory.empty()){
+    // the UID index follows the landing directory: files present are indexed
+    //  once, and arriving files as they are completed
+    context.verbose = false;
+    context.archiveIndexed = true;
+    if(job.archiveRoot.empty())
+      job.archiveRoot = watchDirectory;
+    else
+      uidIndex.scan(job.archiveRoot);
+    uidIndex.scan(watchDirectory);
+    dcmHelpersFolderWatcher watcher([&uidIndex](const std::string &path){
+        std::string sopClassUID;
+        return uidIndex.add(path, &sopClassUID) && sopClassUID == UID_SegmentationStorage;
+      }, [&job, &outputDirectory, &context](const std::string &path){
+        return runWatchJob(path, job, outputDirectory, context);
+      }, debounceMs, maxQueue);
+    if(!watchStatistics.empty())
+      watcher.setStatisticsFile(watchStatistics);
+    signal(SIGINT, stopWatching);
+    signal(SIGTERM, stopWatching);
+    std::cout << "Watching " << watchDirectory << ", " << uidIndex.size() << " instances indexed" << std::endl;
+    if(!watcher.run(watchDirectory))
+      result = -1;
+    watcher.printStatistics(std::cout);
+  } else if(socketPath.empty()){
+    job.segFileName = argv[argi];
+    for(int i=argi+1;i<argc;i++)
+      job.imageFileNames.push_back(argv[i]);
+    std::string writtenFileName;
+    result = generateReport(job, context, writtenFileName);
+  } else {
+    // the decoder threads, parsed headers and UID index stay warm between jobs
+    context.verbose = false;
+    dcmHelpersJobService service([&context](const dcmHelpersJobService::Request &request, std::string &message){
+        return runReportJob(request, context, message);
+      }, maxQueue, memoryBudgetMB*1048576UL, jobMemoryMB*1048576UL);
+    // cached headers and the reservations of the jobs count against the budget
+    service.setMemoryUsage([&headerCache](){ return headerCache.getMemoryUsage(); });
+    service.setMemoryRelief([&headerCache, cacheMB](){ headerCache.trim(cacheMB*1048576UL/2); });
+    service.setStatisticsWriter([&headerCache, &uidIndex, &writer](std::ostream &out){
+        headerCache.writeJSON(out);
+        out << ", \"indexed_instances\": " << uidIndex.size();
+        if(writer){
+          out << ", ";
+          writer->writeJSON(out);
+        }
+      });
+    std::cout << "Serving report jobs on " << socketPath << std::endl;
+    if(!service.run(socketPath))
+      result = -1;
   }
 
-  DcmFileFormat *fileformatSR = new DcmFileFormat();
-  DcmFileFormat *fileformatSEG = new DcmFileFormat();
-  DcmFileFormat *fileformatImage = new DcmFileFormat();
+  if(writer){
+    if(!writer->close())
+      result = -1;
+    writer->printStatistics(std::cout);
+  }
+  if(!socketPath.empty() || !watchDirectory.empty()){
+    prefetcher.printStatistics(std::cout);
+    studyModules.printStatistics(std::cout);
+  }
+
+  dcmHelpersFrameDecoder::cleanupCodecs();
+
+  return result;
+}
+
+/*
+ * Files read ahead for one job; those the job did not load are discarded
+ * when it ends, so that they do not hold on to the prefetch budget.
+ */
+class PrefetchedFiles {
+  public:
+    explicit PrefetchedFiles(dcmHelpersPrefetcher &prefetcher) : prefetcher(prefetcher) {}
+    ~PrefetchedFiles() { prefetcher.discard(paths); }
+
+    // headers in the cache are not read again
+    void prefetch(std::vector<std::string> files, dcmHelpersHeaderCache *headerCache){
+      if(headerCache)
+        files.erase(std::remove_if(files.begin(), files.end(), [headerCache](const std::string &path){
+            return headerCache->contains(path); }), files.end());
+      prefetcher.prefetch(files);
+      paths.insert(paths.end(), files.begin(), files.end());
+    }
+
+  private:
+    dcmHelpersPrefetcher &prefetcher;
+    std::vector<std::string> paths;
+};
+
+/*
+ * Build the report of one segment, or append it to an existing report.
+ * Source images that are referenced by the segmentation but not given are
+ * looked up by SOPInstanceUID below the archive root of the job.
+ */
+int generateReport(const ReportJob &job, ReportContext &context, std::string &writtenFileName)
+{
+  const char* segFileName = job.segFileName.c_str();
+  unsigned short segmentNumber = job.segmentNumber;
+  dcmHelpersFrameDecoder &decoder = *context.decoder;
+
+  // read the inputs ahead, in the order they are loaded below; headers that
+  //  are cached already are not read again, and files the job does not load
+  //  are dropped when it ends
+  dcmHelpersPrefetcher &prefetcher = *context.prefetcher;
+  PrefetchedFiles inputFiles(prefetcher);
+  std::vector<std::string> givenFiles(1, job.segFileName);
+  givenFiles.insert(givenFiles.end(), job.imageFileNames.begin(), job.imageFileNames.end());
+  inputFiles.prefetch(givenFiles, context.headerCache);
+
+  // each input is parsed once, and freed when the registry goes out of scope
+  //  unless the header cache keeps it
+  dcmHelpersInputRegistry inputs(&prefetcher, context.headerCache);
 
   DcmElement *e;
 
   std::vector<std::string> referencedClassUIDs, referencedInstanceUIDs;
-  std::string referencedStudyInstanceUID;
-
-  // read the image
-  fileformatImage->loadFile(imageFileName);
-  DcmDataset *datasetImage = fileformatImage->getDataset();
-  char *imageSeriesInstanceUIDPtr;
-  datasetImage->findAndGetElement(DCM_SeriesInstanceUID,
-                                  e);
-  e->getString(imageSeriesInstanceUIDPtr);
 
   // read SEG and find out the study, series and instance UIDs
   //  of the source images used for segmentation
-  fileformatSEG->loadFile(segFileName);
-  DcmDataset *datasetSEG = fileformatSEG->getDataset();
-  if(!getReferencedInstances(datasetSEG, referencedClassUIDs, referencedInstanceUIDs)){
+  DcmDataset *datasetSEG = inputs.loadDataset(segFileName);
+  if(!datasetSEG)
+    return -1;
+  std::vector<dcmHelpersSegFrame> segFrames;
+  dcmHelpersSegmentation::getFrames(datasetSEG, segFrames);
+  if(!getReferencedInstances(datasetSEG, segFrames, referencedClassUIDs, referencedInstanceUIDs)){
       std::cerr << "Failed to find references to the source image" << std::endl;
       return -1;
   }
+  // frames of multi-frame source images (enhanced CT/MR) that are segmented;
+  //  only these are referenced and decoded
+  std::map<std::string, std::vector<long> > referencedFrames;
+  for(size_t i=0;i<segFrames.size();i++){
+    if(segFrames[i].referencedFrameNumber <= 0)
+      continue;
+    std::vector<long> &frames = referencedFrames[segFrames[i].referencedSOPInstanceUID];
+    if(std::find(frames.begin(), frames.end(), segFrames[i].referencedFrameNumber) == frames.end())
+      frames.push_back(segFrames[i].referencedFrameNumber);
+  }
+  for(std::map<std::string, std::vector<long> >::iterator it=referencedFrames.begin();
+      it!=referencedFrames.end();++it)
+    std::sort(it->second.begin(), it->second.end());
 
   char* segInstanceUIDPtr;
   datasetSEG->findAndGetElement(DCM_SOPInstanceUID, e);
   e->getString(segInstanceUIDPtr);
 
+  // inputs given twice are listed once; the registry returns the already
+  //  parsed object
+  std::vector<const dcmHelpersInputRegistry::Input*> sourceInputs;
+  for(size_t i=0;i<job.imageFileNames.size();i++){
+    const dcmHelpersInputRegistry::Input *input = inputs.load(job.imageFileNames[i]);
+    if(input && std::find(sourceInputs.begin(), sourceInputs.end(), input) == sourceInputs.end())
+      sourceInputs.push_back(input);
+  }
+
+  // referenced instances that were not given are taken from the archive; the
+  //  index is only rescanned when an instance is not known yet, and never in
+  //  watch mode. They are all resolved first, so that they are read ahead
+  //  while the first are parsed
+  if(!job.archiveRoot.empty()){
+    bool scanned = context.archiveIndexed;
+    std::vector<std::string> archiveFiles;
+    for(size_t i=0;i<referencedInstanceUIDs.size();i++){
+      if(inputs.findBySOPInstanceUID(referencedInstanceUIDs[i]))
+        continue;
+      std::string path = context.uidIndex->find(referencedInstanceUIDs[i]);
+      if(path.empty() && !scanned){
+        context.uidIndex->scan(job.archiveRoot);
+        scanned = true;
+        path = context.uidIndex->find(referencedInstanceUIDs[i]);
+      }
+      if(path.empty()){
+        std::cerr << "Source image " << referencedInstanceUIDs[i] << " not found below "
+                  << job.archiveRoot << std::endl;
+        continue;
+      }
+      archiveFiles.push_back(path);
+    }
+    inputFiles.prefetch(archiveFiles, context.headerCache);
+    for(size_t i=0;i<archiveFiles.size();i++){
+      const dcmHelpersInputRegistry::Input *input = inputs.load(archiveFiles[i]);
+      if(input && std::find(sourceInputs.begin(), sourceInputs.end(), input) == sourceInputs.end())
+        sourceInputs.push_back(input);
+    }
+  }
+  if(sourceInputs.empty()){
+    std::cerr << "None of the source images could be loaded" << std::endl;
+    return -1;
+  }
+  // the patient and study modules are taken from the first source image
+  DcmDataset *datasetImage = sourceInputs[0]->getDataset();
+
+  std::map<std::string, const dcmHelpersInputRegistry::Input*> sourceImages;
+  for(size_t i=0;i<sourceInputs.size();i++)
+    if(!sourceInputs[i]->sopInstanceUID.empty())
+      sourceImages[sourceInputs[i]->sopInstanceUID] = sourceInputs[i];
+
+  // Measurement container: TID 1419
+  //  mean of the source image values within the segment, decoding the
+  //  (possibly compressed) frames of the source images and the segmentation;
+  //  no report is written without it
+  dcmHelpersSegmentStatistics statistics;
+  bool measured = computeSegmentStatistics(datasetSEG, segFileName, segFrames, segmentNumber,
+                                           sourceImages, decoder, statistics);
+  if(context.verbose){
+    decoder.printStatistics(std::cout);
+    prefetcher.printStatistics(std::cout);
+    inputs.printStatistics(std::cout);
+  }
+  if(!measured){
+    std::cerr << "Failed to compute the statistics of segment " << segmentNumber << std::endl;
+    return -1;
+  }
+  if(!statistics.count){
+    std::cerr << "Segment " << segmentNumber << " does not cover any pixel of the source images" << std::endl;
+    return -1;
+  }
+  char meanStr[32];
+  sprintf(meanStr, "%.3f", statistics.mean());
+  std::string meanValue = meanStr;
+
+  char trackingIdentifier[32];
+  sprintf(trackingIdentifier, "Object%u", segmentNumber);
+
+  // add the measurements to an existing report, keeping its image library
+  if(!job.appendFileName.empty()){
+    DcmFileFormat report;
+    if(!appendMeasurementGroup(job.appendFileName, job.outputFileName.c_str(), report, sourceInputs,
+                               datasetSEG, trackingIdentifier, segInstanceUIDPtr, segmentNumber,
+                               referencedClassUIDs, referencedInstanceUIDs,
+                               referencedFrames, meanValue) ||
+       !saveReport(report, job, context, writtenFileName) ||
+       !exportReport(report.getDataset(), job, context))
+      return -1;
+    if(context.verbose)
+      std::cout << "Appended measurement group " << trackingIdentifier << " to " << job.appendFileName
+                << ", written to " << writtenFileName << std::endl;
+    return 0;
+  }
+
+  DcmFileFormat *fileformatSR = new DcmFileFormat();
   DcmDataset *datasetSR = fileformatSR->getDataset();
 
   /*
@@ -94,29 +494,20 @@ int main(int argc, char** argv)
    *            SOP Common                  M
    */
 
-  OFString reportUID;
-  OFStatus status;
-
   DSRDocument *doc = new DSRDocument();
 
-  size_t node;
-  
-  //
-
-  // TODO: IF SOMETHING DOESN'T WORK - CHECK THE RETURN VALUE!!!
-
   // create root document
   doc->createNewDocument(DSRTypes::DT_ComprehensiveSR);
   doc->setSeriesDescription("ROI quantitative measurement");
 
   // add incofmation about the template used - see CP-452
   //  ftp://medical.nema.org/medical/dicom/final/cp452_ft.pdf
-  node = doc->getTree().addContentItem(DSRTypes::RT_isRoot, DSRTypes::VT_Container);
+  doc->getTree().addContentItem(DSRTypes::RT_isRoot, DSRTypes::VT_Container);
   doc->getTree().getCurrentContentItem().setTemplateIdentification(
               "1000", "99QIICR");
 
   doc->getTree().getCurrentContentItem().setConceptName(
-              DSRCodedEntryValue("10001","99QIICR", "Quantitative measurement report"));
+              dcmHelpersTerminology::get(dcmHelpersTerminology::CODE_QuantitativeMeasurementReport));
 
   // TID1204: Language of content item and descendants
   dcmHelpersCommon::addLanguageOfContent(doc);
@@ -129,15 +520,13 @@ int main(int argc, char** argv)
 
   // TID 4020: Image library
   //  at the same time, add all referenced instances to CurrentRequestedProcedureEvidence sequence
-  node = doc->getTree().addContentItem(DSRTypes::RT_contains, DSRTypes::VT_Container, DSRTypes::AM_afterCurrent);
+  doc->getTree().addContentItem(DSRTypes::RT_contains, DSRTypes::VT_Container, DSRTypes::AM_afterCurrent);
   doc->getTree().getCurrentContentItem().setConceptName(
-              DSRCodedEntryValue("111028", "DCM", "Image Library"));
-  for(int i=0;i<referencedImages.size();i++){
-    DcmFileFormat *fileFormat = new DcmFileFormat();
-    fileFormat->loadFile(referencedImages[i].c_str());    
-    dcmHelpersCommon::addImageLibraryEntry(doc, fileFormat->getDataset());
+              dcmHelpersTerminology::get(dcmHelpersTerminology::CODE_ImageLibrary));
 
-    doc->getCurrentRequestedProcedureEvidence().addItem(*fileFormat->getDataset());
+  for(size_t i=0;i<sourceInputs.size();i++){
+    addImageLibraryEntries(doc, sourceInputs[i], referencedFrames);
+    doc->getCurrentRequestedProcedureEvidence().addItem(*sourceInputs[i]->getDataset());
   }
   doc->getCurrentRequestedProcedureEvidence().addItem(*datasetSEG);
 
@@ -147,76 +536,15 @@ int main(int argc, char** argv)
                                               DSRTypes::AM_afterCurrent),
                 "Findings container");
   doc->getTree().getCurrentContentItem().setConceptName(
-              DSRCodedEntryValue("121070","DCM","Findings"));
+              dcmHelpersTerminology::get(dcmHelpersTerminology::CODE_Findings));
 
   // TID 1411
-  doc->getTree().addContentItem(DSRTypes::RT_contains, DSRTypes::VT_Container, DSRTypes::AM_belowCurrent);
-  doc->getTree().getCurrentContentItem().setConceptName(DSRCodedEntryValue("125007","DCM","Measurement Group"));
-
-  //
-  node = doc->getTree().addContentItem(
-              DSRTypes::RT_hasObsContext, DSRTypes::VT_Text, DSRTypes::AM_belowCurrent);
-  doc->getTree().getCurrentContentItem().setConceptName(
-              DSRCodedEntryValue("112039","DCM","Tracking Identifier"));
-  doc->getTree().getCurrentContentItem().setStringValue("Object1");
-
-  //
-  node = doc->getTree().addContentItem(
-              DSRTypes::RT_hasObsContext, DSRTypes::VT_UIDRef, DSRTypes::AM_afterCurrent);
-
-  doc->getTree().getCurrentContentItem().setConceptName(
-              DSRCodedEntryValue("112040","DCM","Tracking Unique Identifier"));
   char trackingUID[128];
   dcmGenerateUniqueIdentifier(trackingUID, SITE_INSTANCE_UID_ROOT);
-  doc->getTree().getCurrentContentItem().setStringValue(trackingUID);
-
-  node = doc->getTree().addContentItem(
-              DSRTypes::RT_contains, DSRTypes::VT_Image, DSRTypes::AM_afterCurrent);
-  doc->getTree().getCurrentContentItem().setConceptName(
-              DSRCodedEntryValue("121191","DCM","Referenced Segment"));
-
-  DSRImageReferenceValue segReference = DSRImageReferenceValue(UID_SegmentationStorage, segInstanceUIDPtr);
-  segReference.getSegmentList().addItem(1);
-  if(doc->getTree().getCurrentContentItem().setImageReference(segReference).bad()){
-    std::cerr << "Failed to set segmentation image reference" << std::endl;
-  }
-
-  // Referenced series used for segmentation is not stored in the
-  // segmentation object, so need to reference all images instead.
-  // Can initialize if the source images are available.
-  for(int i=0;i<referencedInstanceUIDs.size();i++){
-    node = doc->getTree().addContentItem(
-                DSRTypes::RT_contains, DSRTypes::VT_Image,
-                DSRTypes::AM_afterCurrent);
-    doc->getTree().getCurrentContentItem().setConceptName(
-                DSRCodedEntryValue("121233","DCM","Source image for segmentation"));
-    DSRImageReferenceValue imageReference =
-            DSRImageReferenceValue(referencedClassUIDs[i].c_str(),referencedInstanceUIDs[i].c_str());
-    if(doc->getTree().getCurrentContentItem().setImageReference(imageReference).bad()){
-      std::cerr << "Failed to set source image reference" << std::endl;
-    }
-  }
-
-  // Measurement container: TID 1419
-  DSRNumericMeasurementValue measurement =
-    DSRNumericMeasurementValue("70.978",
-    DSRCodedEntryValue("[hnsf'U]","UCUM","Hounsfield unit"));
-
-  doc->getTree().addContentItem(DSRTypes::RT_contains,
-                                DSRTypes::VT_Num,
-                                DSRTypes::AM_afterCurrent);
-  doc->getTree().getCurrentContentItem().setNumericValue(measurement);
-
-  doc->getTree().getCurrentContentItem().setConceptName(
-              DSRCodedEntryValue("112031","DCM","Attenuation Coefficient"));
-
-  WARN_IF_ERROR(doc->getTree().addContentItem(DSRTypes::RT_hasConceptMod,
-                                DSRTypes::VT_Code,
-                                DSRTypes::AM_belowCurrent), "Failed to add code");
-  assert(doc->getTree().getCurrentContentItem().setConceptName(
-              DSRCodedEntryValue("121401","DCM","Derivation")).good());
-  assert(doc->getTree().getCurrentContentItem().setCodeValue(
-              DSRCodedEntryValue("R-00317","SRT","Mean")).good());
+  dcmHelpersCommon::addMeasurementGroup(doc, trackingIdentifier, trackingUID,
+                                        segInstanceUIDPtr, segmentNumber,
+                                        referencedClassUIDs, referencedInstanceUIDs,
+                                        referencedFrames, meanValue.c_str(), datasetImage);
 
   OFString contentDate, contentTime;
   DcmDate::getCurrentDate(contentDate);
@@ -231,34 +559,136 @@ int main(int argc, char** argv)
   doc->getCodingSchemeIdentification().setCodingSchemeName("QIICR Coding Scheme");
   doc->getCodingSchemeIdentification().setCodingSchemeResponsibleOrganization("Quantitative Imaging for Cancer Research, http://qiicr.org");
 
-  doc->write(*datasetSR);
+  if(doc->write(*datasetSR).bad()){
+    std::cerr << "Failed to write the report document" << std::endl;
+    delete doc;
+    delete fileformatSR;
+    return -1;
+  }
+
+  // the patient and study module attributes are taken from the set cached
+  //  for the reports of the first source image, while that file is unchanged
+  context.studyModules->copy(sourceInputs[0]->path, datasetImage, datasetSR);
 
-  dcmHelpersCommon::copyPatientModule(datasetImage,datasetSR);
-  dcmHelpersCommon::copyPatientStudyModule(datasetImage,datasetSR);
-  dcmHelpersCommon::copyGeneralStudyModule(datasetImage,datasetSR);
+  // the written dataset is validated before it is saved, so that a report
+  //  that does not conform is not written
+  bool written = isValidReport(datasetSR, job.outputFileName) &&
+                 saveReport(*fileformatSR, job, context, writtenFileName) &&
+                 exportReport(datasetSR, job, context);
 
-  fileformatSR->saveFile("report.dcm", EXS_LittleEndianExplicit);
+  delete doc;
+  delete fileformatSR;
 
-  return 0;
+  return written ? 0 : -1;
+}
+
+/*
+ * A job of the daemon mode: the keys seg, image (repeated for each source
+ * image), root, output, append, json, xml and segment correspond to the
+ * command line. With a container, OK means the report is written to it; it
+ * is synced with its batch, at the latest after the sync delay.
+ */
+bool runReportJob(const dcmHelpersJobService::Request &request, ReportContext &context, std::string &message)
+{
+  ReportJob job;
+  job.segmentNumber = 1;
+  for(dcmHelpersJobService::Request::const_iterator it=request.begin();it!=request.end();++it){
+    if(it->first == "seg")
+      job.segFileName = it->second;
+    else if(it->first == "image")
+      job.imageFileNames.push_back(it->second);
+    else if(it->first == "root")
+      job.archiveRoot = it->second;
+    else if(it->first == "output")
+      job.outputFileName = it->second;
+    else if(it->first == "append")
+      job.appendFileName = it->second;
+    else if(it->first == "json")
+      job.jsonFileName = it->second;
+    else if(it->first == "xml")
+      job.xmlFileName = it->second;
+    else if(it->first == "segment")
+      job.segmentNumber = atoi(it->second.c_str());
+    else {
+      message = "unknown key " + it->first;
+      return false;
+    }
+  }
+  if(job.segFileName.empty() || job.outputFileName.empty() ||
+     (job.imageFileNames.empty() && job.archiveRoot.empty())){
+    message = "seg, output and image or root are required";
+    return false;
+  }
+
+  // with a container, the reply waits until the report is written to it
+  std::string writtenFileName;
+  if(generateReport(job, context, writtenFileName) ||
+     (context.writer && !context.writer->waitForWrites())){
+    message = "failed to write " + job.outputFileName;
+    return false;
+  }
+  message = writtenFileName;
+  return true;
 }
 
 
+/*
+ * A job of the watch mode: the report of a segmentation that arrived in the
+ * watched directory, named after it in the output directory. The segment,
+ * archive root and container options apply as for a single report.
+ */
+bool runWatchJob(const std::string &segFileName, const ReportJob &options, const std::string &outputDirectory,
+                 ReportContext &context)
+{
+  ReportJob job;
+  job.segFileName = segFileName;
+  job.archiveRoot = options.archiveRoot;
+  job.segmentNumber = options.segmentNumber;
+  std::string name = segFileName.substr(segFileName.rfind('/') + 1);
+  if(name.size() > 4 && name.compare(name.size() - 4, 4, ".dcm") == 0)
+    name.resize(name.size() - 4);
+  job.outputFileName = outputDirectory + "/" + name + "_SR.dcm";
+
+  std::string writtenFileName;
+  if(generateReport(job, context, writtenFileName) ||
+     (context.writer && !context.writer->waitForWrites())){
+    std::cerr << "Failed to write the report of " << segFileName << std::endl;
+    return false;
+  }
+  std::cout << "Report of " << segFileName << " written to " << writtenFileName << std::endl;
+  return true;
+}
+
+void stopWatching(int)
+{
+  dcmHelpersFolderWatcher::stop();
+}
+
+/*
+ * Source images of the segmentation, listed in the shared functional groups,
+ * or otherwise collected from the per-frame functional groups (as usual for
+ * segmentations of enhanced multi-frame images).
+ */
 int getReferencedInstances(DcmDataset* dataset,
+                            const std::vector<dcmHelpersSegFrame> &segFrames,
                             std::vector<std::string> &classUIDs,
                             std::vector<std::string> &instanceUIDs){
   DcmItem *item, *subitem1, *subitem2;
 
-  if(dataset->findAndGetSequenceItem(DCM_SharedFunctionalGroupsSequence, item).bad()){
-    std::cerr << "Input segmentation does not contain SharedFunctionalGroupsSequence" << std::endl;
-    return 0;
-  }
-  if(item->findAndGetSequenceItem(DCM_DerivationImageSequence, subitem1).bad()){
-      std::cerr << "Input segmentation does not contain DerivationImageSequence" << std::endl;
-      return 0;
-  }
-  if(subitem1->findAndGetSequenceItem(DCM_SourceImageSequence, subitem2).bad()){
+  if(dataset->findAndGetSequenceItem(DCM_SharedFunctionalGroupsSequence, item).bad() ||
+     item->findAndGetSequenceItem(DCM_DerivationImageSequence, subitem1).bad() ||
+     subitem1->findAndGetSequenceItem(DCM_SourceImageSequence, subitem2).bad()){
+    for(size_t i=0;i<segFrames.size();i++){
+      if(segFrames[i].referencedSOPInstanceUID.empty() ||
+         std::find(instanceUIDs.begin(), instanceUIDs.end(),
+                   segFrames[i].referencedSOPInstanceUID) != instanceUIDs.end())
+        continue;
+      classUIDs.push_back(segFrames[i].referencedSOPClassUID);
+      instanceUIDs.push_back(segFrames[i].referencedSOPInstanceUID);
+    }
+    if(instanceUIDs.empty())
       std::cerr << "Input segmentation does not contain SourceImageSequence" << std::endl;
-      return 0;
+    return instanceUIDs.size();
   }
 
   int itemNumber = 0;
@@ -276,3 +706,226 @@ int getReferencedInstances(DcmDataset* dataset,
 
   return classUIDs.size();
 }
+
+/*
+ * Mean of the source image values covered by the given segment. Segmentation
+ * frames are combined per referenced source frame, then the source frames are
+ * decoded concurrently and accumulated as they become available. Fails if any
+ * referenced source frame is not available, rather than measuring a subset.
+ */
+bool computeSegmentStatistics(DcmDataset* datasetSEG, const char* segFileName,
+                              const std::vector<dcmHelpersSegFrame> &segFrames,
+                              unsigned short segmentNumber,
+                              const std::map<std::string, const dcmHelpersInputRegistry::Input*> &sourceImages,
+                              dcmHelpersFrameDecoder &decoder,
+                              dcmHelpersSegmentStatistics &statistics){
+  if(segFrames.empty())
+    return false;
+
+  Uint16 rows = 0, columns = 0, bitsAllocated = 0;
+  datasetSEG->findAndGetUint16(DCM_Rows, rows);
+  datasetSEG->findAndGetUint16(DCM_Columns, columns);
+  datasetSEG->findAndGetUint16(DCM_BitsAllocated, bitsAllocated);
+  size_t numPixels = size_t(rows) * columns;
+
+  // source frame (SOPInstanceUID, 0-based frame) -> union of the segment masks
+  typedef std::pair<std::string, unsigned long> SourceFrame;
+  std::map<SourceFrame, std::vector<unsigned char> > masks;
+  std::vector<size_t> segFrameIndices;
+  for(size_t i=0;i<segFrames.size();i++){
+    if(segFrames[i].segmentNumber == segmentNumber && !segFrames[i].referencedSOPInstanceUID.empty())
+      segFrameIndices.push_back(i);
+  }
+
+  std::vector<unsigned char> mask;
+  const auto addMask = [&](size_t segFrame){
+    const dcmHelpersSegFrame &f = segFrames[segFrame];
+    SourceFrame key(f.referencedSOPInstanceUID,
+                    f.referencedFrameNumber > 0 ? f.referencedFrameNumber - 1 : 0);
+    std::vector<unsigned char> &sourceMask = masks[key];
+    if(sourceMask.empty())
+      sourceMask.swap(mask);
+    else
+      for(size_t p=0;p<numPixels && p<mask.size();p++)
+        sourceMask[p] |= mask[p];
+  };
+
+  // native segmentation frames are read individually through the frame index
+  //  instead of loading all of PixelData
+  std::shared_ptr<const dcmHelpersFrameIndex> segIndex;
+  if(!DcmXfer(datasetSEG->getOriginalXfer()).isEncapsulated())
+    segIndex = dcmHelpersFrameIndex::get(segFileName);
+  if(segIndex){
+    for(size_t i=0;i<segFrameIndices.size();i++){
+      if(!dcmHelpersSegmentation::getFrameMask(*segIndex, segFrameIndices[i], mask))
+        return false;
+      addMask(segFrameIndices[i]);
+    }
+  } else {
+    std::vector<dcmHelpersFrameRequest> segRequests;
+    for(size_t i=0;i<segFrameIndices.size();i++){
+      dcmHelpersFrameRequest request = {segFileName, segFrameIndices[i], segFrameIndices[i], datasetSEG};
+      segRequests.push_back(request);
+    }
+    if(!decoder.decodeFrames(segRequests, [&](const dcmHelpersDecodedFrame &frame){
+        if(bitsAllocated == 1){
+          dcmHelpersSegmentation::unpackBits(frame.data, 0, numPixels, mask);
+        } else {
+          mask.resize(numPixels);
+          for(size_t p=0;p<numPixels && p<frame.length;p++)
+            mask[p] = frame.data[p] ? 1 : 0;
+        }
+        addMask(frame.userIndex);
+      }))
+      return false;
+  }
+
+  std::vector<dcmHelpersFrameRequest> requests;
+  std::vector<const std::vector<unsigned char>*> requestMasks;
+  for(std::map<SourceFrame, std::vector<unsigned char> >::const_iterator it=masks.begin();
+      it!=masks.end();++it){
+    std::map<std::string, const dcmHelpersInputRegistry::Input*>::const_iterator source =
+            sourceImages.find(it->first.first);
+    if(source == sourceImages.end()){
+      std::cerr << "Source image " << it->first.first << " was not provided" << std::endl;
+      return false;
+    }
+    // the decoder takes the header parsed by the input registry
+    dcmHelpersFrameRequest request = {source->second->path, it->first.second, requests.size(),
+                                      source->second->getDataset()};
+    requests.push_back(request);
+    requestMasks.push_back(&it->second);
+  }
+
+  bool accumulated = true;
+  return decoder.decodeFrames(requests, [&](const dcmHelpersDecodedFrame &frame){
+    if(!dcmHelpersSegmentation::accumulate(frame, *requestMasks[frame.userIndex], statistics)){
+      std::cerr << "Cannot compute statistics for " << requests[frame.userIndex].path << std::endl;
+      accumulated = false;
+    }
+  }) && accumulated;
+}
+
+// TID 4020 entry of a source image, one per segmented frame of a multi-frame image
+void addImageLibraryEntries(DSRDocument *doc, const dcmHelpersInputRegistry::Input *input,
+                            const std::map<std::string, std::vector<long> > &referencedFrames){
+  DcmDataset *dataset = input->getDataset();
+  std::map<std::string, std::vector<long> >::const_iterator frames =
+          referencedFrames.find(input->sopInstanceUID);
+  if(frames == referencedFrames.end()){
+    dcmHelpersCommon::addImageLibraryEntry(doc, dataset);
+  } else {
+    for(size_t f=0;f<frames->second.size();f++)
+      dcmHelpersCommon::addImageLibraryEntry(doc, dataset, frames->second[f]);
+  }
+}
+
+/*
+ * Append the Measurement Group of a segment to a report written before. The
+ * group, the Image Library entries of its sources and its evidence are encoded
+ * through a report that contains only them, and then moved into the content
+ * tree of the existing report; entries the report lists already are not added
+ * again, and the report is otherwise left unchanged for the caller to write.
+ */
+bool appendMeasurementGroup(const std::string &reportFileName, const char* outputFileName,
+                            DcmFileFormat &report,
+                            const std::vector<const dcmHelpersInputRegistry::Input*> &sourceInputs,
+                            DcmDataset* datasetSEG, const char* trackingIdentifier,
+                            const char* segInstanceUID, unsigned short segmentNumber,
+                            const std::vector<std::string> &classUIDs,
+                            const std::vector<std::string> &instanceUIDs,
+                            const std::map<std::string, std::vector<long> > &referencedFrames,
+                            const std::string &meanValue){
+  OFCondition cond = report.loadFile(reportFileName.c_str());
+  if(cond.bad()){
+    std::cerr << "Failed to load " << reportFileName << ": " << cond.text() << std::endl;
+    return false;
+  }
+  // the output may replace the input file
+  report.loadAllDataIntoMemory();
+
+  DSRDocument update;
+  update.createNewDocument(DSRTypes::DT_ComprehensiveSR);
+  update.getTree().addContentItem(DSRTypes::RT_isRoot, DSRTypes::VT_Container);
+  update.getTree().getCurrentContentItem().setConceptName(
+              dcmHelpersTerminology::get(dcmHelpersTerminology::CODE_QuantitativeMeasurementReport));
+  update.getTree().addContentItem(DSRTypes::RT_contains, DSRTypes::VT_Container, DSRTypes::AM_belowCurrent);
+  update.getTree().getCurrentContentItem().setConceptName(
+              dcmHelpersTerminology::get(dcmHelpersTerminology::CODE_ImageLibrary));
+  for(size_t i=0;i<sourceInputs.size();i++)
+    addImageLibraryEntries(&update, sourceInputs[i], referencedFrames);
+  update.getTree().addContentItem(DSRTypes::RT_contains, DSRTypes::VT_Container, DSRTypes::AM_afterCurrent);
+  update.getTree().getCurrentContentItem().setConceptName(
+              dcmHelpersTerminology::get(dcmHelpersTerminology::CODE_Findings));
+
+  char trackingUID[128];
+  dcmGenerateUniqueIdentifier(trackingUID, SITE_INSTANCE_UID_ROOT);
+  dcmHelpersCommon::addMeasurementGroup(&update, trackingIdentifier, trackingUID,
+                                        segInstanceUID, segmentNumber, classUIDs, instanceUIDs,
+                                        referencedFrames, meanValue.c_str(),
+                                        sourceInputs[0]->getDataset());
+
+  for(size_t i=0;i<sourceInputs.size();i++)
+    update.getCurrentRequestedProcedureEvidence().addItem(*sourceInputs[i]->getDataset());
+  update.getCurrentRequestedProcedureEvidence().addItem(*datasetSEG);
+
+  DcmFileFormat updateFileFormat;
+  if(update.write(*updateFileFormat.getDataset()).bad() ||
+     !dcmHelpersReportUpdater::appendMeasurementGroups(report, updateFileFormat.getDataset()) ||
+     !isValidReport(report.getDataset(), outputFileName))
+    return false;
+  return true;
+}
+
+/*
+ * Check a report before it is written, so that nonconforming reports are
+ * caught here rather than by the applications reading them.
+ */
+bool isValidReport(DcmItem *dataset, const std::string &fileName){
+  std::vector<std::string> problems;
+  if(dcmHelpersReportValidator::validate(dataset, problems))
+    return true;
+  std::cerr << "Report " << fileName << " does not conform, not written:" << std::endl;
+  for(size_t i=0;i<problems.size();i++)
+    std::cerr << "  " << problems[i] << std::endl;
+  return false;
+}
+
+/*
+ * Write a report to its output file, or queue it for the bulk output writer
+ * of a batch run; writtenFileName is set to the name it is stored under.
+ */
+bool saveReport(DcmFileFormat &fileFormat, const ReportJob &job, ReportContext &context,
+                std::string &writtenFileName){
+  if(context.writer){
+    writtenFileName = context.writer->write(job.outputFileName, fileFormat);
+    return !writtenFileName.empty();
+  }
+  OFCondition cond = fileFormat.saveFile(job.outputFileName.c_str(), EXS_LittleEndianExplicit);
+  if(cond.bad()){
+    std::cerr << "Failed to write " << job.outputFileName << ": " << cond.text() << std::endl;
+    return false;
+  }
+  writtenFileName = job.outputFileName;
+  return true;
+}
+
+// the writer takes over its content, the export buffer stays with the exporter
+bool writeExport(const std::string &fileName, const std::string &text, ReportContext &context){
+  if(!context.writer)
+    return dcmHelpersReportExport::writeFile(fileName, text);
+  std::string content = text;
+  return !context.writer->write(fileName, content, false).empty();
+}
+
+/*
+ * Write the requested text renderings of a saved report from the dataset in
+ * memory; the export buffers of the context are reused from job to job.
+ */
+bool exportReport(DcmItem *dataset, const ReportJob &job, ReportContext &context){
+  if(!job.jsonFileName.empty() && !writeExport(job.jsonFileName, context.exporter->toJSON(dataset), context))
+    return false;
+  if(!job.xmlFileName.empty() && !writeExport(job.xmlFileName, context.exporter->toXML(dataset), context))
+    return false;
+  return true;
+}